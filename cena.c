@@ -10,24 +10,116 @@
  *
  * Descricao:
  * Este programa cria uma cena 3D de um parque urbano ao entardecer com OpenGL.
- * A cena tem: banco, poste com luz, arvore, chao gramado e iluminacao direcional/pontual.
+ * A cena tem: banco, poste com luz, arvore, terreno gramado em blocos (gerados conforme a camera anda) e iluminacao direcional/pontual.
  *
  * Controles:
  * - Mouse: controla para onde a camera olha
- * - Setas: movem a camera na direcao do olhar
+ * - Setas: movem a camera na direcao do olhar, andando sobre o terreno (velocidade fixa enquanto pressionadas)
+ *   e deslizando pelos props em que encosta
+ * - Clique esquerdo ou tecla 'E': escolhe o prop no centro da tela (contorno amarelo, dados no terminal)
  * - Tecla 'A': liga/desliga luz pontual do poste
  * - Tecla 'S': liga/desliga luz direcional (sol)
+ * - Tecla 'M': alterna entre malhas em cache (VBO) e modo imediato (glBegin/glEnd)
+ * - Tecla 'I': alterna entre props instanciados (uma chamada por tipo) e prop a prop
+ * - Tecla 'F': liga/desliga o culling por frustum (BVH sobre as caixas dos props)
+ * - Tecla 'C': imprime os contadores de culling, de LOD, de oclusao, da fila, da hierarquia, do hash espacial
+ *   do escalonador de frames e da resolucao dinamica
+ * - Tecla 'D': liga/desliga o nivel de detalhe (LOD) pelo tamanho do prop na tela
+ * - Tecla 'P': mostra/esconde o HUD com o tempo de CPU e GPU de cada fase do frame
+ * - Tecla 'L': liga/desliga a iluminacao agrupada por clusters (cada poste do layout e uma luz)
+ * - Tecla 'Q': liga/desliga a fila de desenho ordenada por material (contadores no 'C' e no HUD)
+ * - Tecla 'O': liga/desliga as sombras do sol e do poste (mapas em cache, refeitos so quando algo muda)
+ * - Tecla 'J': liga/desliga os mapas de luz (iluminacao do chao e dos props pre-calculada, um conjunto
+ *   por combinacao de 'A' e 'S')
+ * - Tecla 'H': liga/desliga o culling por oclusao (consultas nas caixas da BVH, resposta do frame anterior)
+ * - Tecla 'B': liga/desliga os impostores (props distantes viram retangulos com a imagem de um atlas)
+ * - Tecla 'G': comeca/pausa a gravacao do video (arquivo do --grava ou gravacao.y4m)
+ * - Tecla 'X': grava o proximo frame em captura_NNN.ppm (sem travar o desenho)
+ * - Tecla 'K': liga/desliga a colisao da camera com os props (hash espacial das partes)
+ * - Tecla 'R': liga/desliga a resolucao dinamica (cena num FBO menor para caber no orcamento do frame)
+ * - Tecla 'T': alterna entre desenhar a lista do frame anterior (threads adiantadas) e esperar a do frame
  * - Tecla 'Esc': encerra
+ *
+ * Opcoes de linha de comando:
+ * - --imediato: comeca no modo imediato antigo (para comparar com as malhas em cache)
+ * - --parque N: troca a cena original por um parque gerado com N props (bancos, postes, arvores)
+ * - --terreno-mb N: memoria fixa (MB) para os blocos do terreno carregados na GPU (16; sobe ate o
+ *   minimo que o alcance da camera pede)
+ * - --cena arquivo.cena: carrega o layout de um arquivo de cena binario (mmap, sem parse)
+ * - --salva-cena arquivo.cena: grava o layout em uso (original, gerado ou carregado) em binario
+ * - --converte layout.txt arquivo.cena: converte um layout em texto e sai. Linhas:
+ *   "extensao E", "banco|poste|arvore X Z [rotY escala r g b]", "luz X Y Z [raio r g b]"
+ * - --luzes ambas|sol|poste|nenhuma: luzes ligadas no inicio (padrao: ambas)
+ * - --prop-a-prop: comeca sem instancias (igual a tecla 'I')
+ * - --luzes-agrupadas: comeca com a iluminacao agrupada ligada (igual a tecla 'L')
+ * - --sombras: comeca com as sombras ligadas (igual a tecla 'O')
+ * - --mapas-luz: calcula os mapas de luz no inicio (em paralelo) e comeca com eles ligados (igual a tecla 'J')
+ * - --oclusao: comeca com o culling por oclusao ligado (igual a tecla 'H')
+ * - --sem-colisao: comeca com a colisao da camera desligada (igual a tecla 'K')
+ * - --sem-fila: comeca com a fila ordenada por material desligada (igual a tecla 'Q')
+ * - --headless: sem janela (EGL surfaceless + FBO), percorre um caminho de camera fixo
+ *   e imprime em JSON a media, p50, p95, p99 e maximo do tempo dos frames. Opcoes:
+ *   --quadros N (300), --aquecimento N (10), --largura W (800), --altura H (600),
+ *   --saida arquivo.json (padrao: saida padrao), --imagem arquivo.ppm (ultimo frame)
+ * - --perfil arquivo.csv: grava por frame o tempo de CPU e GPU (ms) de cada fase e a escala da resolucao
+ * - --threads N: threads do culling/LOD por blocos da BVH (padrao: nucleos - 1; 0 = tudo na thread do GL)
+ * - --travessia-sincrona: cada frame espera a sua lista em vez de desenhar a do frame anterior (tecla 'T')
+ * - --fps N: limite de frames por segundo do laco de desenho (60; 0 = sem limite)
+ * - --vsync: sincroniza a troca de buffers com o monitor
+ * - --impostores: comeca com os impostores dos props distantes ligados (igual a tecla 'B')
+ * - --distancia-impostor D: distancia (m) a partir da qual os props viram impostores (40; 0 desliga)
+ * - --impostor-profundidade: cada fragmento do impostor recebe a profundidade do atlas (mais caro no llvmpipe)
+ * - --grava arquivo: grava todos os frames (leitura assincrona por PBOs e thread escritora).
+ *   .y4m = video Y4M, .ppm = PPMs em sequencia, outro = RGB cru; "-" = saida padrao (RGB cru; com
+ *   --headless ou --reproduz exige --saida para o JSON), "|comando" = pipe (ex.: "|ffmpeg -i - video.mp4")
+ * - --resolucao-dinamica MS: liga a resolucao dinamica com um orcamento de MS ms por frame (ex.: 16.6);
+ *   a escala (0,35 a 1) segue o tempo medido dos frames e a imagem e ampliada com realce de nitidez
+ * - --nitidez K: forca do realce na ampliacao (0.6; 0 = so filtro bilinear)
+ * - --edicoes N: gira N props sorteados por frame (so as subarvores editadas sao recalculadas)
+ * - --grava-entrada arquivo.ent: grava a sessao (mouse, teclas, setas, cliques, janela e o instante
+ *   de cada frame) num log binario, com as opcoes de desenho do inicio no cabecalho
+ * - --reproduz arquivo.ent: repete a sessao gravada pelos mesmos handlers, no tempo real em que foi
+ *   gravada (mesmo caminho de camera e mesmos frames), e imprime o JSON dos tempos dos frames no fim.
+ *   Com --headless substitui o caminho fixo do benchmark. Use as mesmas opcoes de cena da gravacao
+ * - --reproducao-rapida: a reproducao desenha os frames em seguida, sem esperar o instante de cada um
+ *
+ * Compilacao:
+ *   gcc cena.c -o cena -lglut -lGLU -lGL -lEGL -lm -lpthread
  */
 
+#define GL_GLEXT_PROTOTYPES // expoe glGenBuffers/glBindBuffer etc. (VBO, GL 1.5)
 #include <GL/glut.h>
+#include <GL/glext.h>
+#include <GL/glx.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <limits.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 //Variaveis globais para gerenciar o tamanho da tela 
 int windowWidth = 800;
 int windowHeight = 600;
 
+// Area em que a cena e desenhada: a janela inteira ou, com a resolucao dinamica, so uma parte do FBO
+int larguraRender = 800;
+int alturaRender = 600;
+float escalaRender = 1.0f; // larguraRender / windowWidth
+bool usarResolucaoDinamica = false; // 'R' liga/desliga
+
 // Variaveis de controle da camera (posicao inicial)
 float cameraX = 0.0f;
 float cameraY = 1.0f; // Altura para simular visao de pessoa
@@ -37,16 +129,76 @@ float cameraZ = 5.0f; // Distancia inicial da cena
 bool luzPontualLigada = true; // poste comeca aceso
 bool luzDirecionalLigada = true; // sol comeca ligado
 
+// Posicao das luzes no mundo (as sombras refazem o mapa de uma luz quando ela muda)
+GLfloat posSol[] = {3.0f, 3.0f, 3.0f, 0.0f};   // W=0.0 -> luz direcional
+GLfloat posPoste[] = {-3.0f, 3.1f, 0.0f, 1.0f}; // W=1.0 -> luz pontual
+
 
 //Variaveis globais para rotacao (para implementacao do stilo fps)
 float angleYaw = 0.0f;   // rotacao horizontal (movimento de mouse esquerda / direita)
 float anglePitch = 0.0f; // rotacao vertical (movimento de mouse cima/ baixo)
 int oldMouseX = 0; // salva posicao anterior do mouse nos 
 int oldMouseY = 0;
+int mouseAcumuladoX = 0; // deslocamento do mouse ainda nao aplicado (o escalonador aplica uma vez por frame)
+int mouseAcumuladoY = 0;
+
+// Matrizes da camera do frame atual (lidas em display logo apos o gluLookAt)
+GLfloat matrizVista[16];
+GLfloat matrizProjecao[16];
+
+// Planos de recorte da projecao (os clusters de luz dividem a profundidade entre eles)
+const float planoPerto = 0.1f;
+const float planoLonge = 100.0f;
+
+// Sem janela (--headless): desenha num FBO de um contexto EGL e mede o tempo dos frames
+bool modoHeadless = false;
+
+// Modo de desenho: false usa as malhas em cache na GPU, true usa o caminho antigo glBegin/glEnd + glut
+bool modoImediato = false;
 
 // DECLARACOES PROTOTIPO
 void configuraIluminacao();
 void drawCena();
+void criaMalhasCena();
+void constroiBVH();
+void alocaNiveisLOD();
+void desenhaHUD();
+void criaPerfil();
+void criaTerreno();
+void criaTravessia();
+void criaOclusao();
+void criaSombras();
+void criaImpostores();
+void criaHierarquia();
+void atualizaHierarquia();
+float* mundoProp(int i);
+void iniciaTravessia();
+void desenhaBanco();
+void desenhaPoste();
+void desenhaArvore();
+void acordaEscalonador();
+void matrizMultiplica(float r[16], const float a[16], const float b[16]);
+void capturaQuadro();
+void capturaJanelaRedimensionada(int largura, int altura);
+bool capturaPendente();
+void criaHashEspacial();
+void criaMapasLuz();
+void calculaMapasLuz();
+void atualizaHashProp(int i);
+void selecionaCentro();
+bool resolveColisao(float* x, float* z, float base, float topo);
+void criaResolucaoDinamica();
+void iniciaResolucaoDinamica();
+void ampliaResolucaoDinamica();
+void ajustaResolucaoDinamica(double ms);
+void desenhaHUDResolucao(int x, int y);
+double relogioEscalonador();
+bool reproducaoAtiva();
+void gravaAcordaEntrada();
+void gravaQuadroEntrada();
+bool iniciaReproducao();
+bool passoReproducao();
+void escreveSessaoEntrada(FILE* f);
 
 // define para onde a camera deve apontar
 void mouseMotion(int x, int y) {
@@ -55,13 +207,9 @@ void mouseMotion(int x, int y) {
     int dy = y - oldMouseY; // o calculo registra o quanto e para onde o mouse foi movido, dx positivo moveu para a direito
                             // dy positivo moveu para baixo
 
-    // Atualiza angulos de rotacao (estilo FPS)
-    angleYaw += dx * 0.3f;     // adiciona rotacao horizontal ao angulo horizontal da camera e 0.3 e a sensibilidade
-    anglePitch -= dy * 0.3f;   // rotacao vertical (invertida para que arraste para frente olhe para cima)
-    
-    //Limita o pitch para evitar inversao entre -89 e 89
-    if (anglePitch > 89.0f) anglePitch = 89.0f; // caso o angulo de visualizacao exceda 89 , trava em 89
-    if (anglePitch < -89.0f) anglePitch = -89.0f;
+    // So acumula: varios eventos entre dois frames viram uma unica rotacao (aplicaMouse)
+    mouseAcumuladoX += dx;
+    mouseAcumuladoY += dy;
     
     //Reposiciona mouse no centro da janela
     int centerX = windowWidth / 2;
@@ -70,10 +218,29 @@ void mouseMotion(int x, int y) {
     if (x != centerX || y != centerY) { // verifica se o mouse saiu do centro, o movimento e calculado
         oldMouseX = centerX;    // salva o movimento e forca o mouse a voltar para o centro fisico da janela
         oldMouseY = centerY;// oldMouseX/Y voltam a ser o centro criando ilusao de movimento infinito
-        glutWarpPointer(centerX, centerY); //move mouse para o centro
+        if (!modoHeadless) glutWarpPointer(centerX, centerY); //move mouse para o centro (a reproducao headless nao tem cursor)
     }
     
-    glutPostRedisplay();
+    acordaEscalonador();
+}
+
+// Clique esquerdo: escolhe o prop na mira (centro da tela, para onde o mouse aponta a camera)
+void mouseBotao(int botao, int estado, int x, int y) {
+    if (botao == GLUT_LEFT_BUTTON && estado == GLUT_DOWN) selecionaCentro();
+    acordaEscalonador();
+}
+
+// Aplica o deslocamento acumulado do mouse aos angulos da camera (uma vez por frame)
+void aplicaMouse() {
+    // Atualiza angulos de rotacao (estilo FPS)
+    angleYaw += mouseAcumuladoX * 0.3f;     // adiciona rotacao horizontal ao angulo horizontal da camera e 0.3 e a sensibilidade
+    anglePitch -= mouseAcumuladoY * 0.3f;   // rotacao vertical (invertida para que arraste para frente olhe para cima)
+    mouseAcumuladoX = 0;
+    mouseAcumuladoY = 0;
+    
+    //Limita o pitch para evitar inversao entre -89 e 89
+    if (anglePitch > 89.0f) anglePitch = 89.0f; // caso o angulo de visualizacao exceda 89 , trava em 89
+    if (anglePitch < -89.0f) anglePitch = -89.0f;
 }
 
 void init() {
@@ -88,6 +255,51 @@ void init() {
     // Ativa luzes padrao (configuracao detalhada em configuraIluminacao)
     glEnable(GL_LIGHT0); // luz direcional (sol)
     glEnable(GL_LIGHT1); // luz pontual (poste)
+
+    // Matrizes de mundo dos props e das suas partes (antes das malhas: a BVH e as instancias usam)
+    criaHierarquia();
+
+    // Gera uma unica vez as malhas (cubo, esfera, cilindro) nos buffers da GPU
+    criaMalhasCena();
+
+    // Blocos do terreno em volta da camera (os seguintes chegam em segundo plano)
+    criaTerreno();
+
+    // Hierarquia de caixas dos props para o culling por frustum
+    constroiBVH();
+    alocaNiveisLOD();
+
+    // Volumes das partes dos props numa grade com hash (colisao da camera e selecao pelo centro da tela)
+    criaHashEspacial();
+
+    // Iluminacao estatica pre-calculada do chao e dos props (--mapas-luz ou tecla 'J')
+    criaMapasLuz();
+
+    // Consultas de oclusao por folha da BVH
+    criaOclusao();
+
+    // Threads que fazem culling e LOD por blocos da BVH
+    criaTravessia();
+
+    // FBO e shader de ampliacao da resolucao dinamica
+    criaResolucaoDinamica();
+
+    // Consultas de tempo de GPU do perfil de frame (e o CSV, se pedido)
+    criaPerfil();
+}
+
+// Liga/desliga GL_LIGHT0 e GL_LIGHT1 conforme luzDirecionalLigada/luzPontualLigada (opcao --luzes)
+void aplicaConfiguracaoLuzes() {
+    if (luzDirecionalLigada) glEnable(GL_LIGHT0);
+    else glDisable(GL_LIGHT0);
+    if (luzPontualLigada) glEnable(GL_LIGHT1);
+    else glDisable(GL_LIGHT1);
+}
+
+// Fim do frame: troca os buffers da janela ou, sem janela, espera a GPU terminar o frame
+void trocaBuffers() {
+    if (modoHeadless) glFinish();
+    else glutSwapBuffers();
 }
 
 //funcao de janela 
@@ -95,21 +307,170 @@ void reshape(int w, int h) {
     if (h == 0) h = 1; // evita divisao por zero
     float ratio = w * 1.0 / h;
 
+    capturaJanelaRedimensionada(w, h);
+
     // guarda dimensoes da janela
     windowWidth = w;
     windowHeight = h;
+    larguraRender = w;
+    alturaRender = h;
 
     glMatrixMode(GL_PROJECTION); // modo projecao
     glLoadIdentity(); // reseta matriz para estado original
 
     // Projecao perspectiva: FOV 60, near 0.1, far 100
-    gluPerspective(60.0f, ratio, 0.1f, 100.0f);
+    gluPerspective(60.0f, ratio, planoPerto, planoLonge);
 
     glViewport(0, 0, w, h);//diz que a area comeca em 0,0 e vai ate w e h
 }
 
+// --- PERFIL DE FRAME (CPU/GPU) ---
+// Marcadores perfilInicio/perfilFim em volta de cada fase do frame. O tempo de CPU vem de
+// clock_gettime; o de GPU de consultas GL_TIME_ELAPSED. As consultas sao duplicadas (dois
+// conjuntos alternados por frame): o resultado do frame N so e lido no frame N + 2, quando a
+// GPU ja terminou, e se ainda nao estiver pronto e descartado em vez de esperar.
+// As fases nao podem se aninhar (GL_TIME_ELAPSED nao permite duas consultas abertas).
+
+enum {
+    FASE_TRANSFORMACOES, FASE_CAMERA, FASE_ILUMINACAO, FASE_SOMBRAS, FASE_CULLING, FASE_LUZES, FASE_CHAO,
+    FASE_BANCO, FASE_POSTE, FASE_ARVORE, FASE_IMPOSTORES, FASE_FILA, FASE_OCLUSAO, FASE_RESOLUCAO,
+    FASE_CAPTURA, FASE_TROCA, NUM_FASES
+};
+
+const char* nomesFases[NUM_FASES] = {
+    "transformacoes", "camera", "iluminacao", "sombras", "culling_lod", "luzes", "chao", "banco", "poste", "arvore", "impostores", "fila", "oclusao", "resolucao",
+    "captura", "troca"
+};
+
+typedef struct {
+    bool ativo;                         // consultas criadas (precisa de contexto GL)
+    GLuint consultas[2][NUM_FASES];
+    bool emitida[2][NUM_FASES];         // a fase rodou no frame daquele conjunto
+    double cpu[2][NUM_FASES];           // ms de CPU de cada fase no frame daquele conjunto
+    float escala[2];                    // escala da resolucao dinamica no frame daquele conjunto
+    long quadroConjunto[2];             // frame medido por cada conjunto (-1 = vazio)
+    int conjunto;                       // conjunto usado pelo frame atual
+    long quadro;
+    double inicioFase[NUM_FASES];
+    int faseAtual;                      // fase aberta (-1 = nenhuma); a fila guarda com cada item
+    double mediaCpu[NUM_FASES];         // medias moveis exibidas no HUD
+    double mediaGpu[NUM_FASES];
+    FILE* csv;                          // --perfil arquivo.csv
+} Perfil;
+
+Perfil perfil = {.faseAtual = -1};
+bool mostrarHUD = false; // 'P' mostra/esconde o HUD com os tempos por fase
+const char* arquivoPerfil = NULL;
+
+double tempoAtualMs() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000.0 + t.tv_nsec / 1.0e6;
+}
+
+void criaPerfil() {
+    memset(&perfil, 0, sizeof(perfil));
+    glGenQueries(2 * NUM_FASES, &perfil.consultas[0][0]);
+    perfil.quadroConjunto[0] = perfil.quadroConjunto[1] = -1;
+    perfil.faseAtual = -1;
+    perfil.ativo = true;
+
+    if (arquivoPerfil) {
+        perfil.csv = fopen(arquivoPerfil, "w");
+        if (!perfil.csv) {
+            fprintf(stderr, "Nao foi possivel gravar %s\n", arquivoPerfil);
+            return;
+        }
+        fprintf(perfil.csv, "quadro");
+        for (int f = 0; f < NUM_FASES; f++) fprintf(perfil.csv, ",cpu_%s", nomesFases[f]);
+        for (int f = 0; f < NUM_FASES; f++) fprintf(perfil.csv, ",gpu_%s", nomesFases[f]);
+        fprintf(perfil.csv, ",escala\n");
+    }
+}
+
+void perfilInicio(int fase) {
+    perfil.inicioFase[fase] = tempoAtualMs();
+    perfil.faseAtual = fase;
+    if (perfil.ativo) glBeginQuery(GL_TIME_ELAPSED, perfil.consultas[perfil.conjunto][fase]);
+}
+
+void perfilFim(int fase) {
+    if (perfil.ativo) glEndQuery(GL_TIME_ELAPSED);
+    perfil.cpu[perfil.conjunto][fase] += tempoAtualMs() - perfil.inicioFase[fase];
+    perfil.emitida[perfil.conjunto][fase] = true;
+    perfil.faseAtual = -1;
+}
+
+// Le os resultados do conjunto c (sem bloquear), atualiza as medias e grava a linha do CSV
+void perfilColetaConjunto(int c) {
+    if (perfil.quadroConjunto[c] >= 0) {
+        double gpu[NUM_FASES];
+        for (int f = 0; f < NUM_FASES; f++) {
+            gpu[f] = -1.0; // -1 = sem medida (fase nao rodou ou resultado ainda nao pronto)
+            if (!perfil.emitida[c][f]) continue;
+            GLuint pronto = 0;
+            glGetQueryObjectuiv(perfil.consultas[c][f], GL_QUERY_RESULT_AVAILABLE, &pronto);
+            if (pronto) {
+                GLuint64 ns;
+                glGetQueryObjectui64v(perfil.consultas[c][f], GL_QUERY_RESULT, &ns);
+                gpu[f] = ns / 1.0e6;
+            }
+            perfil.mediaCpu[f] += (perfil.cpu[c][f] - perfil.mediaCpu[f]) * 0.1;
+            if (gpu[f] >= 0.0) perfil.mediaGpu[f] += (gpu[f] - perfil.mediaGpu[f]) * 0.1;
+        }
+
+        if (perfil.csv) {
+            fprintf(perfil.csv, "%ld", perfil.quadroConjunto[c]);
+            for (int f = 0; f < NUM_FASES; f++) fprintf(perfil.csv, ",%.4f", perfil.cpu[c][f]);
+            for (int f = 0; f < NUM_FASES; f++) fprintf(perfil.csv, ",%.4f", gpu[f]);
+            fprintf(perfil.csv, ",%.4f\n", perfil.escala[c]);
+        }
+    }
+    perfil.quadroConjunto[c] = -1;
+}
+
+// Inicio do frame: colhe o conjunto usado dois frames atras e o libera para este frame
+void perfilIniciaFrame() {
+    if (!perfil.ativo) return;
+    int c = perfil.conjunto;
+    perfilColetaConjunto(c);
+
+    memset(perfil.emitida[c], 0, sizeof(perfil.emitida[c]));
+    memset(perfil.cpu[c], 0, sizeof(perfil.cpu[c]));
+    perfil.quadroConjunto[c] = perfil.quadro;
+    perfil.escala[c] = escalaRender;
+}
+
+void perfilTerminaFrame() {
+    perfil.quadro++;
+    perfil.conjunto ^= 1;
+}
+
+// Colhe os dois ultimos frames ainda pendentes (chamar com o contexto ativo, no fim do programa)
+void perfilColetaPendentes() {
+    if (!perfil.ativo) return;
+    glFinish();
+    perfilColetaConjunto(perfil.conjunto);
+    perfilColetaConjunto(perfil.conjunto ^ 1);
+}
+
+void fechaPerfil() {
+    if (perfil.csv) fclose(perfil.csv);
+    perfil.csv = NULL;
+}
+
 void display() {
+    double inicioQuadro = tempoAtualMs();
+    perfilIniciaFrame();
+    perfilInicio(FASE_TRANSFORMACOES);
+    atualizaHierarquia(); // so as subarvores editadas desde o ultimo frame
+    perfilFim(FASE_TRANSFORMACOES);
+
+    perfilInicio(FASE_CAMERA);
+
+    iniciaResolucaoDinamica(); // com escala < 1 a cena vai para a area reduzida do FBO
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); //pinta a tela com a cor de fundo (azul escuro) e reseta info de profundidade
+    glDisable(GL_SCISSOR_TEST);
 
     glMatrixMode(GL_MODELVIEW); //modo de view
     glLoadIdentity();   //coloca cursor no ponto 0 0 0 
@@ -135,313 +496,6186 @@ void display() {
         lookX, lookY, lookZ,           // Ponto para o qual olha
         0.0f, 1.0f, 0.0f              // Vetor "up"
     );
+    glGetFloatv(GL_MODELVIEW_MATRIX, matrizVista);
+    glGetFloatv(GL_PROJECTION_MATRIX, matrizProjecao);
+    iniciaTravessia(); // as threads ja preparam a lista desta camera
+    perfilFim(FASE_CAMERA);
 
     // Configurar Iluminação
+    perfilInicio(FASE_ILUMINACAO);
     configuraIluminacao();
+    perfilFim(FASE_ILUMINACAO);
 
     // Desenho da Cena
     drawCena();
 
-    glutSwapBuffers();
-}
+    // area reduzida ampliada para a janela (antes da captura e do HUD, que ficam na resolucao cheia)
+    perfilInicio(FASE_RESOLUCAO);
+    ampliaResolucaoDinamica();
+    perfilFim(FASE_RESOLUCAO);
 
-void desenhaChao() {
-    // DESENHA O CHÃO 
-    // Material: Grama verde escura
-    // Transformação: Quadrado plano no plano XZ (Y=0)
-    
-    GLfloat corGrama[] = {0.1f, 0.4f, 0.1f, 1.0f}; // Verde escuro
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, corGrama);
-    // Pequeno componente especular para evidenciar reflexo/local pool de luz
-    GLfloat corGramaSpecular[] = {0.05f, 0.05f, 0.05f, 1.0f};
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, corGramaSpecular);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 10.0f);
-
-    glBegin(GL_QUADS);
-        // Normal aponta para cima (eixo Y positivo)
-        glNormal3f(0.0f, 1.0f, 0.0f);
-
-        // Vértices do chão (um plano grande no XZ)
-        glVertex3f(-10.0f, 0.0f, -10.0f);
-        glVertex3f(-10.0f, 0.0f,  10.0f);
-        glVertex3f( 10.0f, 0.0f,  10.0f);
-        glVertex3f( 10.0f, 0.0f, -10.0f);
-    glEnd();
-}
+    // leitura assincrona para a gravacao (antes do HUD: o video fica so com a cena)
+    perfilInicio(FASE_CAPTURA);
+    capturaQuadro();
+    perfilFim(FASE_CAPTURA);
+    desenhaHUD();
 
-void desenhaAssento() {
-    // Define medida da caixa que sera criada
-    float largura = 1.8f;
-    float espessura = 0.1f;
-    float profundidade = 0.5f;
+    // o tempo do frame e medido antes da troca: com vsync ela espera o retraco e o controle
+    // leria essa espera como custo, baixando a escala a toa. O glFinish inclui o trabalho da GPU.
+    if (usarResolucaoDinamica) glFinish();
+    double msQuadro = tempoAtualMs() - inicioQuadro;
 
-    glPushMatrix();
-        // Escala: Redimensiona o cubo unitário para o tamanho do assento
-        glScalef(largura, espessura, profundidade); //passa os parametros de escala que serao multiplicados
-        glutSolidCube(1.0); // cria um cubo 1x1x1
-    glPopMatrix();
+    perfilInicio(FASE_TROCA);
+    trocaBuffers();
+    perfilFim(FASE_TROCA);
+    perfilTerminaFrame();
+    ajustaResolucaoDinamica(msQuadro); // escala do proximo frame
 }
 
-void desenhaPerna(float posX, float posZ) {
-    // Perna do banco (um bloco fino)
-    float tamanho = 0.7f;
-    float espessura = 0.08f;
+// --- CACHE DE MALHAS NA GPU ---
+// Cada malha e gerada uma unica vez em init(): os vertices (posicao + normal intercalados)
+// vao para um VBO e os indices dos triangulos para um IBO. No desenho basta ligar os buffers
+// e fazer um glDrawElements, em vez de reenviar vertice por vertice a cada frame.
 
-    glPushMatrix();
-        // Move a perna para a posição desejada
-        glTranslatef(posX, tamanho / 2.0f, posZ);
-        // Escala: Redimensiona o cubo para a forma de uma perna
-        glScalef(espessura, tamanho, espessura);
-        glutSolidCube(1.0);
-    glPopMatrix();
-}
+#define FLOATS_POR_VERTICE 6  // x, y, z, nx, ny, nz
+#define FLOATS_POR_VERTICE_COMPOSTO 10 // x, y, z, nx, ny, nz, r, g, b, emissivo
+#define NUM_NIVEIS_LOD 3 // tesselacoes pre-calculadas de cada primitiva (ver NIVEL DE DETALHE)
 
-void desenhaCilindro(float raio, float altura) {
-    //Desenha um cilindro
-    int numSegmentos = 16; // Numero de segmentos para formar o circulo
-    float angulo;
-    
-    glPushMatrix();
-        // Move para que a base do cilindro fique em Y=0
-        glTranslatef(0.0f, altura / 2.0f, 0.0f);
-        
-        // Desenha o corpo do cilindro 
-        glBegin(GL_QUAD_STRIP); // dois pontos sao definidos, depois mais dois e quad strip os conecata
-            glNormal3f(0.0f, 1.0f, 0.0f); // o par anterior com o novo
-            for (int i = 0; i <= numSegmentos; i++) {
-                angulo = 2.0f * M_PI * i / numSegmentos;
-                float x = raio * cos(angulo); //transforma os angulos em posicao no circulo 
-                float z = raio * sin(angulo);
-                
-                // Normal apontando para fora, pois na lateral do cilindro a luz deve refletir como se fosse arredondado.
-                glNormal3f(x / raio, 0.0f, z / raio);
-                
-                // Vertice superior
-                glVertex3f(x, altura / 2.0f, z);
-                // Vertice inferior
-                glVertex3f(x, -altura / 2.0f, z);
-            }
-        glEnd();
-        
-        // Desenha a tampa superior
-        glBegin(GL_TRIANGLE_FAN);           // Leque de triangulos o centro e definido primeiro depois a cada ponto
-            glNormal3f(0.0f, 1.0f, 0.0f);   // desenhado na porda, um triangulo  e criado e conectado ao centro
-            glVertex3f(0.0f, altura / 2.0f, 0.0f);  //nomral fixa porque e plana e aponta para cima
-            for (int i = 0; i <= numSegmentos; i++) {
-                angulo = 2.0f * M_PI * i / numSegmentos;
-                glVertex3f(raio * cos(angulo), altura / 2.0f, raio * sin(angulo));
-            }
-        glEnd();
-        
-        // Desenha a base inferior
-        glBegin(GL_TRIANGLE_FAN);
-            glNormal3f(0.0f, -1.0f, 0.0f);
-            glVertex3f(0.0f, -altura / 2.0f, 0.0f);
-            for (int i = numSegmentos; i >= 0; i--) { //i -- para inverter a ordem dos pontos e manter a face visivel virada para baixo
-                angulo = 2.0f * M_PI * i / numSegmentos;
-                glVertex3f(raio * cos(angulo), -altura / 2.0f, raio * sin(angulo));
-            }
-        glEnd();
-    glPopMatrix();
-}
+// Estrutura auxiliar com os dados da malha do lado da CPU
+typedef struct {
+    float* vertices;
+    GLuint* indices;
+    int numVertices;
+    int numIndices;
+    int capVertices;       // capacidade alocada (cresce sob demanda)
+    int capIndices;
+    int floatsPorVertice;
+} DadosMalha;
 
-void desenhaBanco() {
-    // DESENHA O BANCO DE PRAÇA
-    // Composição: Assento, encosto e 4 pernas
-    // Transformações hierárquicas: Translação, rotação e escala
+typedef struct {
+    GLuint vbo;           // buffer de vertices
+    GLuint ibo;           // buffer de indices
+    GLsizei numIndices;   // quantidade de indices (3 por triangulo)
+    int numVertices;
+    DadosMalha dados;     // copia na CPU, mantida so durante init() para montar os props compostos
+} Malha;
 
-    GLfloat corBanco[] = {0.55f, 0.35f, 0.15f, 1.0f}; // Marrom
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, corBanco);
+Malha malhaCubo;          // cubo unitario centrado na origem (substitui glutSolidCube(1.0))
+Malha malhaCilindro[NUM_NIVEIS_LOD];    // cilindro de raio 1 e altura 1 com a base em Y=0 (um por nivel de LOD)
+Malha malhaEsferaPoste[NUM_NIVEIS_LOD]; // esfera unitaria da luminaria (16x16 no nivel 0)
+Malha malhaEsferaCopa[NUM_NIVEIS_LOD];  // esfera unitaria da copa da arvore (20x20 no nivel 0)
+int nivelLODAtual = 0;    // nivel de LOD usado por desenhaCilindro/desenhaEsfera
 
-    glPushMatrix(); // Salva a matriz de transformação
-        // Posiciona o banco em (2, 0, -2) na cena
-        glTranslatef(2.0f, 0.0f, -2.0f);
-        glRotatef(30.0f, 0.0f, 1.0f, 0.0f); // Rotaciona o banco 30 graus
+// Quando diferente de NULL, desenhaMalha grava a geometria (ja transformada pela modelview)
+// nesta malha composta em vez de desenhar. Usado em init() para juntar as partes de cada prop.
+DadosMalha* malhaEmGravacao = NULL;
+GLfloat corGravacao[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+bool emissaoGravacao = false;
 
-        float altAssento = 0.7f;
-        float largura = 1.8f;
-        float profundidade = 0.5f;
+// Partes de um tipo de prop (primitiva, matriz em relacao ao prop e cor), gravadas uma vez em
+// init() para a hierarquia de transformacoes: com partesEmGravacao, desenhaMalha grava aqui.
+enum { PRIM_CUBO, PRIM_CILINDRO, PRIM_ESFERA_POSTE, PRIM_ESFERA_COPA };
 
-        // Desenhar Assento
-        glPushMatrix();
-            glTranslatef(0.0f, altAssento, 0.0f); // ergue a altura do banco para 0.7
-            desenhaAssento();
-        glPopMatrix();
+#define MAX_PARTES_PROP 16
 
-        // Desenhar Encosto
-        float alturaEncosto = 0.8f;
-        float espessuraEncosto = 0.1f;
-        float espessuraAssento = 0.1f;
-        
-        glPushMatrix();
-            float topoAssento = altAssento + espessuraAssento/2.0f;
-        // a altura e a altura do acento+ metade da altura do encosto
-        // para colocar o encosto, devemos empurralo para tras. Movemos para a vorda de tras (-profundidade/2)
-        // e subtraimos a espessura do proprio encosto
-            glTranslatef(0.0f, topoAssento + alturaEncosto/2.0f, -profundidade/2.0f - espessuraEncosto/2.0f);
-            glScalef(largura, alturaEncosto, espessuraEncosto);
-            glutSolidCube(1.0);
-        glPopMatrix();
+typedef struct {
+    float local[16];       // em relacao ao prop
+    int primitiva;
+    GLfloat cor[4];        // sem a tinta do prop
+    bool emissiva;         // luminaria: cor e emissao seguem a luz do poste
+    unsigned char niveis;  // bit L ligado: a parte existe no nivel de LOD L
+} ParteProp;
 
-        // Desenhar as 4 Pernas (cantos do banco)
-        float offset = (largura / 2.0f) - 0.1f;         // espelhamento das cordenadas, a subtracao por 1 evitta
-        float offsetZ = (profundidade / 2.0f) - 0.1f;   // Que a perna fique para fora
+typedef struct {
+    ParteProp partes[MAX_PARTES_PROP];
+    int numPartes;
+} PartesProp;
 
-        desenhaPerna(offset, offsetZ);      // Canto Frontal Direito
-        desenhaPerna(-offset, offsetZ);     // Canto Frontal Esquerdo
-        desenhaPerna(offset, -offsetZ);     // Canto Traseiro Direito
-        desenhaPerna(-offset, -offsetZ);    // Canto Traseiro Esquerdo
+PartesProp* partesEmGravacao = NULL;
 
-    glPopMatrix(); // Restaura a matriz de transformação
+void alocaDadosMalha(DadosMalha* d, int maxVertices, int maxIndices, int floatsPorVertice) {
+    d->vertices = malloc(sizeof(float) * floatsPorVertice * maxVertices);
+    d->indices = malloc(sizeof(GLuint) * maxIndices);
+    d->numVertices = 0;
+    d->numIndices = 0;
+    d->capVertices = maxVertices;
+    d->capIndices = maxIndices;
+    d->floatsPorVertice = floatsPorVertice;
 }
 
-void desenhaPoste() {
-    // DESENHA O POSTE DE ILUMINAÇÃO 
-    // Transformações: Translação e escala
-    // Iluminação: Luz pontual posicionada no topo da luminária
-    
-    GLfloat corMetal[] = {0.3f, 0.3f, 0.3f, 1.0f}; // Cinza escuro para o poste
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, corMetal);
-
-    glPushMatrix();
-        // Posiciona o poste em 
-        glTranslatef(-3.0f, 0.0f, 0.0f);
-
-        // --- Base do Poste (cilindro fino e alto) ---
-        // define medidas do poste
-        float alturaPoste = 3.0f;
-        float raioPoste = 0.08f;
+void liberaDadosMalha(DadosMalha* d) {
+    free(d->vertices);
+    free(d->indices);
+    d->vertices = NULL;
+    d->indices = NULL;
+}
 
-        // desenha a base do poste como um cilindro
-        glPushMatrix();
-            desenhaCilindro(raioPoste, alturaPoste);
-        glPopMatrix();
+// adiciona um vertice e devolve o seu indice (campos extras de vertice composto ficam zerados)
+GLuint adicionaVertice(DadosMalha* d, float x, float y, float z, float nx, float ny, float nz) {
+    if (d->numVertices == d->capVertices) {
+        d->capVertices *= 2;
+        d->vertices = realloc(d->vertices, sizeof(float) * d->floatsPorVertice * d->capVertices);
+    }
+    float* v = d->vertices + d->numVertices * d->floatsPorVertice;
+    v[0] = x;  v[1] = y;  v[2] = z;
+    v[3] = nx; v[4] = ny; v[5] = nz;
+    for (int i = FLOATS_POR_VERTICE; i < d->floatsPorVertice; i++) v[i] = 0.0f;
+    return d->numVertices++;
+}
 
-        // --- Luminaria ---
-        // Define material diferente se a luz do poste esta ligada (emissivo)
-        GLfloat corLuminariaOff[] = {0.4f, 0.4f, 0.3f, 1.0f}; // Cinza claro quando desligada
-        GLfloat corLuminariaOn[]  = {1.0f, 0.9f, 0.6f, 1.0f}; // Amarelo quente quando ligada
-        GLfloat emisOn[] = {0.8f, 0.7f, 0.3f, 1.0f}; // Emissão amarela quando ligada
-        GLfloat emisOff[] = {0.0f, 0.0f, 0.0f, 1.0f}; // Sem emissão quando desligada
-
-        if (luzPontualLigada) {
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, corLuminariaOn); // amarelo claro quando ligada 
-            glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, emisOn);                      // define emissao para amarelo forte
-        } else {
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, corLuminariaOff); // amarelo escuro para desligada
-            glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, emisOff);                     // sem emissao
-        }
+void adicionaTriangulo(DadosMalha* d, GLuint a, GLuint b, GLuint c) {
+    if (d->numIndices + 3 > d->capIndices) {
+        d->capIndices = d->capIndices * 2 + 3;
+        d->indices = realloc(d->indices, sizeof(GLuint) * d->capIndices);
+    }
+    d->indices[d->numIndices++] = a;
+    d->indices[d->numIndices++] = b;
+    d->indices[d->numIndices++] = c;
+}
 
-        glPushMatrix();
-            float raioLuminaria = 0.2f; //raio da bola
-            glTranslatef(0.0f, alturaPoste + raioLuminaria/2.0f, 0.0f); //poiciona a bola no final do corpo do poste
-            glutSolidSphere(raioLuminaria, 16, 16); //desenha a esfera
-        glPopMatrix();
+// Envia os dados para a GPU (a copia na CPU continua em m.dados ate liberaDadosMalha)
+Malha enviaMalha(DadosMalha* d) {
+    Malha m;
+    glGenBuffers(1, &m.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * d->floatsPorVertice * d->numVertices, d->vertices, GL_STATIC_DRAW);
 
-        // Após desenhar, garante que emissao nao vaze para outros objetos
-        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, emisOff);
+    glGenBuffers(1, &m.ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * d->numIndices, d->indices, GL_STATIC_DRAW);
+    m.numIndices = d->numIndices;
+    m.numVertices = d->numVertices;
+    m.dados = *d;
 
-    glPopMatrix(); // Restaura a matriz de transformação
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    return m;
 }
 
+void geraDadosCubo(DadosMalha* d) {
+    // 6 faces com 4 vertices proprios cada, para que a normal fique reta em cada face
+    static const float normais[6][3] = {
+        { 1, 0, 0}, {-1, 0, 0}, {0,  1, 0}, {0, -1, 0}, {0, 0,  1}, {0, 0, -1}
+    };
+    alocaDadosMalha(d, 24, 36, FLOATS_POR_VERTICE);
 
+    for (int f = 0; f < 6; f++) {
+        float nx = normais[f][0], ny = normais[f][1], nz = normais[f][2];
+        // dois eixos tangentes a face (u x v = normal, para manter a ordem anti-horaria)
+        float ux = ny, uy = nz, uz = nx;
+        float vx = ny * uz - nz * uy, vy = nz * ux - nx * uz, vz = nx * uy - ny * ux;
 
-void desenhaArvore() {
-    //DESENHA A ARVORE 
-    // Composicao: tronco e copa
-    // transformacoes: translacao e escala
-    
-    glPushMatrix();
-        // Posiciona a árvore em (-5, 0, 5) na cena
-        glTranslatef(-5.0f, 0.0f, 5.0f);
+        GLuint base = d->numVertices;
+        for (int c = 0; c < 4; c++) {
+            float su = (c == 1 || c == 2) ? 0.5f : -0.5f;
+            float sv = (c >= 2) ? 0.5f : -0.5f;
+            adicionaVertice(d,
+                0.5f * nx + su * ux + sv * vx,
+                0.5f * ny + su * uy + sv * vy,
+                0.5f * nz + su * uz + sv * vz,
+                nx, ny, nz);
+        }
+        adicionaTriangulo(d, base, base + 1, base + 2);
+        adicionaTriangulo(d, base, base + 2, base + 3);
+    }
+}
 
-        // --- Tronco (Cilindro marrom) ---
-        GLfloat corTronco[] = {0.4f, 0.2f, 0.0f, 1.0f}; // Marrom
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, corTronco);
+void geraDadosEsfera(DadosMalha* d, int fatias, int pilhas) {
+    // esfera unitaria: na esfera a normal e a propria posicao
+    alocaDadosMalha(d, (fatias + 1) * (pilhas + 1), fatias * pilhas * 6, FLOATS_POR_VERTICE);
 
-        // dimensoes do tronco
-        float alturaTronco = 2.5f;
-        float raioTronco = 0.2f;
+    for (int p = 0; p <= pilhas; p++) {
+        float phi = M_PI * p / pilhas;            // 0 no polo norte, pi no polo sul
+        for (int f = 0; f <= fatias; f++) {
+            float theta = 2.0f * M_PI * f / fatias;
+            float x = sin(phi) * cos(theta);
+            float y = cos(phi);
+            float z = -sin(phi) * sin(theta);
+            adicionaVertice(d, x, y, z, x, y, z);
+        }
+    }
+    for (int p = 0; p < pilhas; p++) {
+        for (int f = 0; f < fatias; f++) {
+            GLuint a = p * (fatias + 1) + f;   // anel de cima
+            GLuint b = a + fatias + 1;         // anel de baixo
+            adicionaTriangulo(d, a, b, b + 1);
+            adicionaTriangulo(d, a, b + 1, a + 1);
+        }
+    }
+}
 
-        // desenha tronco usando cilindro 
-        glPushMatrix();
-            desenhaCilindro(raioTronco, alturaTronco);
-        glPopMatrix();
+void geraDadosCilindro(DadosMalha* d, int numSegmentos) {
+    // mesma geometria de desenhaCilindro no modo imediato, mas com raio 1 e altura 1
+    alocaDadosMalha(d, (numSegmentos + 1) * 4 + 2, numSegmentos * 12, FLOATS_POR_VERTICE);
 
-        // --- Copa (Esfera verde) ---
-        GLfloat corCopa[] = {0.0f, 0.5f, 0.0f, 1.0f}; // Verde escuro
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, corCopa);
+    // corpo: pares de vertices (topo, base) com normal radial
+    for (int i = 0; i <= numSegmentos; i++) {
+        float angulo = 2.0f * M_PI * i / numSegmentos;
+        float x = cos(angulo), z = sin(angulo);
+        adicionaVertice(d, x, 1.0f, z, x, 0.0f, z);
+        adicionaVertice(d, x, 0.0f, z, x, 0.0f, z);
+    }
+    for (int i = 0; i < numSegmentos; i++) {
+        GLuint t0 = 2 * i, b0 = t0 + 1, t1 = t0 + 2, b1 = t0 + 3;
+        adicionaTriangulo(d, t0, t1, b1);
+        adicionaTriangulo(d, t0, b1, b0);
+    }
 
-        glPushMatrix();
-            float raioCopa = 1.2f;
-            glTranslatef(0.0f, alturaTronco + raioCopa * 0.5f, 0.0f); //poiciona a copa sobreposta ao final tronco
-            glutSolidSphere(raioCopa, 20, 20);          // desenha a esfera
-        glPopMatrix();
+    // tampas: centro + anel com normal fixa para cima (topo) e para baixo (base)
+    for (int tampa = 0; tampa < 2; tampa++) {
+        float y = (tampa == 0) ? 1.0f : 0.0f;
+        float ny = (tampa == 0) ? 1.0f : -1.0f;
+        GLuint centro = adicionaVertice(d, 0.0f, y, 0.0f, 0.0f, ny, 0.0f);
+        for (int i = 0; i <= numSegmentos; i++) {
+            float angulo = 2.0f * M_PI * i / numSegmentos;
+            adicionaVertice(d, cos(angulo), y, sin(angulo), 0.0f, ny, 0.0f);
+        }
+        for (int i = 0; i < numSegmentos; i++) {
+            if (tampa == 0) adicionaTriangulo(d, centro, centro + 2 + i, centro + 1 + i);
+            else            adicionaTriangulo(d, centro, centro + 1 + i, centro + 2 + i);
+        }
+    }
+}
 
-    glPopMatrix(); // Restaura a matriz de transformação
+// Liga os arrays de vertice/normal uma vez antes de desenhar a cena com malhas
+void iniciaDesenhoMalhas() {
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
 }
 
-void configuraIluminacao() {
-    // Esta função configura a iluminação mesmo quando as luzes estão desligadas
+// Desliga os arrays e os buffers (o glut usa arrays do lado do cliente no modo imediato)
+void terminaDesenhoMalhas() {
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+}
 
-    // --- LUZ AMBIENTE GERAL (Escuro de Entardecer) ---
+// --- FILA DE RENDERIZACAO ---
+// No caminho com malhas em cache, desenhaMalha e defineCor/defineEmissao/defineEspecular nao
+// falam direto com o GL: cada malha vira um item (malha, material, modelview) numa fila.
+// executaFila ordena os itens por material e depois por malha e so emite o glMaterial ou o
+// glBindBuffer que mudou em relacao ao que o GL ja tem. Assim os postes, que tem o mesmo
+// metal, ou os bancos de mesmo tom, trocam de estado uma vez em vez de uma por peca. A
+// modelview de cada item e matrizVista vezes a matriz de mundo da hierarquia (sem ler do GL).
+// Cada item lembra a fase do perfil em que foi enviado e a fila e ordenada primeiro por ela:
+// executaFila reabre a fase de cada lote, entao o tempo de banco, poste e arvore inclui o
+// desenho feito pela fila (a consulta de GPU reaberta fica com o desenho; a CPU soma os dois).
 
-    // Define um nivel mais baixo de luz para que ambiente seja viivel, nao 100% preto
-    GLfloat luzAmbienteGlobal[] = {0.05f, 0.05f, 0.07f, 1.0f}; // tom azulado escuro
-    glLightModelfv(GL_LIGHT_MODEL_AMBIENT, luzAmbienteGlobal);
+typedef struct {
+    GLfloat difusa[4];      // ambiente e difusa
+    GLfloat emissao[4];
+    GLfloat especular[4];
+    GLfloat brilho;
+} Material;
 
-    // Habilita a atenuação de luz especular (mais realista)
-    glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, GL_TRUE);
+typedef struct {
+    const Malha* malha;
+    Material material;
+    int fase;               // fase do perfil que enviou o item (ordem principal da fila)
+    unsigned int chave;     // hash do material
+    GLfloat matriz[16];     // modelview do item (matrizVista * mundo)
+} ItemFila;
 
+typedef struct {
+    ItemFila* itens;
+    int* ordem;             // indices dos itens, e o que e ordenado
+    int numItens, capItens;
+    bool ativa;             // entre iniciaFila e executaFila
+    Material material;      // material que os proximos itens vao usar
+    Material noGL;          // material que o GL tem agora (toda chamada glMaterial passa por aqui)
+} FilaRender;
 
-    // --- LUZ DIRECIONAL - SOL POENTE (GL_LIGHT0) ---
-    // simula o por do sol
+// os dois comecam com os valores padrao do GL; noGL segue o GL de um frame para o outro
+#define MATERIAL_PADRAO_GL {{0.8f, 0.8f, 0.8f, 1.0f}, {0.0f, 0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, 0.0f, 1.0f}, 0.0f}
+FilaRender fila = {.material = MATERIAL_PADRAO_GL, .noGL = MATERIAL_PADRAO_GL};
+bool usarFila = true; // 'Q' liga/desliga a ordenacao por material
+
+// Mudancas de estado por frame: "antes" e o que o desenho direto emitiria (um glMaterial por
+// chamada de defineCor etc. e um bind por malha), "depois" o que a fila emitiu de fato
+typedef struct {
+    int itens;
+    int materialAntes, materialDepois;
+    int malhaAntes, malhaDepois;
+} EstatisticasFila;
+
+EstatisticasFila estatFila;
+
+// Comeca a fila do frame (so nas malhas em cache: o modo imediato desenha na hora)
+void iniciaFila() {
+    memset(&estatFila, 0, sizeof(estatFila));
+    fila.numItens = 0;
+    fila.ativa = usarFila && !modoImediato;
+}
+
+void submeteFila(const Malha* m, const float* mundo) {
+    if (fila.numItens == fila.capItens) {
+        fila.capItens = fila.capItens ? fila.capItens * 2 : 256;
+        fila.itens = realloc(fila.itens, sizeof(ItemFila) * fila.capItens);
+        fila.ordem = realloc(fila.ordem, sizeof(int) * fila.capItens);
+    }
+    ItemFila* item = &fila.itens[fila.numItens];
+    item->malha = m;
+    item->material = fila.material;
+    item->fase = perfil.faseAtual >= 0 ? perfil.faseAtual : FASE_FILA;
+    if (mundo) matrizMultiplica(item->matriz, matrizVista, mundo);
+    else memcpy(item->matriz, matrizVista, sizeof(item->matriz));
+
+    // FNV-1a sobre os bytes do material: materiais iguais tem a mesma chave e ficam juntos
+    const unsigned char* b = (const unsigned char*)&item->material;
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < sizeof(Material); i++) h = (h ^ b[i]) * 16777619u;
+    item->chave = h;
+
+    fila.ordem[fila.numItens] = fila.numItens;
+    fila.numItens++;
+}
+
+int comparaItensFila(const void* a, const void* b) {
+    const ItemFila* x = &fila.itens[*(const int*)a];
+    const ItemFila* y = &fila.itens[*(const int*)b];
+    if (x->fase != y->fase) return x->fase - y->fase;
+    if (x->chave != y->chave) return x->chave < y->chave ? -1 : 1;
+    if (x->malha != y->malha) return x->malha < y->malha ? -1 : 1;
+    return *(const int*)a - *(const int*)b;
+}
+
+// Ordena e desenha o que esta na fila emitindo so as mudancas de estado. Pode ser chamada
+// mais de uma vez por frame: o chao e desenhado antes dos props para que as bases dos props
+// no nivel mais baixo (desenhadas direto pelo shader) continuem atras dele no teste de profundidade.
+// Abre as fases do perfil por conta propria: nao pode ser chamada com uma fase aberta.
+void executaFila() {
+    if (!fila.ativa) {
+        // desenho direto: cada chamada ja foi emitida
+        estatFila.materialDepois = estatFila.materialAntes;
+        estatFila.malhaDepois = estatFila.malhaAntes;
+        return;
+    }
+    estatFila.itens += fila.numItens;
+    if (fila.numItens == 0) return;
+    perfilInicio(FASE_FILA);
+    qsort(fila.ordem, fila.numItens, sizeof(int), comparaItensFila);
+    perfilFim(FASE_FILA);
+
+    Material* aplicado = &fila.noGL;
+    const Malha* ligada = NULL;
+    int fase = -1;
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    for (int k = 0; k < fila.numItens; k++) {
+        const ItemFila* item = &fila.itens[fila.ordem[k]];
+        const Material* m = &item->material;
+        if (item->fase != fase) {
+            if (fase >= 0) perfilFim(fase);
+            fase = item->fase;
+            perfilInicio(fase);
+        }
+
+        if (memcmp(aplicado->difusa, m->difusa, sizeof(m->difusa)) != 0) {
+            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, m->difusa);
+            estatFila.materialDepois++;
+        }
+        if (memcmp(aplicado->emissao, m->emissao, sizeof(m->emissao)) != 0) {
+            glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, m->emissao);
+            estatFila.materialDepois++;
+        }
+        if (memcmp(aplicado->especular, m->especular, sizeof(m->especular)) != 0) {
+            glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, m->especular);
+            estatFila.materialDepois++;
+        }
+        if (aplicado->brilho != m->brilho) {
+            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, m->brilho);
+            estatFila.materialDepois++;
+        }
+        *aplicado = *m;
+
+        if (item->malha != ligada) {
+            glBindBuffer(GL_ARRAY_BUFFER, item->malha->vbo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, item->malha->ibo);
+            glVertexPointer(3, GL_FLOAT, FLOATS_POR_VERTICE * sizeof(float), (void*)0);
+            glNormalPointer(GL_FLOAT, FLOATS_POR_VERTICE * sizeof(float), (void*)(3 * sizeof(float)));
+            ligada = item->malha;
+            estatFila.malhaDepois++;
+        }
+        glLoadMatrixf(item->matriz);
+        glDrawElements(GL_TRIANGLES, item->malha->numIndices, GL_UNSIGNED_INT, (void*)0);
+    }
+    perfilFim(fase);
+    glPopMatrix();
+    fila.numItens = 0;
+}
+
+void terminaFila() {
+    executaFila();
+    fila.ativa = false;
+}
+
+// Copia a malha para malhaEmGravacao, transformada pela modelview atual e com a cor atual
+void gravaMalha(const Malha* m) {
+    DadosMalha* g = malhaEmGravacao;
+    const DadosMalha* d = &m->dados;
+    GLfloat mv[16];
+    glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+
+    // normais usam a matriz de cofatores da parte 3x3 (inversa transposta a menos da escala)
+    float c[9] = {
+        mv[5] * mv[10] - mv[6] * mv[9], mv[6] * mv[8] - mv[4] * mv[10], mv[4] * mv[9] - mv[5] * mv[8],
+        mv[2] * mv[9] - mv[1] * mv[10], mv[0] * mv[10] - mv[2] * mv[8], mv[1] * mv[8] - mv[0] * mv[9],
+        mv[1] * mv[6] - mv[2] * mv[5], mv[2] * mv[4] - mv[0] * mv[6], mv[0] * mv[5] - mv[1] * mv[4]
+    };
+
+    GLuint base = g->numVertices;
+    for (int i = 0; i < d->numVertices; i++) {
+        const float* v = d->vertices + i * d->floatsPorVertice;
+        float nx = c[0] * v[3] + c[3] * v[4] + c[6] * v[5];
+        float ny = c[1] * v[3] + c[4] * v[4] + c[7] * v[5];
+        float nz = c[2] * v[3] + c[5] * v[4] + c[8] * v[5];
+        float len = sqrtf(nx * nx + ny * ny + nz * nz);
+        GLuint idx = adicionaVertice(g,
+            mv[0] * v[0] + mv[4] * v[1] + mv[8]  * v[2] + mv[12],
+            mv[1] * v[0] + mv[5] * v[1] + mv[9]  * v[2] + mv[13],
+            mv[2] * v[0] + mv[6] * v[1] + mv[10] * v[2] + mv[14],
+            nx / len, ny / len, nz / len);
+        float* extra = g->vertices + idx * g->floatsPorVertice + FLOATS_POR_VERTICE;
+        extra[0] = corGravacao[0];
+        extra[1] = corGravacao[1];
+        extra[2] = corGravacao[2];
+        extra[3] = emissaoGravacao ? 1.0f : 0.0f;
+    }
+    for (int i = 0; i < d->numIndices; i += 3) {
+        adicionaTriangulo(g, base + d->indices[i], base + d->indices[i + 1], base + d->indices[i + 2]);
+    }
+}
+
+// Grava a primitiva como parte (a mesma parte em varios niveis de LOD vira uma so)
+void gravaParte(const Malha* m) {
+    PartesProp* g = partesEmGravacao;
+    int L = nivelLODAtual;
+    ParteProp nova;
+    glGetFloatv(GL_MODELVIEW_MATRIX, nova.local);
+    if (m == &malhaCilindro[L]) nova.primitiva = PRIM_CILINDRO;
+    else if (m == &malhaEsferaPoste[L]) nova.primitiva = PRIM_ESFERA_POSTE;
+    else if (m == &malhaEsferaCopa[L]) nova.primitiva = PRIM_ESFERA_COPA;
+    else nova.primitiva = PRIM_CUBO;
+    memcpy(nova.cor, corGravacao, sizeof(nova.cor));
+    nova.emissiva = emissaoGravacao;
+
+    for (int k = 0; k < g->numPartes; k++) {
+        ParteProp* p = &g->partes[k];
+        if (p->primitiva == nova.primitiva && memcmp(p->local, nova.local, sizeof(nova.local)) == 0) {
+            p->niveis |= 1 << L;
+            return;
+        }
+    }
+    if (g->numPartes == MAX_PARTES_PROP) return;
+    nova.niveis = 1 << L;
+    g->partes[g->numPartes++] = nova;
+}
+
+void desenhaMalha(const Malha* m) {
+    if (malhaEmGravacao) {
+        gravaMalha(m);
+        return;
+    }
+    if (partesEmGravacao) {
+        gravaParte(m);
+        return;
+    }
+    estatFila.malhaAntes++;
+    glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ibo);
+    glVertexPointer(3, GL_FLOAT, FLOATS_POR_VERTICE * sizeof(float), (void*)0);
+    glNormalPointer(GL_FLOAT, FLOATS_POR_VERTICE * sizeof(float), (void*)(3 * sizeof(float)));
+    glDrawElements(GL_TRIANGLES, m->numIndices, GL_UNSIGNED_INT, (void*)0);
+}
+
+// Malha com matriz de mundo conhecida (NULL = identidade): vai para a fila ou e desenhada
+// com matrizVista * mundo na modelview
+void desenhaMalhaMundo(const Malha* m, const float* mundo) {
+    if (fila.ativa) {
+        estatFila.malhaAntes++;
+        submeteFila(m, mundo);
+        return;
+    }
+    glLoadMatrixf(matrizVista);
+    if (mundo) glMultMatrixf(mundo);
+    desenhaMalha(m);
+}
+
+// Cubo unitario: malha em cache ou glutSolidCube no modo imediato
+void desenhaCubo() {
+    if (modoImediato) glutSolidCube(1.0);
+    else desenhaMalha(&malhaCubo);
+}
+
+// Esfera de raio qualquer no nivel de LOD atual: a malha unitaria e escalada
+// (GL_NORMALIZE corrige as normais). tess[nivel] = {fatias, pilhas} usados no modo imediato.
+void desenhaEsfera(float raio, const Malha malhas[], const int tess[][2]) {
+    if (modoImediato) {
+        glutSolidSphere(raio, tess[nivelLODAtual][0], tess[nivelLODAtual][1]);
+        return;
+    }
+    glPushMatrix();
+        glScalef(raio, raio, raio);
+        desenhaMalha(&malhas[nivelLODAtual]);
+    glPopMatrix();
+}
+
+// Cor (ambiente e difusa) do material, multiplicada pela tinta do prop sendo desenhado
+GLfloat tintaAtual[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+void defineCor(const GLfloat* cor) {
+    GLfloat c[4] = {cor[0] * tintaAtual[0], cor[1] * tintaAtual[1], cor[2] * tintaAtual[2], cor[3]};
+    estatFila.materialAntes++;
+    if (fila.ativa) memcpy(fila.material.difusa, c, sizeof(c));
+    else {
+        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, c);
+        memcpy(fila.noGL.difusa, c, sizeof(c));
+    }
+    memcpy(corGravacao, c, sizeof(c));
+}
+
+// Emissao do material (so a luminaria do poste usa)
+void defineEmissao(const GLfloat* emissao) {
+    estatFila.materialAntes++;
+    if (fila.ativa) memcpy(fila.material.emissao, emissao, sizeof(fila.material.emissao));
+    else {
+        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, emissao);
+        memcpy(fila.noGL.emissao, emissao, sizeof(fila.noGL.emissao));
+    }
+    emissaoGravacao = emissao[0] > 0.0f || emissao[1] > 0.0f || emissao[2] > 0.0f;
+}
+
+// Cores da luminaria do poste: acesa (amarela e emissiva) ou apagada
+const GLfloat corLuminariaOn[]  = {1.0f, 0.9f, 0.6f, 1.0f}; // Amarelo quente quando ligada
+const GLfloat corLuminariaOff[] = {0.4f, 0.4f, 0.3f, 1.0f}; // Cinza claro quando desligada
+const GLfloat emisOn[] = {0.8f, 0.7f, 0.3f, 1.0f};          // Emissão amarela quando ligada
+const GLfloat emisOff[] = {0.0f, 0.0f, 0.0f, 1.0f};         // Sem emissão quando desligada
+
+// Define material diferente se a luz do poste esta ligada (emissivo)
+void defineMaterialLuminaria() {
+    if (luzPontualLigada) {
+        defineCor(corLuminariaOn);                                                 // amarelo claro quando ligada
+        defineEmissao(emisOn);                                                     // define emissao para amarelo forte
+    } else {
+        defineCor(corLuminariaOff);                                                // amarelo escuro para desligada
+        defineEmissao(emisOff);                                                    // sem emissao
+    }
+}
+
+// Especular e brilho do material (so o chao define; os props herdam)
+void defineEspecular(const GLfloat* especular, GLfloat brilho) {
+    estatFila.materialAntes += 2;
+    if (fila.ativa) {
+        memcpy(fila.material.especular, especular, sizeof(fila.material.especular));
+        fila.material.brilho = brilho;
+    } else {
+        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, especular);
+        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, brilho);
+        memcpy(fila.noGL.especular, especular, sizeof(fila.noGL.especular));
+        fila.noGL.brilho = brilho;
+    }
+}
+
+// --- MATRIZES (lado da CPU, coluna maior como no OpenGL) ---
+
+void matrizIdentidade(float m[16]) {
+    memset(m, 0, sizeof(float) * 16);
+    m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+// r = a * b (r pode ser igual a a ou b)
+void matrizMultiplica(float r[16], const float a[16], const float b[16]) {
+    float t[16];
+    for (int c = 0; c < 4; c++) {
+        for (int l = 0; l < 4; l++) {
+            t[c * 4 + l] = a[l] * b[c * 4] + a[4 + l] * b[c * 4 + 1] + a[8 + l] * b[c * 4 + 2] + a[12 + l] * b[c * 4 + 3];
+        }
+    }
+    memcpy(r, t, sizeof(t));
+}
+
+// Equivale a glTranslatef(x, y, z); glRotatef(rotY, 0, 1, 0); glScalef(escala, escala, escala)
+void matrizProp(float m[16], float x, float y, float z, float rotYGraus, float escala) {
+    float rad = rotYGraus * M_PI / 180.0f;
+    float c = cos(rad) * escala, s = sin(rad) * escala;
+    matrizIdentidade(m);
+    m[0] = c;   m[2] = -s;
+    m[5] = escala;
+    m[8] = s;   m[10] = c;
+    m[12] = x;  m[13] = y;  m[14] = z;
+}
+
+
+// --- ALTURA DO TERRENO ---
+// Relevo procedural (ruido de valor em duas oitavas), deterministico e definido no plano
+// inteiro: os blocos do terreno, os props e a camera usam a mesma funcao. Perto da origem o
+// relevo e zerado para a cena original continuar no plano y = 0.
+
+const float alturaOlhos = 1.0f; // altura da camera acima do terreno
+
+// Valor pseudoaleatorio em [0, 1] de um ponto inteiro da rede
+float ruidoRede(int x, int z) {
+    unsigned int h = (unsigned int)x * 374761393u + (unsigned int)z * 668265263u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    h ^= h >> 16;
+    return (h & 0xffffffu) / (float)0xffffffu;
+}
+
+// Interpolacao suave dos valores da rede
+float ruidoValor(float x, float z) {
+    float fx0 = floorf(x), fz0 = floorf(z);
+    int x0 = (int)fx0, z0 = (int)fz0;
+    float fx = x - fx0, fz = z - fz0;
+    fx = fx * fx * (3.0f - 2.0f * fx);
+    fz = fz * fz * (3.0f - 2.0f * fz);
+    float a = ruidoRede(x0, z0) + (ruidoRede(x0 + 1, z0) - ruidoRede(x0, z0)) * fx;
+    float b = ruidoRede(x0, z0 + 1) + (ruidoRede(x0 + 1, z0 + 1) - ruidoRede(x0, z0 + 1)) * fx;
+    return a + (b - a) * fz;
+}
+
+#define ALTURA_MAXIMA_TERRENO 1.45f // |alturaTerreno| nunca passa de 1,2 + 0,25
+
+float alturaTerreno(float x, float z) {
+    // o relevo entra aos poucos entre 15 e 45 m da origem
+    float t = (sqrtf(x * x + z * z) - 15.0f) / 30.0f;
+    if (t <= 0.0f) return 0.0f;
+    if (t > 1.0f) t = 1.0f;
+    t = t * t * (3.0f - 2.0f * t);
+    float h = (ruidoValor(x / 23.0f, z / 23.0f) - 0.5f) * 2.4f
+            + (ruidoValor(x / 7.0f + 100.0f, z / 7.0f) - 0.5f) * 0.5f;
+    return t * h;
+}
+
+// --- LAYOUT DO PARQUE ---
+// O parque e uma lista de props (banco, poste, arvore), cada um com uma matriz de transformacao
+// e uma tinta de material. Os props ficam ordenados por tipo para que cada tipo seja desenhado
+// com uma unica chamada instanciada.
+
+enum { PROP_BANCO, PROP_POSTE, PROP_ARVORE, NUM_TIPOS_PROP };
+
+const char* const nomesTiposProp[NUM_TIPOS_PROP] = { "banco", "poste", "arvore" };
+
+// Luz pontual do layout (mesmo registro no arquivo de cena). A cor multiplica a de GL_LIGHT1.
+typedef struct {
+    float posicao[3];
+    float raio;                   // alcance: a luz zera suavemente ate essa distancia
+    float cor[3];
+    float reservado;
+} LuzCena;
+
+const float raioLuzPoste = 10.0f;
+const float alturaLuzPoste = 3.1f; // em relacao a base do poste, como a posicao de GL_LIGHT1
+
+typedef struct {
+    int numProps;
+    float (*matrizes)[16];        // transformacao de cada prop (mesmo formato do glMultMatrixf)
+    float (*materiais)[4];        // tinta rgba multiplicada pela cor das partes do prop
+    unsigned char* tipos;         // PROP_BANCO, PROP_POSTE ou PROP_ARVORE
+    int primeiro[NUM_TIPOS_PROP]; // indice do primeiro prop de cada tipo
+    int quantidade[NUM_TIPOS_PROP];
+    float extensao;               // meia largura da area ocupada no XZ (tamanho do chao)
+    LuzCena* luzes;               // luzes pontuais da iluminacao agrupada
+    int numLuzes;
+} LayoutParque;
+
+LayoutParque parque;
+int numPropsParque = 0; // --parque N: gera um parque com N props (0 = cena original)
+const char* arquivoCena = NULL;      // --cena arquivo.cena: layout binario (ver ARQUIVO DE CENA)
+const char* arquivoSalvaCena = NULL; // --salva-cena arquivo.cena: grava o layout em uso
+double tempoCargaCena = 0.0, tempoInit = 0.0; // ms, impressos no inicio e no JSON do benchmark
+
+void alocaParque(LayoutParque* p, int numProps) {
+    p->numProps = numProps;
+    p->matrizes = malloc(sizeof(*p->matrizes) * numProps);
+    p->materiais = malloc(sizeof(*p->materiais) * numProps);
+    p->tipos = malloc(numProps);
+    p->extensao = 10.0f;
+    p->luzes = NULL;
+    p->numLuzes = 0;
+}
+
+// Reordena os props por tipo (counting sort) e preenche primeiro/quantidade
+void ordenaParquePorTipo(LayoutParque* p) {
+    LayoutParque o;
+    alocaParque(&o, p->numProps);
+    o.extensao = p->extensao;
+
+    memset(o.quantidade, 0, sizeof(o.quantidade));
+    for (int i = 0; i < p->numProps; i++) o.quantidade[p->tipos[i]]++;
+    int proximo[NUM_TIPOS_PROP];
+    for (int t = 0, soma = 0; t < NUM_TIPOS_PROP; t++) {
+        o.primeiro[t] = proximo[t] = soma;
+        soma += o.quantidade[t];
+    }
+    for (int i = 0; i < p->numProps; i++) {
+        int j = proximo[p->tipos[i]]++;
+        memcpy(o.matrizes[j], p->matrizes[i], sizeof(o.matrizes[j]));
+        memcpy(o.materiais[j], p->materiais[i], sizeof(o.materiais[j]));
+        o.tipos[j] = p->tipos[i];
+    }
+
+    free(p->matrizes);
+    free(p->materiais);
+    free(p->tipos);
+    o.luzes = p->luzes;
+    o.numLuzes = p->numLuzes;
+    *p = o;
+}
+
+// Uma luz por poste, na altura da lampada (layouts que nao trazem luzes proprias)
+void geraLuzesPostes(LayoutParque* p) {
+    p->numLuzes = p->quantidade[PROP_POSTE];
+    p->luzes = realloc(p->luzes, sizeof(LuzCena) * (p->numLuzes > 0 ? p->numLuzes : 1));
+    for (int k = 0; k < p->numLuzes; k++) {
+        const float* m = p->matrizes[p->primeiro[PROP_POSTE] + k];
+        LuzCena* l = &p->luzes[k];
+        l->posicao[0] = m[4] * alturaLuzPoste + m[12];
+        l->posicao[1] = m[5] * alturaLuzPoste + m[13];
+        l->posicao[2] = m[6] * alturaLuzPoste + m[14];
+        l->raio = raioLuzPoste;
+        l->cor[0] = l->cor[1] = l->cor[2] = 1.0f;
+        l->reservado = 0.0f;
+    }
+}
+
+// O prop fica apoiado no terreno em (x, z)
+void defineProp(LayoutParque* p, int i, int tipo, float x, float z, float rotY, float escala, float r, float g, float b) {
+    p->tipos[i] = tipo;
+    matrizProp(p->matrizes[i], x, alturaTerreno(x, z), z, rotY, escala);
+    p->materiais[i][0] = r;
+    p->materiais[i][1] = g;
+    p->materiais[i][2] = b;
+    p->materiais[i][3] = 1.0f;
+}
+
+// A cena original: banco em (2, 0, -2) girado 30 graus, poste em (-3, 0, 0) e arvore em (-5, 0, 5)
+void criaParqueOriginal(LayoutParque* p) {
+    alocaParque(p, 3);
+    defineProp(p, 0, PROP_BANCO, 2.0f, -2.0f, 30.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+    defineProp(p, 1, PROP_POSTE, -3.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+    defineProp(p, 2, PROP_ARVORE, -5.0f, 5.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+    ordenaParquePorTipo(p);
+    geraLuzesPostes(p);
+}
+
+// gerador pseudo-aleatorio proprio (xorshift) para que o mesmo N gere sempre o mesmo parque
+unsigned int sementeParque = 2025;
+
+float aleatorio() {
+    sementeParque ^= sementeParque << 13;
+    sementeParque ^= sementeParque >> 17;
+    sementeParque ^= sementeParque << 5;
+    return (sementeParque & 0xFFFFFF) / (float)0x1000000;
+}
+
+// Gera um parque com numProps props espalhados numa grade de celulas de 4m centrada na origem
+void geraParque(LayoutParque* p, int numProps) {
+    float espacamento = 4.0f;
+    int lado = (int)ceil(sqrt((double)numProps));
+    alocaParque(p, numProps);
+    p->extensao = fmaxf(10.0f, lado * espacamento * 0.5f + espacamento);
+
+    for (int i = 0; i < numProps; i++) {
+        float x = (i % lado - lado * 0.5f + 0.5f) * espacamento + (aleatorio() - 0.5f) * espacamento * 0.5f;
+        float z = (i / lado - lado * 0.5f + 0.5f) * espacamento + (aleatorio() - 0.5f) * espacamento * 0.5f;
+        float sorteio = aleatorio();
+
+        if (sorteio < 0.45f) {
+            // arvores com tamanho e tom de verde variados
+            float tom = 0.8f + aleatorio() * 0.4f;
+            defineProp(p, i, PROP_ARVORE, x, z, aleatorio() * 360.0f, 0.8f + aleatorio() * 0.5f, 1.0f, tom, 1.0f);
+        } else if (sorteio < 0.8f) {
+            float tom = 0.85f + aleatorio() * 0.3f;
+            defineProp(p, i, PROP_BANCO, x, z, aleatorio() * 360.0f, 1.0f, tom, tom, tom);
+        } else {
+            defineProp(p, i, PROP_POSTE, x, z, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+        }
+    }
+    ordenaParquePorTipo(p);
+    geraLuzesPostes(p);
+}
+
+
+// --- ARQUIVO DE CENA ---
+// Formato binario do layout (little-endian, todos os blocos alinhados em 64 bytes):
+//   CabecalhoCena
+//   RegistroTipoCena[numTipos]   nome e faixa (primeiro, quantidade) de cada tipo
+//   float matrizes[numProps][16]
+//   float materiais[numProps][4]
+//   uint8 tipos[numProps]
+//   LuzCena luzes[numLuzes]
+// Os props ja vem ordenados por tipo. carregaCena mapeia o arquivo com mmap e aponta o
+// layout direto para os blocos: nada e lido campo a campo nem alocado por prop, e os
+// arrays vao do mapeamento para os texture buffers em enviaParqueGPU. O mapeamento e
+// privado (copia na escrita), entao o layout pode ser alterado sem mexer no arquivo.
+
+#define MAGICA_CENA "PRQC"
+#define VERSAO_CENA 1
+#define ALINHAMENTO_CENA 64
+
+typedef struct {
+    char magica[4];
+    uint32_t versao;
+    uint32_t numTipos;
+    uint32_t numProps;
+    uint32_t numLuzes;
+    float extensao;
+    uint64_t offTipos, offMatrizes, offMateriais, offTiposProp, offLuzes;
+    uint64_t tamanho;             // tamanho total do arquivo
+} CabecalhoCena;
+
+typedef struct {
+    char nome[16];
+    uint32_t primeiro;
+    uint32_t quantidade;
+} RegistroTipoCena;
+
+uint64_t alinhaCena(uint64_t off) {
+    return (off + ALINHAMENTO_CENA - 1) & ~(uint64_t)(ALINHAMENTO_CENA - 1);
+}
+
+void preencheCabecalhoCena(CabecalhoCena* c, const LayoutParque* p) {
+    memset(c, 0, sizeof(*c));
+    memcpy(c->magica, MAGICA_CENA, 4);
+    c->versao = VERSAO_CENA;
+    c->numTipos = NUM_TIPOS_PROP;
+    c->numProps = p->numProps;
+    c->numLuzes = p->numLuzes;
+    c->extensao = p->extensao;
+    c->offTipos = alinhaCena(sizeof(CabecalhoCena));
+    c->offMatrizes = alinhaCena(c->offTipos + sizeof(RegistroTipoCena) * NUM_TIPOS_PROP);
+    c->offMateriais = alinhaCena(c->offMatrizes + sizeof(float) * 16 * (uint64_t)p->numProps);
+    c->offTiposProp = alinhaCena(c->offMateriais + sizeof(float) * 4 * (uint64_t)p->numProps);
+    c->offLuzes = alinhaCena(c->offTiposProp + (uint64_t)p->numProps);
+    c->tamanho = c->offLuzes + sizeof(LuzCena) * (uint64_t)p->numLuzes;
+}
+
+// Grava um bloco na posicao off, completando com zeros desde a posicao atual
+bool gravaBlocoCena(FILE* f, uint64_t off, const void* dados, size_t tamanho) {
+    static const char zeros[ALINHAMENTO_CENA];
+    long atual = ftell(f);
+    if (atual < 0 || (uint64_t)atual > off) return false;
+    if (fwrite(zeros, 1, off - atual, f) != off - atual) return false;
+    return tamanho == 0 || fwrite(dados, 1, tamanho, f) == tamanho;
+}
+
+// Grava o layout (ja ordenado por tipo) no formato binario
+bool salvaCena(const char* caminho, const LayoutParque* p) {
+    FILE* f = fopen(caminho, "wb");
+    if (!f) {
+        fprintf(stderr, "Nao foi possivel gravar %s\n", caminho);
+        return false;
+    }
+    CabecalhoCena c;
+    preencheCabecalhoCena(&c, p);
+    RegistroTipoCena tipos[NUM_TIPOS_PROP];
+    memset(tipos, 0, sizeof(tipos));
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        strncpy(tipos[t].nome, nomesTiposProp[t], sizeof(tipos[t].nome) - 1);
+        tipos[t].primeiro = p->primeiro[t];
+        tipos[t].quantidade = p->quantidade[t];
+    }
+    bool ok = gravaBlocoCena(f, 0, &c, sizeof(c))
+        && gravaBlocoCena(f, c.offTipos, tipos, sizeof(tipos))
+        && gravaBlocoCena(f, c.offMatrizes, p->matrizes, sizeof(float) * 16 * (size_t)p->numProps)
+        && gravaBlocoCena(f, c.offMateriais, p->materiais, sizeof(float) * 4 * (size_t)p->numProps)
+        && gravaBlocoCena(f, c.offTiposProp, p->tipos, (size_t)p->numProps)
+        && gravaBlocoCena(f, c.offLuzes, p->luzes, sizeof(LuzCena) * (size_t)p->numLuzes);
+    if (fclose(f) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Erro ao gravar %s\n", caminho);
+    return ok;
+}
+
+// Mapeia o arquivo e aponta o layout para dentro dele. Devolve false (com a mensagem) se o
+// arquivo nao for uma cena valida; nesse caso o layout nao e alterado.
+bool carregaCena(const char* caminho, LayoutParque* p) {
+    int fd = open(caminho, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Nao foi possivel abrir %s\n", caminho);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CabecalhoCena)) {
+        fprintf(stderr, "%s: arquivo de cena muito pequeno\n", caminho);
+        close(fd);
+        return false;
+    }
+    unsigned char* mapa = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); // o mapeamento continua valido sem o descritor
+    if (mapa == MAP_FAILED) {
+        fprintf(stderr, "%s: mmap falhou\n", caminho);
+        return false;
+    }
+
+    // o cabecalho e validado contra o proprio arquivo antes de qualquer ponteiro ser usado
+    const CabecalhoCena* c = (const CabecalhoCena*)mapa;
+    const char* erro = NULL;
+    if (memcmp(c->magica, MAGICA_CENA, 4) != 0) erro = "nao e um arquivo de cena";
+    else if (c->versao != VERSAO_CENA) erro = "versao nao suportada";
+    else if (c->numTipos != NUM_TIPOS_PROP) erro = "tabela de tipos diferente";
+    else if (c->numProps > INT_MAX || c->numLuzes > INT_MAX) erro = "props ou luzes demais"; // o layout guarda em int
+    else if (!isfinite(c->extensao) || c->extensao < 0.0f) erro = "extensao invalida";
+    if (!erro) {
+        CabecalhoCena esperado;
+        LayoutParque tamanhos = { .numProps = (int)c->numProps, .numLuzes = (int)c->numLuzes };
+        preencheCabecalhoCena(&esperado, &tamanhos);
+        if (c->offTipos != esperado.offTipos || c->offMatrizes != esperado.offMatrizes
+            || c->offMateriais != esperado.offMateriais || c->offTiposProp != esperado.offTiposProp
+            || c->offLuzes != esperado.offLuzes || c->tamanho != esperado.tamanho
+            || c->tamanho > (uint64_t)st.st_size) erro = "blocos fora do lugar ou arquivo truncado";
+    }
+
+    // as faixas sao somadas em 64 bits e cada quantidade e limitada ao que ainda falta, para que
+    // nenhuma combinacao de valores de 32 bits do arquivo aponte para fora do bloco de tipos
+    const RegistroTipoCena* tipos = (const RegistroTipoCena*)(mapa + c->offTipos);
+    const unsigned char* tiposProp = mapa + c->offTiposProp;
+    uint64_t soma = 0;
+    for (int t = 0; !erro && t < NUM_TIPOS_PROP; t++) {
+        if (strncmp(tipos[t].nome, nomesTiposProp[t], sizeof(tipos[t].nome)) != 0) erro = "tipo de prop desconhecido";
+        else if (tipos[t].primeiro != soma) erro = "props fora da ordem por tipo";
+        else if (tipos[t].quantidade > c->numProps - soma) erro = "contagem de props inconsistente";
+        else soma += tipos[t].quantidade;
+    }
+    if (!erro && soma != c->numProps) erro = "contagem de props inconsistente";
+    if (erro) {
+        fprintf(stderr, "%s: %s\n", caminho, erro);
+        munmap(mapa, st.st_size);
+        return false;
+    }
+    // o tipo de cada prop tem que bater com a faixa do seu tipo (o desenho confia nisso)
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        const unsigned char* fim = tiposProp + tipos[t].primeiro + tipos[t].quantidade;
+        for (const unsigned char* q = tiposProp + tipos[t].primeiro; q < fim; q++) {
+            if (*q != t) {
+                fprintf(stderr, "%s: tipo de prop fora da sua faixa\n", caminho);
+                munmap(mapa, st.st_size);
+                return false;
+            }
+        }
+    }
+
+    p->numProps = c->numProps;
+    p->extensao = c->extensao;
+    p->matrizes = (float (*)[16])(mapa + c->offMatrizes);
+    p->materiais = (float (*)[4])(mapa + c->offMateriais);
+    p->tipos = mapa + c->offTiposProp;
+    p->luzes = (LuzCena*)(mapa + c->offLuzes);
+    p->numLuzes = c->numLuzes;
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        p->primeiro[t] = tipos[t].primeiro;
+        p->quantidade[t] = tipos[t].quantidade;
+    }
+    return true;
+}
+
+// Converte um layout em texto para o formato binario. Uma linha por item, '#' comenta:
+//   extensao E
+//   banco|poste|arvore X Z [rotY escala r g b]
+//   luz X Y Z [raio r g b]      (Y acima do terreno)
+// As posicoes vao para o arquivo ja em cima do relevo (alturaTerreno).
+// Sem nenhuma linha "luz", cada poste ganha a sua luz como nos parques gerados.
+bool converteTextoCena(const char* entrada, const char* saida) {
+    FILE* f = fopen(entrada, "r");
+    if (!f) {
+        fprintf(stderr, "Nao foi possivel abrir %s\n", entrada);
+        return false;
+    }
+    LayoutParque p;
+    int capProps = 64, capLuzes = 0;
+    alocaParque(&p, capProps);
+    p.numProps = 0;
+    float extensao = 0.0f;
+    float maiorCoordenada = 0.0f;
+
+    char linha[256];
+    int numLinha = 0;
+    bool ok = true;
+    while (ok && fgets(linha, sizeof(linha), f)) {
+        numLinha++;
+        char* comentario = strchr(linha, '#');
+        if (comentario) *comentario = '\0';
+        char nome[16];
+        float v[8] = {0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+        int n = sscanf(linha, "%15s %f %f %f %f %f %f %f %f", nome, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+        if (n <= 0) continue;
+
+        int tipo = -1;
+        for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+            if (strcmp(nome, nomesTiposProp[t]) == 0) tipo = t;
+        }
+        if (strcmp(nome, "extensao") == 0 && n == 2) {
+            extensao = v[0];
+        } else if (tipo >= 0 && n >= 3) {
+            // campos que faltam: rotacao 0, escala 1, tinta branca
+            if (n < 4) v[2] = 0.0f;
+            if (n < 5) v[3] = 1.0f;
+            if (p.numProps == capProps) {
+                capProps *= 2;
+                p.matrizes = realloc(p.matrizes, sizeof(*p.matrizes) * capProps);
+                p.materiais = realloc(p.materiais, sizeof(*p.materiais) * capProps);
+                p.tipos = realloc(p.tipos, capProps);
+            }
+            defineProp(&p, p.numProps++, tipo, v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
+            maiorCoordenada = fmaxf(maiorCoordenada, fmaxf(fabsf(v[0]), fabsf(v[1])));
+        } else if (strcmp(nome, "luz") == 0 && n >= 4) {
+            if (p.numLuzes == capLuzes) {
+                capLuzes = capLuzes ? capLuzes * 2 : 16;
+                p.luzes = realloc(p.luzes, sizeof(LuzCena) * capLuzes);
+            }
+            LuzCena* l = &p.luzes[p.numLuzes++];
+            l->posicao[0] = v[0]; l->posicao[1] = v[1] + alturaTerreno(v[0], v[2]); l->posicao[2] = v[2];
+            l->raio = n >= 5 ? v[3] : raioLuzPoste;
+            l->cor[0] = v[4]; l->cor[1] = v[5]; l->cor[2] = v[6];
+            l->reservado = 0.0f;
+        } else {
+            fprintf(stderr, "%s:%d: linha invalida\n", entrada, numLinha);
+            ok = false;
+        }
+    }
+    fclose(f);
+
+    if (ok) {
+        p.extensao = extensao > 0.0f ? extensao : fmaxf(10.0f, maiorCoordenada + 4.0f);
+        ordenaParquePorTipo(&p);
+        if (p.numLuzes == 0) geraLuzesPostes(&p);
+        ok = salvaCena(saida, &p);
+        if (ok) printf("%s: %d props, %d luzes\n", saida, p.numProps, p.numLuzes);
+    }
+    free(p.matrizes);
+    free(p.materiais);
+    free(p.tipos);
+    free(p.luzes);
+    return ok;
+}
+
+// --- BVH E CULLING POR FRUSTUM ---
+// Cada prop tem uma caixa alinhada aos eixos (AABB) no mundo. As caixas sao organizadas numa
+// hierarquia (BVH) montada em init(). A cada frame a BVH e testada contra os 6 planos do
+// frustum da camera: um no totalmente fora descarta todos os props abaixo dele sem testa-los,
+// e um no totalmente dentro aceita todos sem mais testes.
+
+#define PROPS_POR_FOLHA 4
+
+typedef struct {
+    float min[3], max[3];
+    int filho;        // indice do filho esquerdo (o direito e filho + 1); -1 nas folhas
+    int primeiro;     // intervalo dos props em bvh.indices
+    int quantidade;
+} NoBVH;
+
+typedef struct {
+    NoBVH* nos;
+    int numNos;
+    int* indices;          // props reordenados para que cada no cubra um intervalo continuo
+    float (*caixas)[6];    // AABB de cada prop no mundo: min xyz, max xyz
+    int* pais;             // pai de cada no (-1 na raiz), para reajustar as caixas de um prop editado
+    int* folhaProp;        // folha que contem cada prop
+} BVH;
+
+BVH bvh;
+
+// AABB local de cada tipo de prop (calculada ao montar a malha composta)
+float caixaTipoProp[NUM_TIPOS_PROP][6];
+
+bool usarCulling = true; // 'F' liga/desliga o culling por frustum
+
+// Contadores do ultimo frame (tecla 'C' imprime)
+typedef struct {
+    int nosVisitados;    // nos da BVH testados contra o frustum
+    int descartados;     // props eliminados pelo culling
+    int desenhados;      // props enviados para a GPU
+} EstatisticasCulling;
+
+EstatisticasCulling estatCulling;
+
+// Props visiveis no frame, separados por tipo: o tipo t usa a faixa
+// [parque.primeiro[t], parque.primeiro[t] + numVisiveis[t]) de listaVisiveis.
+// listaVisiveis aponta para visiveisSerial ou para a lista pronta da travessia em paralelo.
+GLuint* listaVisiveis = NULL;
+GLuint* visiveisSerial = NULL;
+GLuint* ordemBVHSerial = NULL; // props achados pela travessia serial, antes de separar por tipo
+int numVisiveis[NUM_TIPOS_PROP];
+
+// Caixa local transformada pela matriz m (centro transformado + extensoes pelo |m|)
+void transformaCaixa(const float m[16], const float local[6], float mundo[6]) {
+    for (int i = 0; i < 3; i++) {
+        float centro = m[12 + i];
+        float raio = 0.0f;
+        for (int j = 0; j < 3; j++) {
+            float c = (local[j] + local[3 + j]) * 0.5f;
+            float e = (local[3 + j] - local[j]) * 0.5f;
+            centro += m[j * 4 + i] * c;
+            raio += fabsf(m[j * 4 + i]) * e;
+        }
+        mundo[i] = centro - raio;
+        mundo[3 + i] = centro + raio;
+    }
+}
+
+// eixo usado na ordenacao dos props durante a construcao (qsort nao recebe contexto)
+int eixoOrdenacao;
+
+int comparaCentroProp(const void* a, const void* b) {
+    const float* ca = bvh.caixas[*(const int*)a];
+    const float* cb = bvh.caixas[*(const int*)b];
+    float va = ca[eixoOrdenacao] + ca[3 + eixoOrdenacao];
+    float vb = cb[eixoOrdenacao] + cb[3 + eixoOrdenacao];
+    return (va > vb) - (va < vb);
+}
+
+// Constroi o no com os props [primeiro, primeiro + quantidade) e, se preciso, divide pela mediana
+void constroiNoBVH(int no, int primeiro, int quantidade) {
+    NoBVH* n = &bvh.nos[no];
+    n->primeiro = primeiro;
+    n->quantidade = quantidade;
+    n->filho = -1;
+
+    float centroMin[3] = { INFINITY, INFINITY, INFINITY };
+    float centroMax[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (int k = 0; k < 3; k++) { n->min[k] = INFINITY; n->max[k] = -INFINITY; }
+    for (int i = primeiro; i < primeiro + quantidade; i++) {
+        const float* c = bvh.caixas[bvh.indices[i]];
+        for (int k = 0; k < 3; k++) {
+            n->min[k] = fminf(n->min[k], c[k]);
+            n->max[k] = fmaxf(n->max[k], c[3 + k]);
+            float centro = (c[k] + c[3 + k]) * 0.5f;
+            centroMin[k] = fminf(centroMin[k], centro);
+            centroMax[k] = fmaxf(centroMax[k], centro);
+        }
+    }
+    if (quantidade <= PROPS_POR_FOLHA) {
+        for (int i = primeiro; i < primeiro + quantidade; i++) bvh.folhaProp[bvh.indices[i]] = no;
+        return;
+    }
+
+    // divide no eixo em que os centros estao mais espalhados
+    eixoOrdenacao = 0;
+    for (int k = 1; k < 3; k++) {
+        if (centroMax[k] - centroMin[k] > centroMax[eixoOrdenacao] - centroMin[eixoOrdenacao]) eixoOrdenacao = k;
+    }
+    qsort(bvh.indices + primeiro, quantidade, sizeof(int), comparaCentroProp);
+
+    int metade = quantidade / 2;
+    n->filho = bvh.numNos;
+    bvh.numNos += 2;
+    bvh.pais[n->filho] = bvh.pais[n->filho + 1] = no;
+    constroiNoBVH(n->filho, primeiro, metade);
+    constroiNoBVH(n->filho + 1, primeiro + metade, quantidade - metade);
+}
+
+void constroiBVH() {
+    free(bvh.nos);
+    free(bvh.indices);
+    free(bvh.caixas);
+    free(bvh.pais);
+    free(bvh.folhaProp);
+    free(visiveisSerial);
+    free(ordemBVHSerial);
+
+    int n = parque.numProps;
+    bvh.caixas = malloc(sizeof(*bvh.caixas) * (n > 0 ? n : 1));
+    bvh.indices = malloc(sizeof(int) * (n > 0 ? n : 1));
+    bvh.nos = malloc(sizeof(NoBVH) * (2 * n + 1));
+    bvh.pais = malloc(sizeof(int) * (2 * n + 1));
+    bvh.folhaProp = malloc(sizeof(int) * (n > 0 ? n : 1));
+    visiveisSerial = malloc(sizeof(GLuint) * (n > 0 ? n : 1));
+    ordemBVHSerial = malloc(sizeof(GLuint) * (n > 0 ? n : 1));
+    listaVisiveis = visiveisSerial;
+
+    for (int i = 0; i < n; i++) {
+        transformaCaixa(mundoProp(i), caixaTipoProp[parque.tipos[i]], bvh.caixas[i]);
+        bvh.indices[i] = i;
+    }
+    bvh.numNos = 1;
+    bvh.pais[0] = -1;
+    constroiNoBVH(0, 0, n);
+}
+
+// Planos do frustum (ax + by + cz + d >= 0 dentro) extraidos de projecao * vista
+void extraiFrustum(const float proj[16], const float vista[16], float planos[6][4]) {
+    float m[16];
+    matrizMultiplica(m, proj, vista);
+    for (int p = 0; p < 6; p++) {
+        int linha = p / 2;                    // esquerda/direita, baixo/cima, perto/longe
+        float sinal = (p % 2 == 0) ? 1.0f : -1.0f;
+        for (int k = 0; k < 4; k++) {
+            planos[p][k] = m[k * 4 + 3] + sinal * m[k * 4 + linha];
+        }
+    }
+}
+
+// 0 = fora, 1 = cruza algum plano, 2 = totalmente dentro
+int testaCaixaFrustum(const float planos[6][4], const float min[3], const float max[3]) {
+    int resultado = 2;
+    for (int p = 0; p < 6; p++) {
+        const float* pl = planos[p];
+        // vertice da caixa mais a frente (p) e mais atras (n) em relacao a normal do plano
+        float px = pl[0] >= 0 ? max[0] : min[0], nx = pl[0] >= 0 ? min[0] : max[0];
+        float py = pl[1] >= 0 ? max[1] : min[1], ny = pl[1] >= 0 ? min[1] : max[1];
+        float pz = pl[2] >= 0 ? max[2] : min[2], nz = pl[2] >= 0 ? min[2] : max[2];
+        if (pl[0] * px + pl[1] * py + pl[2] * pz + pl[3] < 0) return 0;
+        if (pl[0] * nx + pl[1] * ny + pl[2] * nz + pl[3] < 0) resultado = 1;
+    }
+    return resultado;
+}
+
+void marcaVisivel(int prop) {
+    int t = parque.tipos[prop];
+    listaVisiveis[parque.primeiro[t] + numVisiveis[t]++] = prop;
+}
+
+// Percorre a subarvore da BVH a partir de 'raiz' e grava em 'saida' os props dentro do frustum,
+// na ordem da BVH (planos == NULL aceita todos). Devolve quantos foram gravados.
+int percorreNoBVH(int raiz, const float planos[6][4], GLuint* saida, EstatisticasCulling* est) {
+    // pilha de nos pendentes; 'dentro' indica que o pai ja estava totalmente dentro
+    int pilha[128];
+    bool dentro[128];
+    int topo = 0, num = 0;
+    pilha[topo] = raiz;
+    dentro[topo++] = (planos == NULL);
+
+    while (topo > 0) {
+        topo--;
+        const NoBVH* n = &bvh.nos[pilha[topo]];
+        bool todoDentro = dentro[topo];
+
+        if (!todoDentro) {
+            est->nosVisitados++;
+            int r = testaCaixaFrustum(planos, n->min, n->max);
+            if (r == 0) {
+                est->descartados += n->quantidade;
+                continue;
+            }
+            todoDentro = (r == 2);
+        }
+
+        if (todoDentro || n->filho < 0) {
+            for (int i = n->primeiro; i < n->primeiro + n->quantidade; i++) {
+                int prop = bvh.indices[i];
+                const float* c = bvh.caixas[prop];
+                if (!todoDentro && testaCaixaFrustum(planos, c, c + 3) == 0) {
+                    est->descartados++;
+                    continue;
+                }
+                saida[num++] = prop;
+            }
+            continue;
+        }
+
+        pilha[topo] = n->filho + 1;
+        dentro[topo++] = false;
+        pilha[topo] = n->filho;
+        dentro[topo++] = false;
+    }
+    return num;
+}
+
+// Percorre a BVH e preenche listaVisiveis/numVisiveis com os props dentro do frustum
+void cullingFrustum() {
+    memset(&estatCulling, 0, sizeof(estatCulling));
+    memset(numVisiveis, 0, sizeof(numVisiveis));
+    listaVisiveis = visiveisSerial;
+
+    if (!usarCulling || parque.numProps == 0) {
+        for (int i = 0; i < parque.numProps; i++) marcaVisivel(i);
+        estatCulling.desenhados = parque.numProps;
+        return;
+    }
+
+    float planos[6][4];
+    extraiFrustum(matrizProjecao, matrizVista, planos);
+
+    // props em ordem da BVH, depois separados por tipo
+    int num = percorreNoBVH(0, planos, ordemBVHSerial, &estatCulling);
+    for (int k = 0; k < num; k++) marcaVisivel(ordemBVHSerial[k]);
+
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) estatCulling.desenhados += numVisiveis[t];
+}
+
+// --- NIVEL DE DETALHE (LOD) ---
+// Cada primitiva e cada prop composto tem NUM_NIVEIS_LOD tesselacoes pre-calculadas. O nivel de
+// cada prop visivel e escolhido pelo tamanho projetado na tela (em pixels), com histerese:
+// para trocar de nivel o tamanho tem que passar do limiar com uma folga, senao um prop parado
+// bem no limiar ficaria alternando entre dois niveis (flicker).
+
+// segmentos do cilindro e fatias x pilhas das esferas por nivel (o nivel 0 e o original)
+const int segmentosCilindro[NUM_NIVEIS_LOD] = { 16, 6, 3 };
+const int tessEsferaPoste[NUM_NIVEIS_LOD][2] = { {16, 16}, {8, 6}, {5, 3} };
+const int tessEsferaCopa[NUM_NIVEIS_LOD][2] = { {20, 20}, {10, 8}, {6, 4} };
+
+// diametro projetado (pixels) na fronteira entre o nivel i e o nivel i + 1
+const float limiarLOD[NUM_NIVEIS_LOD - 1] = { 150.0f, 40.0f };
+const float folgaLOD = 0.15f; // histerese de 15% em torno de cada limiar
+
+bool usarLOD = true;               // 'D' liga/desliga (desligado tudo usa o nivel 0)
+unsigned char* nivelProp = NULL;   // nivel atual de cada prop (persistente, para a histerese)
+GLuint* ordemLOD = NULL;           // area de trabalho do counting sort de selecionaLOD
+
+// Visiveis do tipo t no nivel L ficam em listaVisiveis[parque.primeiro[t] + inicioNivel[t][L] ...]
+int inicioNivel[NUM_TIPOS_PROP][NUM_NIVEIS_LOD];
+int numVisiveisNivel[NUM_TIPOS_PROP][NUM_NIVEIS_LOD];
+
+typedef struct {
+    int props[NUM_NIVEIS_LOD];   // props desenhados em cada nivel
+    long vertices;               // vertices enviados no frame
+    long verticesSemLOD;         // vertices que seriam enviados com tudo no nivel 0
+} EstatisticasLOD;
+
+EstatisticasLOD estatLOD;
+
+void alocaNiveisLOD() {
+    free(nivelProp);
+    free(ordemLOD);
+    nivelProp = calloc(parque.numProps > 0 ? parque.numProps : 1, 1);
+    ordemLOD = malloc(sizeof(GLuint) * (parque.numProps > 0 ? parque.numProps : 1));
+}
+
+// Nivel novo de um prop com diametro projetado 'pixels' que estava no nivel 'atual'
+int escolheNivelLOD(int atual, float pixels) {
+    int nivel = atual;
+    while (nivel > 0 && pixels > limiarLOD[nivel - 1] * (1.0f + folgaLOD)) nivel--;
+    while (nivel < NUM_NIVEIS_LOD - 1 && pixels < limiarLOD[nivel] * (1.0f - folgaLOD)) nivel++;
+    return nivel;
+}
+
+// Nivel do prop i visto de 'camera' (escalaPixels converte tamanho / distancia em pixels)
+int nivelLODProp(int i, const float camera[3], float escalaPixels) {
+    const float* c = bvh.caixas[i];
+    float dx = (c[0] + c[3]) * 0.5f - camera[0];
+    float dy = (c[1] + c[4]) * 0.5f - camera[1];
+    float dz = (c[2] + c[5]) * 0.5f - camera[2];
+    float diametro = sqrtf((c[3] - c[0]) * (c[3] - c[0]) + (c[4] - c[1]) * (c[4] - c[1]) + (c[5] - c[2]) * (c[5] - c[2]));
+    float distancia = fmaxf(sqrtf(dx * dx + dy * dy + dz * dz), 0.1f);
+    return escolheNivelLOD(nivelProp[i], diametro * escalaPixels / distancia);
+}
+
+// Escolhe o nivel dos props visiveis e reordena cada faixa de listaVisiveis por nivel
+void selecionaLOD() {
+    // matrizProjecao[5] = 1 / tan(fov / 2): converte tamanho / distancia em pixels
+    float escalaPixels = matrizProjecao[5] * windowHeight * 0.5f;
+    float camera[3] = { cameraX, cameraY, cameraZ };
+
+    memset(estatLOD.props, 0, sizeof(estatLOD.props));
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        GLuint* faixa = listaVisiveis + parque.primeiro[t];
+        int contagem[NUM_NIVEIS_LOD] = { 0 };
+
+        for (int k = 0; k < numVisiveis[t]; k++) {
+            int i = faixa[k];
+            int nivel = usarLOD ? nivelLODProp(i, camera, escalaPixels) : 0;
+            nivelProp[i] = nivel;
+            contagem[nivel]++;
+        }
+
+        // counting sort estavel da faixa por nivel
+        int proximo[NUM_NIVEIS_LOD];
+        for (int L = 0, soma = 0; L < NUM_NIVEIS_LOD; L++) {
+            inicioNivel[t][L] = proximo[L] = soma;
+            numVisiveisNivel[t][L] = contagem[L];
+            estatLOD.props[L] += contagem[L];
+            soma += contagem[L];
+        }
+        for (int k = 0; k < numVisiveis[t]; k++) ordemLOD[proximo[nivelProp[faixa[k]]]++] = faixa[k];
+        memcpy(faixa, ordemLOD, sizeof(GLuint) * numVisiveis[t]);
+    }
+}
+
+// --- TRAVESSIA EM PARALELO ---
+// Culling, escolha de LOD e separacao por tipo/nivel rodam num grupo de threads. A BVH e
+// dividida em blocos (subarvores com ate ~numProps / (8 * threads) props, na ordem da BVH);
+// cada thread comeca com uma faixa continua de blocos e, quando acaba a sua, rouba blocos do
+// fim da faixa das outras. A saida de cada bloco vai para a arena da thread (memoria do frame,
+// so um ponteiro que volta a zero) e a ultima thread a terminar junta os blocos em ordem na
+// lista de render, entao o resultado e o mesmo da travessia serial.
+// A lista e duplicada: com 'T' ligado (padrao) o frame N desenha a lista preparada no frame
+// N - 1 enquanto as threads ja preparam a do frame N; desligado, o frame espera a sua lista.
+
+typedef struct {
+    GLuint* visiveis;                                    // faixas por tipo, como listaVisiveis
+    int numVisiveis[NUM_TIPOS_PROP];
+    int inicioNivel[NUM_TIPOS_PROP][NUM_NIVEIS_LOD];
+    int numVisiveisNivel[NUM_TIPOS_PROP][NUM_NIVEIS_LOD];
+    EstatisticasCulling culling;
+    int propsNivel[NUM_NIVEIS_LOD];
+    GLfloat vista[16];                                   // camera com que a lista foi feita
+    double tempoMs;                                      // do pedido ate a lista ficar pronta
+} ListaRender;
+
+typedef struct {
+    char* base;
+    size_t usado, capacidade;
+} Arena;
+
+typedef struct {
+    GLuint* props;                                   // visiveis do bloco, agrupados por tipo e nivel
+    int contagem[NUM_TIPOS_PROP][NUM_NIVEIS_LOD];
+    EstatisticasCulling culling;
+} ResultadoBloco;
+
+typedef struct {
+    int numThreads;
+    pthread_t* threads;
+    Arena* arenas;
+    uint64_t* faixas;          // por thread: inicio (32 bits baixos) e fim (altos) dos blocos que restam
+    int* blocos;               // raiz de cada bloco na BVH
+    ResultadoBloco* resultados;
+    int numBlocos;
+    ListaRender listas[2];
+    int escrita;               // lista que as threads estao preenchendo
+    int leitura;               // lista que o frame desenha (-1 = nenhuma pronta ainda)
+
+    // pedido do frame (copiado antes de acordar as threads; so lido por elas)
+    float planos[6][4];
+    bool culling, lod;
+    float camera[3], escalaPixels;
+    double inicioMs;
+
+    pthread_mutex_t trava;
+    pthread_cond_t temTrabalho, terminou;
+    long pedido, pronto;       // frames pedidos e prontos
+    bool pendente;             // lista pedida que ainda nao virou a de leitura
+    int restantes;             // threads ainda trabalhando no pedido atual
+    bool encerrar;             // terminaTravessia: as threads saem em vez de esperar outro pedido
+} Travessia;
+
+Travessia travessia;
+int threadsTravessia = -1;      // --threads N (0 = tudo na thread do GL; -1 = nucleos - 1)
+bool travessiaAtrasada = true;  // 'T': desenha a lista do frame anterior em vez de esperar a atual
+
+void* arenaAloca(Arena* a, size_t tamanho) {
+    tamanho = (tamanho + 15) & ~(size_t)15;
+    if (a->usado + tamanho > a->capacidade) {
+        fprintf(stderr, "Arena da travessia sem espaco\n");
+        abort();
+    }
+    void* p = a->base + a->usado;
+    a->usado += tamanho;
+    return p;
+}
+
+uint64_t empacotaFaixa(uint32_t inicio, uint32_t fim) {
+    return ((uint64_t)fim << 32) | inicio;
+}
+
+// Pega o proximo bloco da propria faixa (pelo inicio) ou rouba da faixa de outra (pelo fim)
+int pegaBloco(int faixa, bool roubo) {
+    uint64_t* f = &travessia.faixas[faixa];
+    uint64_t atual = __atomic_load_n(f, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t inicio = (uint32_t)atual, fim = (uint32_t)(atual >> 32);
+        if (inicio >= fim) return -1;
+        uint64_t novo = roubo ? empacotaFaixa(inicio, fim - 1) : empacotaFaixa(inicio + 1, fim);
+        if (__atomic_compare_exchange_n(f, &atual, novo, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return roubo ? (int)fim - 1 : (int)inicio;
+        }
+    }
+}
+
+// Culling e LOD dos props de um bloco; a saida (na arena) sai agrupada por tipo e nivel
+void processaBloco(int b, Arena* arena) {
+    Travessia* tv = &travessia;
+    ResultadoBloco* r = &tv->resultados[b];
+    const NoBVH* raiz = &bvh.nos[tv->blocos[b]];
+    memset(r, 0, sizeof(*r));
+
+    GLuint* encontrados = arenaAloca(arena, sizeof(GLuint) * raiz->quantidade);
+    int num = percorreNoBVH(tv->blocos[b], tv->culling ? tv->planos : NULL, encontrados, &r->culling);
+
+    for (int k = 0; k < num; k++) {
+        int i = encontrados[k];
+        int nivel = tv->lod ? nivelLODProp(i, tv->camera, tv->escalaPixels) : 0;
+        nivelProp[i] = nivel; // cada prop esta em um bloco so: sem disputa entre threads
+        r->contagem[parque.tipos[i]][nivel]++;
+    }
+
+    int proximo[NUM_TIPOS_PROP][NUM_NIVEIS_LOD];
+    for (int t = 0, soma = 0; t < NUM_TIPOS_PROP; t++) {
+        for (int L = 0; L < NUM_NIVEIS_LOD; L++) {
+            proximo[t][L] = soma;
+            soma += r->contagem[t][L];
+        }
+    }
+    r->props = arenaAloca(arena, sizeof(GLuint) * (num > 0 ? num : 1));
+    for (int k = 0; k < num; k++) {
+        int i = encontrados[k];
+        r->props[proximo[parque.tipos[i]][nivelProp[i]]++] = i;
+    }
+    r->culling.desenhados = num;
+}
+
+// Junta os blocos, em ordem, na lista que esta sendo escrita (feito pela ultima thread)
+void juntaBlocos() {
+    Travessia* tv = &travessia;
+    ListaRender* l = &tv->listas[tv->escrita];
+    memset(&l->culling, 0, sizeof(l->culling));
+    memset(l->propsNivel, 0, sizeof(l->propsNivel));
+
+    int total[NUM_TIPOS_PROP][NUM_NIVEIS_LOD] = { { 0 } };
+    for (int b = 0; b < tv->numBlocos; b++) {
+        const ResultadoBloco* r = &tv->resultados[b];
+        l->culling.nosVisitados += r->culling.nosVisitados;
+        l->culling.descartados += r->culling.descartados;
+        l->culling.desenhados += r->culling.desenhados;
+        for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+            for (int L = 0; L < NUM_NIVEIS_LOD; L++) total[t][L] += r->contagem[t][L];
+        }
+    }
+
+    int proximo[NUM_TIPOS_PROP][NUM_NIVEIS_LOD];
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        l->numVisiveis[t] = 0;
+        for (int L = 0; L < NUM_NIVEIS_LOD; L++) {
+            l->inicioNivel[t][L] = l->numVisiveis[t];
+            l->numVisiveisNivel[t][L] = total[t][L];
+            l->propsNivel[L] += total[t][L];
+            proximo[t][L] = parque.primeiro[t] + l->numVisiveis[t];
+            l->numVisiveis[t] += total[t][L];
+        }
+    }
+    for (int b = 0; b < tv->numBlocos; b++) {
+        const ResultadoBloco* r = &tv->resultados[b];
+        const GLuint* origem = r->props;
+        for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+            for (int L = 0; L < NUM_NIVEIS_LOD; L++) {
+                int n = r->contagem[t][L];
+                memcpy(l->visiveis + proximo[t][L], origem, sizeof(GLuint) * n);
+                proximo[t][L] += n;
+                origem += n;
+            }
+        }
+    }
+    l->tempoMs = tempoAtualMs() - tv->inicioMs;
+}
+
+void* trabalhadorTravessia(void* arg) {
+    Travessia* tv = &travessia;
+    int eu = (int)(intptr_t)arg;
+    long visto = 0;
+    for (;;) {
+        pthread_mutex_lock(&tv->trava);
+        while (tv->pedido == visto && !tv->encerrar) pthread_cond_wait(&tv->temTrabalho, &tv->trava);
+        visto = tv->pedido;
+        bool encerrar = tv->encerrar;
+        pthread_mutex_unlock(&tv->trava);
+        if (encerrar) break;
+
+        Arena* arena = &tv->arenas[eu];
+        arena->usado = 0; // a memoria do frame anterior ja foi juntada na lista
+        int b;
+        while ((b = pegaBloco(eu, false)) >= 0) processaBloco(b, arena);
+        for (int k = 1; k < tv->numThreads; k++) {
+            int vitima = (eu + k) % tv->numThreads;
+            while ((b = pegaBloco(vitima, true)) >= 0) processaBloco(b, arena);
+        }
+
+        if (__atomic_sub_fetch(&tv->restantes, 1, __ATOMIC_ACQ_REL) == 0) {
+            juntaBlocos();
+            pthread_mutex_lock(&tv->trava);
+            tv->pronto = visto;
+            pthread_cond_broadcast(&tv->terminou);
+            pthread_mutex_unlock(&tv->trava);
+        }
+    }
+    return NULL;
+}
+
+// Blocos: desce da raiz ate subarvores com no maximo 'limite' props, guardando-as na ordem da BVH
+void divideBlocos(int no, int limite) {
+    const NoBVH* n = &bvh.nos[no];
+    if (n->quantidade <= limite || n->filho < 0) {
+        travessia.blocos[travessia.numBlocos++] = no;
+        return;
+    }
+    divideBlocos(n->filho, limite);
+    divideBlocos(n->filho + 1, limite);
+}
+
+void criaTravessia() {
+    Travessia* tv = &travessia;
+    int n = parque.numProps;
+    if (threadsTravessia < 0) {
+        long nucleos = sysconf(_SC_NPROCESSORS_ONLN);
+        threadsTravessia = nucleos > 1 ? (int)(nucleos - 1) : 1; // um nucleo fica para a thread do GL
+    }
+    if (threadsTravessia == 0 || n == 0) return;
+
+    tv->numThreads = threadsTravessia;
+    int limite = n / (8 * tv->numThreads);
+    if (limite < 64) limite = 64;
+    tv->blocos = malloc(sizeof(int) * (2 * n + 1));
+    tv->numBlocos = 0;
+    divideBlocos(0, limite);
+    tv->resultados = malloc(sizeof(ResultadoBloco) * tv->numBlocos);
+    tv->faixas = calloc(tv->numThreads, sizeof(uint64_t));
+    tv->arenas = calloc(tv->numThreads, sizeof(Arena));
+    for (int i = 0; i < tv->numThreads; i++) {
+        // pior caso: a thread processa todos os blocos (visiveis + agrupados por tipo/nivel)
+        tv->arenas[i].capacidade = 2 * (sizeof(GLuint) * n + 16 * (size_t)tv->numBlocos);
+        tv->arenas[i].base = malloc(tv->arenas[i].capacidade);
+    }
+    for (int i = 0; i < 2; i++) tv->listas[i].visiveis = malloc(sizeof(GLuint) * n);
+    tv->escrita = 0;
+    tv->leitura = -1;
+
+    pthread_mutex_init(&tv->trava, NULL);
+    pthread_cond_init(&tv->temTrabalho, NULL);
+    pthread_cond_init(&tv->terminou, NULL);
+    tv->threads = malloc(sizeof(pthread_t) * tv->numThreads);
+    for (int i = 0; i < tv->numThreads; i++) pthread_create(&tv->threads[i], NULL, trabalhadorTravessia, (void*)(intptr_t)i);
+    fprintf(stderr, "Travessia: %d threads, %d blocos de ate %d props\n", tv->numThreads, tv->numBlocos, limite);
+}
+
+bool travessiaAtiva() {
+    return travessia.numThreads > 0;
+}
+
+void esperaTravessia() {
+    Travessia* tv = &travessia;
+    pthread_mutex_lock(&tv->trava);
+    while (tv->pronto != tv->pedido) pthread_cond_wait(&tv->terminou, &tv->trava);
+    pthread_mutex_unlock(&tv->trava);
+}
+
+// Espera o pedido em andamento, acorda as threads para sairem e junta todas (atexit)
+void terminaTravessia() {
+    Travessia* tv = &travessia;
+    if (!travessiaAtiva()) return;
+    esperaTravessia();
+    pthread_mutex_lock(&tv->trava);
+    tv->encerrar = true;
+    pthread_cond_broadcast(&tv->temTrabalho);
+    pthread_mutex_unlock(&tv->trava);
+    for (int i = 0; i < tv->numThreads; i++) pthread_join(tv->threads[i], NULL);
+    tv->numThreads = 0;
+}
+
+// Espera a lista pedida e passa a desenha-la
+void trocaListasTravessia() {
+    Travessia* tv = &travessia;
+    esperaTravessia();
+    tv->leitura = tv->escrita;
+    tv->escrita = 1 - tv->escrita;
+    tv->pendente = false;
+}
+
+// Pede a lista da camera atual (chamado em display logo depois do gluLookAt)
+void iniciaTravessia() {
+    Travessia* tv = &travessia;
+    if (!travessiaAtiva()) return;
+
+    // a lista pedida no frame anterior vira a de leitura; a outra pode ser reescrita
+    if (tv->pendente) trocaListasTravessia();
+
+    extraiFrustum(matrizProjecao, matrizVista, tv->planos);
+    tv->culling = usarCulling;
+    tv->lod = usarLOD;
+    tv->camera[0] = cameraX;
+    tv->camera[1] = cameraY;
+    tv->camera[2] = cameraZ;
+    tv->escalaPixels = matrizProjecao[5] * windowHeight * 0.5f;
+    memcpy(tv->listas[tv->escrita].vista, matrizVista, sizeof(matrizVista));
+    tv->inicioMs = tempoAtualMs();
+    for (int i = 0; i < tv->numThreads; i++) {
+        uint32_t inicio = (uint32_t)((long)tv->numBlocos * i / tv->numThreads);
+        uint32_t fim = (uint32_t)((long)tv->numBlocos * (i + 1) / tv->numThreads);
+        __atomic_store_n(&tv->faixas[i], empacotaFaixa(inicio, fim), __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_lock(&tv->trava);
+    tv->restantes = tv->numThreads;
+    tv->pendente = true;
+    tv->pedido++;
+    pthread_cond_broadcast(&tv->temTrabalho);
+    pthread_mutex_unlock(&tv->trava);
+}
+
+// Lista que o frame desenha: a anterior (atrasada) ou a que acabou de ser pedida
+void usaListaTravessia() {
+    Travessia* tv = &travessia;
+    if (tv->pendente && (!travessiaAtrasada || tv->leitura < 0)) trocaListasTravessia();
+    const ListaRender* l = &tv->listas[tv->leitura];
+    listaVisiveis = l->visiveis;
+    memcpy(numVisiveis, l->numVisiveis, sizeof(numVisiveis));
+    memcpy(inicioNivel, l->inicioNivel, sizeof(inicioNivel));
+    memcpy(numVisiveisNivel, l->numVisiveisNivel, sizeof(numVisiveisNivel));
+    memcpy(estatLOD.props, l->propsNivel, sizeof(estatLOD.props));
+    estatCulling = l->culling;
+}
+
+// A lista desenhada foi feita com outra camera (o escalonador desenha mais um frame)
+bool travessiaDesatualizada() {
+    const Travessia* tv = &travessia;
+    if (!travessiaAtiva() || tv->leitura < 0) return false;
+    return memcmp(tv->listas[tv->leitura].vista, matrizVista, sizeof(matrizVista)) != 0;
+}
+
+// --- CULLING POR OCLUSAO ---
+// Depois do frustum, as folhas da BVH (ate PROPS_POR_FOLHA props) que ficaram atras de outros
+// props ou do terreno sao descartadas com consultas de oclusao (GL_SAMPLES_PASSED) sobre a
+// caixa da folha, no estilo do CHC++: o frame usa a visibilidade que as consultas do frame
+// anterior devolveram, entao nunca espera pela GPU. As caixas sao desenhadas depois dos props
+// (com a profundidade do frame pronta, sem escrever cor nem profundidade). Folhas ocultas sao
+// consultadas todo frame; as visiveis so a cada INTERVALO_OCLUSAO frames (escalonadas pelo
+// indice, para nao consultar todas no mesmo frame). Uma folha que acabou de entrar no frustum
+// e desenhada ate a primeira resposta, para nao sumir por um frame.
+
+#define INTERVALO_OCLUSAO 8
+
+typedef struct {
+    GLuint* consultas;        // uma consulta por no da BVH (so folhas; criada no primeiro uso)
+    unsigned char* visivel;   // ultima resposta de cada folha
+    unsigned char* pendente;  // consulta emitida e ainda sem resposta
+    long* quadroFrustum;      // ultimo frame em que a folha estava no frustum
+    int* aConsultar;          // folhas que recebem consulta neste frame
+    int numAConsultar;
+    int* emVoo;               // folhas com consulta pendente
+    int numEmVoo;
+    GLuint* visiveis;         // lista de visiveis depois da oclusao (mesmas faixas por tipo e nivel)
+    long quadro;
+    int quadrosEstaveis;      // frames seguidos em que nenhuma resposta mudou a visibilidade
+} Oclusao;
+
+// Contadores do ultimo frame (tecla 'C' imprime)
+typedef struct {
+    int consultas;        // caixas de folhas consultadas
+    int folhasOcultas;    // folhas no frustum descartadas pela oclusao
+    int propsOcultos;
+    int semResposta;      // consultas do frame anterior ainda na GPU (ficam para o proximo)
+} EstatisticasOclusao;
+
+Oclusao oclusao;
+EstatisticasOclusao estatOclusao;
+bool usarOclusao = false; // 'H' liga/desliga (--oclusao)
+
+bool oclusaoAtiva() {
+    return usarOclusao && !modoImediato && parque.numProps > 0;
+}
+
+void criaOclusao() {
+    Oclusao* o = &oclusao;
+    int nos = bvh.numNos > 0 ? bvh.numNos : 1;
+    o->consultas = calloc(nos, sizeof(GLuint));
+    o->visivel = calloc(nos, 1);
+    o->pendente = calloc(nos, 1);
+    o->quadroFrustum = calloc(nos, sizeof(long));
+    o->aConsultar = malloc(sizeof(int) * nos);
+    o->emVoo = malloc(sizeof(int) * nos);
+    o->visiveis = malloc(sizeof(GLuint) * (parque.numProps > 0 ? parque.numProps : 1));
+    o->numAConsultar = o->numEmVoo = 0;
+    o->quadro = 1;
+}
+
+// Le as respostas que ja chegaram; as outras continuam em voo
+void coletaOclusao() {
+    Oclusao* o = &oclusao;
+    bool mudou = false;
+    int restantes = 0;
+    estatOclusao.semResposta = 0;
+    for (int k = 0; k < o->numEmVoo; k++) {
+        int folha = o->emVoo[k];
+        GLuint pronta, amostras;
+        glGetQueryObjectuiv(o->consultas[folha], GL_QUERY_RESULT_AVAILABLE, &pronta);
+        if (!pronta && !reproducaoAtiva()) { // a reproducao espera: o frame nao pode depender do tempo da GPU
+            o->emVoo[restantes++] = folha;
+            estatOclusao.semResposta++;
+            continue;
+        }
+        glGetQueryObjectuiv(o->consultas[folha], GL_QUERY_RESULT, &amostras);
+        mudou = mudou || o->visivel[folha] != (amostras > 0);
+        o->visivel[folha] = amostras > 0;
+        o->pendente[folha] = 0;
+    }
+    o->numEmVoo = restantes;
+    o->quadrosEstaveis = mudou || restantes > 0 ? 0 : o->quadrosEstaveis + 1;
+}
+
+// Camera dentro da caixa (com folga do plano perto): as faces seriam cortadas e a consulta mentiria
+bool cameraNaCaixa(const NoBVH* n) {
+    float c[3] = { cameraX, cameraY, cameraZ };
+    for (int k = 0; k < 3; k++) {
+        if (c[k] < n->min[k] - planoPerto || c[k] > n->max[k] + planoPerto) return false;
+    }
+    return true;
+}
+
+// Tira de listaVisiveis os props de folhas ocultas e escolhe as folhas consultadas no frame
+void filtraOclusao() {
+    Oclusao* o = &oclusao;
+    if (!oclusaoAtiva()) return;
+    o->quadro++;
+    o->numAConsultar = 0;
+    memset(&estatOclusao, 0, sizeof(estatOclusao));
+    coletaOclusao();
+
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        int saida = parque.primeiro[t];
+        for (int L = 0; L < NUM_NIVEIS_LOD; L++) {
+            const GLuint* faixa = listaVisiveis + parque.primeiro[t] + inicioNivel[t][L];
+            int inicio = saida;
+            for (int k = 0; k < numVisiveisNivel[t][L]; k++) {
+                int prop = faixa[k];
+                int folha = bvh.folhaProp[prop];
+                if (o->quadroFrustum[folha] != o->quadro) {
+                    // primeira vez que a folha aparece neste frame
+                    if (o->quadroFrustum[folha] < o->quadro - 1) o->visivel[folha] = 1;
+                    o->quadroFrustum[folha] = o->quadro;
+                    if (cameraNaCaixa(&bvh.nos[folha])) o->visivel[folha] = 1;
+                    else if (!o->pendente[folha] && (!o->visivel[folha] || (o->quadro + folha) % INTERVALO_OCLUSAO == 0)) {
+                        o->aConsultar[o->numAConsultar++] = folha;
+                    }
+                    if (!o->visivel[folha]) estatOclusao.folhasOcultas++;
+                }
+                if (o->visivel[folha]) o->visiveis[saida++] = prop;
+                else estatOclusao.propsOcultos++;
+            }
+            estatLOD.props[L] -= numVisiveisNivel[t][L] - (saida - inicio);
+            inicioNivel[t][L] = inicio - parque.primeiro[t];
+            numVisiveisNivel[t][L] = saida - inicio;
+        }
+        numVisiveis[t] = saida - parque.primeiro[t];
+    }
+    listaVisiveis = o->visiveis;
+    estatCulling.desenhados -= estatOclusao.propsOcultos;
+}
+
+// Desenha as caixas das folhas escolhidas contra a profundidade do frame, cada uma na sua consulta
+void emiteConsultasOclusao() {
+    Oclusao* o = &oclusao;
+    if (!oclusaoAtiva() || o->numAConsultar == 0) return;
+
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_LIGHTING);
+    glBindBuffer(GL_ARRAY_BUFFER, malhaCubo.vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, malhaCubo.ibo);
+    glVertexPointer(3, GL_FLOAT, FLOATS_POR_VERTICE * sizeof(float), (void*)0);
+    glMatrixMode(GL_MODELVIEW);
+    for (int k = 0; k < o->numAConsultar; k++) {
+        int folha = o->aConsultar[k];
+        const NoBVH* n = &bvh.nos[folha];
+        if (!o->consultas[folha]) glGenQueries(1, &o->consultas[folha]);
+        glLoadMatrixf(matrizVista);
+        glTranslatef((n->min[0] + n->max[0]) * 0.5f, (n->min[1] + n->max[1]) * 0.5f, (n->min[2] + n->max[2]) * 0.5f);
+        glScalef(n->max[0] - n->min[0], n->max[1] - n->min[1], n->max[2] - n->min[2]);
+        glBeginQuery(GL_SAMPLES_PASSED, o->consultas[folha]);
+        glDrawElements(GL_TRIANGLES, malhaCubo.numIndices, GL_UNSIGNED_INT, (void*)0);
+        glEndQuery(GL_SAMPLES_PASSED);
+        o->pendente[folha] = 1;
+        o->emVoo[o->numEmVoo++] = folha;
+    }
+    glLoadMatrixf(matrizVista);
+    glPopAttrib();
+    estatOclusao.consultas = o->numAConsultar;
+    o->numAConsultar = 0;
+}
+
+// Respostas recentes ainda mudando a visibilidade: o escalonador desenha mais um frame
+bool oclusaoAcomodando() {
+    return oclusaoAtiva() && oclusao.quadrosEstaveis < 2;
+}
+
+// --- HUD ---
+
+void escreveTexto(int x, int y, const char* texto) {
+    glRasterPos2i(x, y);
+    for (const char* c = texto; *c; c++) glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
+}
+
+// HUD com as medias de CPU/GPU por fase (precisa do glut, entao nao existe no modo headless)
+void desenhaHUD() {
+    if (!mostrarHUD || modoHeadless) return;
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, windowWidth, 0, windowHeight);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glColor3f(1.0f, 1.0f, 0.6f);
+
+    char linha[128];
+    int y = windowHeight - 18;
+    escreveTexto(10, y, "fase           cpu ms   gpu ms");
+    double totalCpu = 0.0, totalGpu = 0.0;
+    for (int f = 0; f < NUM_FASES; f++) {
+        y -= 15;
+        snprintf(linha, sizeof(linha), "%-12s %8.3f %8.3f", nomesFases[f], perfil.mediaCpu[f], perfil.mediaGpu[f]);
+        escreveTexto(10, y, linha);
+        totalCpu += perfil.mediaCpu[f];
+        totalGpu += perfil.mediaGpu[f];
+    }
+    y -= 15;
+    snprintf(linha, sizeof(linha), "%-12s %8.3f %8.3f", "total", totalCpu, totalGpu);
+    escreveTexto(10, y, linha);
+    y -= 20;
+    snprintf(linha, sizeof(linha), "props %d/%d  vertices %ld", estatCulling.desenhados, parque.numProps, estatLOD.vertices);
+    escreveTexto(10, y, linha);
+    y -= 15;
+    snprintf(linha, sizeof(linha), "material %d->%d  malha %d->%d",
+             estatFila.materialAntes, estatFila.materialDepois, estatFila.malhaAntes, estatFila.malhaDepois);
+    escreveTexto(10, y, linha);
+    y -= 15;
+    desenhaHUDResolucao(10, y);
+
+    glPopAttrib();
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+// --- TERRENO EM BLOCOS ---
+// O chao e um campo de alturas dividido em blocos de TAMANHO_BLOCO metros, gerados sob demanda
+// numa thread de trabalho conforme a camera anda. Cada bloco tem um VBO de tamanho fixo (a
+// grade do nivel 0 mais as saias das bordas); os niveis de detalhe pulam vertices da mesma
+// grade com IBOs compartilhados por todos os blocos. As saias (tiras verticais abaixo das
+// bordas) cobrem as frestas entre blocos vizinhos em niveis diferentes.
+// A memoria e fixa: --terreno-mb define quantos blocos cabem (nunca menos que o alcance de
+// planoLonge pede), e quando falta lugar o bloco usado ha mais tempo (LRU) e reaproveitado.
+// Cada bloco guarda tambem os vertices na CPU (o mesmo tamanho do VBO), que a thread escreve
+// direto e o modo imediato reenvia. A thread so gera os vertices; o envio para a GPU fica na
+// thread principal, limitado a ENVIOS_TERRENO_POR_QUADRO blocos por frame.
+
+#define TAMANHO_BLOCO 16.0f
+#define LADO_BLOCO 33                 // vertices por lado no nivel 0 (passo de 0,5 m)
+#define NUM_NIVEIS_TERRENO 4          // passos de 1, 2, 4 e 8 vertices
+#define VERTICES_BLOCO (LADO_BLOCO * LADO_BLOCO + 4 * LADO_BLOCO) // grade + saias
+#define PROFUNDIDADE_SAIA 1.0f
+#define MAX_PEDIDOS_TERRENO 64        // blocos pedidos e ainda nao enviados a GPU
+#define PEDIDOS_TERRENO_POR_QUADRO 16
+#define ENVIOS_TERRENO_POR_QUADRO 4
+#define TAMANHO_HASH_TERRENO 1024
+
+const GLfloat corGrama[] = {0.1f, 0.4f, 0.1f, 1.0f}; // Verde escuro
+const float distanciaNivelTerreno[NUM_NIVEIS_TERRENO - 1] = {20.0f, 40.0f, 64.0f};
+
+enum { BLOCO_VAZIO, BLOCO_CARREGANDO, BLOCO_PRONTO };
+
+typedef struct {
+    int bx, bz;                       // coordenadas do bloco (em blocos)
+    int estado;
+    long ultimoUso;                   // ultimo frame em que o bloco foi necessario (LRU)
+    int proximoHash;                  // proximo bloco no mesmo balde do hash
+    float min[3], max[3];             // caixa para o culling
+    Malha malhas[NUM_NIVEIS_TERRENO]; // o VBO do bloco com o IBO de cada nivel
+    float* vertices;                  // copia na CPU; so a thread escreve, enquanto CARREGANDO
+} BlocoTerreno;
+
+typedef struct {
+    int bloco, bx, bz;
+    float* vertices;                  // os do bloco, preenchidos pela thread de trabalho
+    float minY, maxY;
+} TrabalhoTerreno;
+
+typedef struct {
+    BlocoTerreno* blocos;
+    int numBlocos;
+    float* vertices;                  // os vertices de todos os blocos, um seguido do outro
+    int hash[TAMANHO_HASH_TERRENO];   // primeiro bloco de cada balde (-1 = vazio)
+    GLuint ibos[NUM_NIVEIS_TERRENO];
+    GLuint* indices[NUM_NIVEIS_TERRENO]; // os mesmos indices na CPU, para o modo imediato
+    GLsizei numIndices[NUM_NIVEIS_TERRENO];
+    long quadro;
+    int* necessarios;                 // blocos prontos em volta da camera neste frame
+    int numNecessarios;
+    int* visiveis;                    // necessarios que passaram pelo frustum
+    int* niveis;
+    int numVisiveis;
+    int emVoo;                        // pedidos ainda nao enviados a GPU
+
+    // filas entre a thread principal e a de trabalho (protegidas por trava)
+    pthread_t trabalhador;
+    pthread_mutex_t trava;
+    pthread_cond_t temPedido, temPronto;
+    TrabalhoTerreno pedidos[MAX_PEDIDOS_TERRENO];
+    int inicioPedidos, numPedidos;
+    TrabalhoTerreno prontos[MAX_PEDIDOS_TERRENO];
+    int inicioProntos, numProntos;
+    bool encerrar;                    // terminaTerreno: a thread sai em vez de esperar outro pedido
+} Terreno;
+
+Terreno terreno;
+int orcamentoTerrenoMB = 16; // --terreno-mb N
+
+typedef struct {
+    int residentes;   // blocos prontos na GPU
+    int desenhados;
+    int pendentes;    // pedidos ainda nao enviados
+    int faltando;     // blocos necessarios que nao estao prontos
+    int enviados;     // blocos enviados a GPU neste frame
+} EstatisticasTerreno;
+
+EstatisticasTerreno estatTerreno;
+
+int baldeTerreno(int bx, int bz) {
+    return (int)(((unsigned int)bx * 73856093u ^ (unsigned int)bz * 19349663u) & (TAMANHO_HASH_TERRENO - 1));
+}
+
+int procuraBlocoTerreno(int bx, int bz) {
+    for (int i = terreno.hash[baldeTerreno(bx, bz)]; i >= 0; i = terreno.blocos[i].proximoHash) {
+        if (terreno.blocos[i].bx == bx && terreno.blocos[i].bz == bz) return i;
+    }
+    return -1;
+}
+
+void removeHashTerreno(int i) {
+    int* elo = &terreno.hash[baldeTerreno(terreno.blocos[i].bx, terreno.blocos[i].bz)];
+    while (*elo != i) elo = &terreno.blocos[*elo].proximoHash;
+    *elo = terreno.blocos[i].proximoHash;
+}
+
+// Gera a grade e as saias de um bloco (roda na thread de trabalho)
+void geraBlocoTerreno(TrabalhoTerreno* t) {
+    float* v = t->vertices;
+    float passo = TAMANHO_BLOCO / (LADO_BLOCO - 1);
+    float x0 = t->bx * TAMANHO_BLOCO, z0 = t->bz * TAMANHO_BLOCO;
+    t->minY = INFINITY;
+    t->maxY = -INFINITY;
+    for (int iz = 0; iz < LADO_BLOCO; iz++) {
+        for (int ix = 0; ix < LADO_BLOCO; ix++) {
+            float x = x0 + ix * passo, z = z0 + iz * passo;
+            float y = alturaTerreno(x, z);
+            // normal por diferencas centrais da propria funcao: igual dos dois lados da borda
+            float dx = (alturaTerreno(x + passo, z) - alturaTerreno(x - passo, z)) / (2.0f * passo);
+            float dz = (alturaTerreno(x, z + passo) - alturaTerreno(x, z - passo)) / (2.0f * passo);
+            float len = sqrtf(dx * dx + 1.0f + dz * dz);
+            float* p = v + (iz * LADO_BLOCO + ix) * FLOATS_POR_VERTICE;
+            p[0] = x; p[1] = y; p[2] = z;
+            p[3] = -dx / len; p[4] = 1.0f / len; p[5] = -dz / len;
+            t->minY = fminf(t->minY, y);
+            t->maxY = fmaxf(t->maxY, y);
+        }
+    }
+    // saias: copias das bordas (z0, z1, x0, x1) abaixadas
+    for (int b = 0; b < 4; b++) {
+        for (int k = 0; k < LADO_BLOCO; k++) {
+            int ix = b < 2 ? k : (b == 2 ? 0 : LADO_BLOCO - 1);
+            int iz = b < 2 ? (b == 0 ? 0 : LADO_BLOCO - 1) : k;
+            float* p = v + (LADO_BLOCO * LADO_BLOCO + b * LADO_BLOCO + k) * FLOATS_POR_VERTICE;
+            memcpy(p, v + (iz * LADO_BLOCO + ix) * FLOATS_POR_VERTICE, sizeof(float) * FLOATS_POR_VERTICE);
+            p[1] -= PROFUNDIDADE_SAIA;
+        }
+    }
+    t->minY -= PROFUNDIDADE_SAIA;
+}
+
+void* trabalhadorTerreno(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&terreno.trava);
+    for (;;) {
+        while (terreno.numPedidos == 0 && !terreno.encerrar) pthread_cond_wait(&terreno.temPedido, &terreno.trava);
+        if (terreno.encerrar) break;
+        TrabalhoTerreno t = terreno.pedidos[terreno.inicioPedidos];
+        terreno.inicioPedidos = (terreno.inicioPedidos + 1) % MAX_PEDIDOS_TERRENO;
+        terreno.numPedidos--;
+        pthread_mutex_unlock(&terreno.trava);
+
+        geraBlocoTerreno(&t);
+
+        pthread_mutex_lock(&terreno.trava);
+        terreno.prontos[(terreno.inicioProntos + terreno.numProntos) % MAX_PEDIDOS_TERRENO] = t;
+        terreno.numProntos++;
+        pthread_cond_signal(&terreno.temPronto);
+    }
+    pthread_mutex_unlock(&terreno.trava);
+    return NULL;
+}
+
+// Indices de um nivel: a grade com passo 2^nivel e as saias ligando as bordas desse passo
+void geraIndicesTerreno(DadosMalha* d, int nivel) {
+    int passo = 1 << nivel;
+    int n = (LADO_BLOCO - 1) / passo;
+    alocaDadosMalha(d, 0, 6 * n * n + 4 * 6 * n, FLOATS_POR_VERTICE);
+    for (int iz = 0; iz < LADO_BLOCO - 1; iz += passo) {
+        for (int ix = 0; ix < LADO_BLOCO - 1; ix += passo) {
+            GLuint a = iz * LADO_BLOCO + ix, b = (iz + passo) * LADO_BLOCO + ix;
+            adicionaTriangulo(d, a, b, b + passo);
+            adicionaTriangulo(d, a, b + passo, a + passo);
+        }
+    }
+    for (int borda = 0; borda < 4; borda++) {
+        for (int k = 0; k < LADO_BLOCO - 1; k += passo) {
+            GLuint s = LADO_BLOCO * LADO_BLOCO + borda * LADO_BLOCO + k;
+            GLuint g0, g1;
+            if (borda < 2) {
+                int iz = borda == 0 ? 0 : LADO_BLOCO - 1;
+                g0 = iz * LADO_BLOCO + k;
+                g1 = g0 + passo;
+            } else {
+                int ix = borda == 2 ? 0 : LADO_BLOCO - 1;
+                g0 = k * LADO_BLOCO + ix;
+                g1 = g0 + passo * LADO_BLOCO;
+            }
+            adicionaTriangulo(d, g0, s, s + passo);
+            adicionaTriangulo(d, g0, s + passo, g1);
+        }
+    }
+}
+
+// Pede os blocos em volta da camera que faltam, reaproveitando os menos usados,
+// e envia para a GPU ate maxEnvios blocos que a thread ja terminou
+void atualizaTerreno(int maxEnvios) {
+    Terreno* t = &terreno;
+    t->quadro++;
+
+    // 1) blocos prontos da thread de trabalho
+    estatTerreno.enviados = 0;
+    pthread_mutex_lock(&t->trava);
+    while (t->numProntos > 0 && estatTerreno.enviados < maxEnvios) {
+        TrabalhoTerreno tr = t->prontos[t->inicioProntos];
+        t->inicioProntos = (t->inicioProntos + 1) % MAX_PEDIDOS_TERRENO;
+        t->numProntos--;
+        pthread_mutex_unlock(&t->trava);
+
+        BlocoTerreno* b = &t->blocos[tr.bloco];
+        glBindBuffer(GL_ARRAY_BUFFER, b->malhas[0].vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * FLOATS_POR_VERTICE * VERTICES_BLOCO, tr.vertices);
+        b->min[1] = tr.minY;
+        b->max[1] = tr.maxY;
+        b->estado = BLOCO_PRONTO;
+        t->emVoo--;
+        estatTerreno.enviados++;
+
+        pthread_mutex_lock(&t->trava);
+    }
+    pthread_mutex_unlock(&t->trava);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // 2) blocos que tocam o circulo de raio planoLonge em volta da camera
+    int raio = (int)ceilf(planoLonge / TAMANHO_BLOCO);
+    int cbx = (int)floorf(cameraX / TAMANHO_BLOCO), cbz = (int)floorf(cameraZ / TAMANHO_BLOCO);
+    int maxFaltando = (2 * raio + 1) * (2 * raio + 1);
+    static float* distFaltando = NULL;
+    static int (*faltando)[2] = NULL;
+    static int capFaltando = 0;
+    if (capFaltando < maxFaltando) {
+        capFaltando = maxFaltando;
+        distFaltando = realloc(distFaltando, sizeof(float) * capFaltando);
+        faltando = realloc(faltando, sizeof(*faltando) * capFaltando);
+    }
+    int numFaltando = 0;
+    t->numNecessarios = 0;
+    for (int bz = cbz - raio; bz <= cbz + raio; bz++) {
+        for (int bx = cbx - raio; bx <= cbx + raio; bx++) {
+            // distancia da camera ao retangulo do bloco
+            float x0 = bx * TAMANHO_BLOCO, z0 = bz * TAMANHO_BLOCO;
+            float dx = fmaxf(fmaxf(x0 - cameraX, cameraX - x0 - TAMANHO_BLOCO), 0.0f);
+            float dz = fmaxf(fmaxf(z0 - cameraZ, cameraZ - z0 - TAMANHO_BLOCO), 0.0f);
+            float d2 = dx * dx + dz * dz;
+            if (d2 > planoLonge * planoLonge) continue;
+
+            int i = procuraBlocoTerreno(bx, bz);
+            if (i >= 0) {
+                t->blocos[i].ultimoUso = t->quadro;
+                if (t->blocos[i].estado == BLOCO_PRONTO) t->necessarios[t->numNecessarios++] = i;
+            } else {
+                distFaltando[numFaltando] = d2;
+                faltando[numFaltando][0] = bx;
+                faltando[numFaltando][1] = bz;
+                numFaltando++;
+            }
+        }
+    }
+    estatTerreno.faltando = numFaltando + t->emVoo;
+
+    // 3) pedidos, do mais perto para o mais longe
+    int pedidos = 0;
+    while (numFaltando > 0 && pedidos < PEDIDOS_TERRENO_POR_QUADRO && t->emVoo < MAX_PEDIDOS_TERRENO) {
+        int perto = 0;
+        for (int k = 1; k < numFaltando; k++) {
+            if (distFaltando[k] < distFaltando[perto]) perto = k;
+        }
+        int bx = faltando[perto][0], bz = faltando[perto][1];
+        distFaltando[perto] = distFaltando[numFaltando - 1];
+        faltando[perto][0] = faltando[numFaltando - 1][0];
+        faltando[perto][1] = faltando[numFaltando - 1][1];
+        numFaltando--;
+
+        // um bloco livre ou o menos usado que nao foi necessario neste frame
+        int livre = -1;
+        for (int i = 0; i < t->numBlocos; i++) {
+            BlocoTerreno* b = &t->blocos[i];
+            if (b->estado == BLOCO_VAZIO) { livre = i; break; }
+            if (b->estado == BLOCO_PRONTO && b->ultimoUso < t->quadro
+                && (livre < 0 || b->ultimoUso < t->blocos[livre].ultimoUso)) livre = i;
+        }
+        if (livre < 0) break; // o orcamento nao comporta mais blocos em volta da camera
+        BlocoTerreno* b = &t->blocos[livre];
+        if (b->estado != BLOCO_VAZIO) removeHashTerreno(livre);
+        b->bx = bx;
+        b->bz = bz;
+        b->estado = BLOCO_CARREGANDO;
+        b->ultimoUso = t->quadro;
+        b->min[0] = bx * TAMANHO_BLOCO;
+        b->min[2] = bz * TAMANHO_BLOCO;
+        b->max[0] = b->min[0] + TAMANHO_BLOCO;
+        b->max[2] = b->min[2] + TAMANHO_BLOCO;
+        int balde = baldeTerreno(bx, bz);
+        b->proximoHash = t->hash[balde];
+        t->hash[balde] = livre;
+
+        pthread_mutex_lock(&t->trava);
+        TrabalhoTerreno* tr = &t->pedidos[(t->inicioPedidos + t->numPedidos) % MAX_PEDIDOS_TERRENO];
+        tr->bloco = livre;
+        tr->bx = bx;
+        tr->bz = bz;
+        tr->vertices = b->vertices;
+        t->numPedidos++;
+        pthread_cond_signal(&t->temPedido);
+        pthread_mutex_unlock(&t->trava);
+        t->emVoo++;
+        pedidos++;
+    }
+
+    estatTerreno.pendentes = t->emVoo;
+    estatTerreno.residentes = 0;
+    for (int i = 0; i < t->numBlocos; i++) {
+        if (t->blocos[i].estado == BLOCO_PRONTO) estatTerreno.residentes++;
+    }
+}
+
+// Blocos prontos dentro do frustum e o nivel de cada um pela distancia a camera
+void selecionaBlocosTerreno() {
+    Terreno* t = &terreno;
+    float planos[6][4];
+    extraiFrustum(matrizProjecao, matrizVista, planos);
+    t->numVisiveis = 0;
+    for (int k = 0; k < t->numNecessarios; k++) {
+        BlocoTerreno* b = &t->blocos[t->necessarios[k]];
+        if (testaCaixaFrustum(planos, b->min, b->max) == 0) continue;
+        float dx = (b->min[0] + b->max[0]) * 0.5f - cameraX;
+        float dz = (b->min[2] + b->max[2]) * 0.5f - cameraZ;
+        float d = sqrtf(dx * dx + dz * dz);
+        int nivel = 0;
+        while (nivel < NUM_NIVEIS_TERRENO - 1 && d > distanciaNivelTerreno[nivel]) nivel++;
+        t->visiveis[t->numVisiveis] = t->necessarios[k];
+        t->niveis[t->numVisiveis] = nivel;
+        t->numVisiveis++;
+    }
+    estatTerreno.desenhados = t->numVisiveis;
+}
+
+// Maximo de blocos que o circulo de raio planoLonge toca de uma vez, com a camera em qualquer
+// ponto do seu bloco: os que ficam a ate planoLonge do bloco da camera
+int blocosNoAlcance() {
+    int raio = (int)ceilf(planoLonge / TAMANHO_BLOCO);
+    int n = 0;
+    for (int bz = -raio; bz <= raio; bz++) {
+        for (int bx = -raio; bx <= raio; bx++) {
+            float dx = (float)(abs(bx) > 0 ? abs(bx) - 1 : 0) * TAMANHO_BLOCO;
+            float dz = (float)(abs(bz) > 0 ? abs(bz) - 1 : 0) * TAMANHO_BLOCO;
+            if (dx * dx + dz * dz <= planoLonge * planoLonge) n++;
+        }
+    }
+    return n;
+}
+
+// Carrega e envia todos os blocos em volta da camera atual, esperando a thread de trabalho
+void esperaTerreno() {
+    Terreno* t = &terreno;
+    for (;;) {
+        atualizaTerreno(MAX_PEDIDOS_TERRENO);
+        if (estatTerreno.faltando == 0 || (estatTerreno.pendentes == 0 && estatTerreno.residentes == t->numBlocos)) break;
+        pthread_mutex_lock(&t->trava);
+        while (t->numProntos == 0 && t->emVoo > 0) pthread_cond_wait(&t->temPronto, &t->trava);
+        pthread_mutex_unlock(&t->trava);
+    }
+}
+
+// Cria os blocos dentro do orcamento, os IBOs de cada nivel e a thread de trabalho, e
+// espera o terreno em volta da camera inicial (para nao comecar com buracos)
+void criaTerreno() {
+    Terreno* t = &terreno;
+    size_t bytesBloco = sizeof(float) * FLOATS_POR_VERTICE * VERTICES_BLOCO;
+    t->numBlocos = (int)((size_t)orcamentoTerrenoMB * 1024 * 1024 / bytesBloco);
+    // abaixo do alcance (mais os pedidos em voo, que nao podem ser reaproveitados) o LRU
+    // descartaria blocos ainda visiveis a cada passo da camera e os pediria de novo
+    int minimo = blocosNoAlcance() + MAX_PEDIDOS_TERRENO;
+    if (t->numBlocos < minimo) {
+        fprintf(stderr, "Terreno: %d MB nao cobrem o alcance de %.0f m; usando %d blocos (%.1f MB)\n",
+                orcamentoTerrenoMB, planoLonge, minimo, (double)minimo * bytesBloco / (1024 * 1024));
+        t->numBlocos = minimo;
+    }
+    t->blocos = calloc(t->numBlocos, sizeof(BlocoTerreno));
+    t->vertices = malloc(bytesBloco * t->numBlocos);
+    t->necessarios = malloc(sizeof(int) * t->numBlocos);
+    t->visiveis = malloc(sizeof(int) * t->numBlocos);
+    t->niveis = malloc(sizeof(int) * t->numBlocos);
+    for (int k = 0; k < TAMANHO_HASH_TERRENO; k++) t->hash[k] = -1;
+
+    DadosMalha d;
+    for (int L = 0; L < NUM_NIVEIS_TERRENO; L++) {
+        geraIndicesTerreno(&d, L);
+        glGenBuffers(1, &t->ibos[L]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, t->ibos[L]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * d.numIndices, d.indices, GL_STATIC_DRAW);
+        t->numIndices[L] = d.numIndices;
+        t->indices[L] = d.indices;
+        d.indices = NULL;
+        liberaDadosMalha(&d);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    for (int i = 0; i < t->numBlocos; i++) {
+        BlocoTerreno* b = &t->blocos[i];
+        GLuint vbo;
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, bytesBloco, NULL, GL_STATIC_DRAW);
+        for (int L = 0; L < NUM_NIVEIS_TERRENO; L++) {
+            b->malhas[L].vbo = vbo;
+            b->malhas[L].ibo = t->ibos[L];
+            b->malhas[L].numIndices = t->numIndices[L];
+            b->malhas[L].numVertices = VERTICES_BLOCO;
+        }
+        b->estado = BLOCO_VAZIO;
+        b->proximoHash = -1;
+        b->vertices = t->vertices + (size_t)i * FLOATS_POR_VERTICE * VERTICES_BLOCO;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    pthread_mutex_init(&t->trava, NULL);
+    pthread_cond_init(&t->temPedido, NULL);
+    pthread_cond_init(&t->temPronto, NULL);
+    pthread_create(&t->trabalhador, NULL, trabalhadorTerreno, NULL);
+
+    esperaTerreno();
+    fprintf(stderr, "Terreno: %d blocos de %.0f m (%.1f MB na GPU e o mesmo na CPU), %d carregados no inicio\n",
+            t->numBlocos, TAMANHO_BLOCO, (double)t->numBlocos * bytesBloco / (1024 * 1024), estatTerreno.residentes);
+}
+
+// Acorda a thread de trabalho para sair e a junta (atexit); os pedidos na fila sao abandonados
+void terminaTerreno() {
+    Terreno* t = &terreno;
+    if (t->numBlocos == 0 || t->encerrar) return;
+    pthread_mutex_lock(&t->trava);
+    t->encerrar = true;
+    pthread_cond_broadcast(&t->temPedido);
+    pthread_mutex_unlock(&t->trava);
+    pthread_join(t->trabalhador, NULL);
+}
+
+// Modo imediato: os vertices do bloco (ja na CPU) sao enviados um a um com glBegin/glEnd,
+// na mesma ordem dos indices do nivel
+void desenhaBlocoImediato(const BlocoTerreno* b, int nivel) {
+    glBegin(GL_TRIANGLES);
+    for (int k = 0; k < terreno.numIndices[nivel]; k++) {
+        const float* v = b->vertices + terreno.indices[nivel][k] * FLOATS_POR_VERTICE;
+        glNormal3fv(v + 3);
+        glVertex3fv(v);
+    }
+    glEnd();
+}
+
+void desenhaChao() {
+    // DESENHA O CHÃO 
+    // Material: Grama verde escura
+    // Transformação: blocos do terreno ja em coordenadas do mundo (ver TERRENO EM BLOCOS)
+    
+    defineCor(corGrama);
+    // Pequeno componente especular para evidenciar reflexo/local pool de luz
+    GLfloat corGramaSpecular[] = {0.05f, 0.05f, 0.05f, 1.0f};
+    defineEspecular(corGramaSpecular, 10.0f);
+
+    if (modoImediato) {
+        glLoadMatrixf(matrizVista);
+        for (int k = 0; k < terreno.numVisiveis; k++) desenhaBlocoImediato(&terreno.blocos[terreno.visiveis[k]], terreno.niveis[k]);
+        return;
+    }
+    for (int k = 0; k < terreno.numVisiveis; k++) {
+        desenhaMalhaMundo(&terreno.blocos[terreno.visiveis[k]].malhas[terreno.niveis[k]], NULL);
+    }
+}
+
+void desenhaAssento() {
+    // Define medida da caixa que sera criada
+    float largura = 1.8f;
+    float espessura = 0.1f;
+    float profundidade = 0.5f;
+
+    glPushMatrix();
+        // Escala: Redimensiona o cubo unitário para o tamanho do assento
+        glScalef(largura, espessura, profundidade); //passa os parametros de escala que serao multiplicados
+        desenhaCubo(); // cria um cubo 1x1x1
+    glPopMatrix();
+}
+
+void desenhaPerna(float posX, float posZ) {
+    // Perna do banco (um bloco fino)
+    float tamanho = 0.7f;
+    float espessura = 0.08f;
+
+    glPushMatrix();
+        // Move a perna para a posição desejada
+        glTranslatef(posX, tamanho / 2.0f, posZ);
+        // Escala: Redimensiona o cubo para a forma de uma perna
+        glScalef(espessura, tamanho, espessura);
+        desenhaCubo();
+    glPopMatrix();
+}
+
+void desenhaCilindro(float raio, float altura) {
+    //Desenha um cilindro
+    int numSegmentos = segmentosCilindro[nivelLODAtual]; // Numero de segmentos para formar o circulo (16 no nivel 0)
+    float angulo;
+
+    if (!modoImediato) {
+        // malha unitaria em cache (base em Y=0), so escala para o raio e altura pedidos
+        glPushMatrix();
+            glScalef(raio, altura, raio);
+            desenhaMalha(&malhaCilindro[nivelLODAtual]);
+        glPopMatrix();
+        return;
+    }
+    
+    glPushMatrix();
+        // Move para que a base do cilindro fique em Y=0
+        glTranslatef(0.0f, altura / 2.0f, 0.0f);
+        
+        // Desenha o corpo do cilindro 
+        glBegin(GL_QUAD_STRIP); // dois pontos sao definidos, depois mais dois e quad strip os conecata
+            glNormal3f(0.0f, 1.0f, 0.0f); // o par anterior com o novo
+            for (int i = 0; i <= numSegmentos; i++) {
+                angulo = 2.0f * M_PI * i / numSegmentos;
+                float x = raio * cos(angulo); //transforma os angulos em posicao no circulo 
+                float z = raio * sin(angulo);
+                
+                // Normal apontando para fora, pois na lateral do cilindro a luz deve refletir como se fosse arredondado.
+                glNormal3f(x / raio, 0.0f, z / raio);
+                
+                // Vertice superior
+                glVertex3f(x, altura / 2.0f, z);
+                // Vertice inferior
+                glVertex3f(x, -altura / 2.0f, z);
+            }
+        glEnd();
+        
+        // Desenha a tampa superior
+        glBegin(GL_TRIANGLE_FAN);           // Leque de triangulos o centro e definido primeiro depois a cada ponto
+            glNormal3f(0.0f, 1.0f, 0.0f);   // desenhado na porda, um triangulo  e criado e conectado ao centro
+            glVertex3f(0.0f, altura / 2.0f, 0.0f);  //nomral fixa porque e plana e aponta para cima
+            for (int i = 0; i <= numSegmentos; i++) {
+                angulo = 2.0f * M_PI * i / numSegmentos;
+                glVertex3f(raio * cos(angulo), altura / 2.0f, raio * sin(angulo));
+            }
+        glEnd();
+        
+        // Desenha a base inferior
+        glBegin(GL_TRIANGLE_FAN);
+            glNormal3f(0.0f, -1.0f, 0.0f);
+            glVertex3f(0.0f, -altura / 2.0f, 0.0f);
+            for (int i = numSegmentos; i >= 0; i--) { //i -- para inverter a ordem dos pontos e manter a face visivel virada para baixo
+                angulo = 2.0f * M_PI * i / numSegmentos;
+                glVertex3f(raio * cos(angulo), -altura / 2.0f, raio * sin(angulo));
+            }
+        glEnd();
+    glPopMatrix();
+}
+
+void desenhaBanco() {
+    // DESENHA O BANCO DE PRAÇA
+    // Composição: Assento, encosto e 4 pernas
+    // Transformações hierárquicas: Translação, rotação e escala
+    // A posicao e a rotacao no parque vem da matriz do layout (ver desenhaProps)
+
+    GLfloat corBanco[] = {0.55f, 0.35f, 0.15f, 1.0f}; // Marrom
+    defineCor(corBanco);
+
+    glPushMatrix(); // Salva a matriz de transformação
+        float altAssento = 0.7f;
+        float largura = 1.8f;
+        float profundidade = 0.5f;
+
+        // Desenhar Assento
+        glPushMatrix();
+            glTranslatef(0.0f, altAssento, 0.0f); // ergue a altura do banco para 0.7
+            desenhaAssento();
+        glPopMatrix();
+
+        // Desenhar Encosto
+        float alturaEncosto = 0.8f;
+        float espessuraEncosto = 0.1f;
+        float espessuraAssento = 0.1f;
+        
+        glPushMatrix();
+            float topoAssento = altAssento + espessuraAssento/2.0f;
+        // a altura e a altura do acento+ metade da altura do encosto
+        // para colocar o encosto, devemos empurralo para tras. Movemos para a vorda de tras (-profundidade/2)
+        // e subtraimos a espessura do proprio encosto
+            glTranslatef(0.0f, topoAssento + alturaEncosto/2.0f, -profundidade/2.0f - espessuraEncosto/2.0f);
+            glScalef(largura, alturaEncosto, espessuraEncosto);
+            desenhaCubo();
+        glPopMatrix();
+
+        // Desenhar as 4 Pernas (cantos do banco)
+        float offset = (largura / 2.0f) - 0.1f;         // espelhamento das cordenadas, a subtracao por 1 evitta
+        float offsetZ = (profundidade / 2.0f) - 0.1f;   // Que a perna fique para fora
+
+        if (nivelLODAtual == NUM_NIVEIS_LOD - 1) {
+            // de longe as duas pernas de cada lado viram um bloco so (2 cubos em vez de 4)
+            for (int lado = -1; lado <= 1; lado += 2) {
+                glPushMatrix();
+                    glTranslatef(lado * offset, 0.35f, 0.0f);
+                    glScalef(0.08f, 0.7f, 2.0f * offsetZ + 0.08f);
+                    desenhaCubo();
+                glPopMatrix();
+            }
+        } else {
+            desenhaPerna(offset, offsetZ);      // Canto Frontal Direito
+            desenhaPerna(-offset, offsetZ);     // Canto Frontal Esquerdo
+            desenhaPerna(offset, -offsetZ);     // Canto Traseiro Direito
+            desenhaPerna(-offset, -offsetZ);    // Canto Traseiro Esquerdo
+        }
+
+    glPopMatrix(); // Restaura a matriz de transformação
+}
+
+void desenhaPoste() {
+    // DESENHA O POSTE DE ILUMINAÇÃO 
+    // Transformações: Translação e escala
+    // Iluminação: Luz pontual posicionada no topo da luminária
+    
+    GLfloat corMetal[] = {0.3f, 0.3f, 0.3f, 1.0f}; // Cinza escuro para o poste
+    defineCor(corMetal);
+
+    glPushMatrix();
+        // --- Base do Poste (cilindro fino e alto) ---
+        // define medidas do poste
+        float alturaPoste = 3.0f;
+        float raioPoste = 0.08f;
+
+        // desenha a base do poste como um cilindro
+        glPushMatrix();
+            desenhaCilindro(raioPoste, alturaPoste);
+        glPopMatrix();
+
+        // --- Luminaria ---
+        defineMaterialLuminaria(); // acesa ou apagada conforme a luz do poste
+
+        glPushMatrix();
+            float raioLuminaria = 0.2f; //raio da bola
+            glTranslatef(0.0f, alturaPoste + raioLuminaria/2.0f, 0.0f); //poiciona a bola no final do corpo do poste
+            desenhaEsfera(raioLuminaria, malhaEsferaPoste, tessEsferaPoste); //desenha a esfera
+        glPopMatrix();
+
+        // Após desenhar, garante que emissao nao vaze para outros objetos
+        defineEmissao(emisOff);
+
+    glPopMatrix(); // Restaura a matriz de transformação
+}
+
+
+
+void desenhaArvore() {
+    //DESENHA A ARVORE 
+    // Composicao: tronco e copa
+    // transformacoes: translacao e escala
+    
+    glPushMatrix();
+        // --- Tronco (Cilindro marrom) ---
+        GLfloat corTronco[] = {0.4f, 0.2f, 0.0f, 1.0f}; // Marrom
+        defineCor(corTronco);
+
+        // dimensoes do tronco
+        float alturaTronco = 2.5f;
+        float raioTronco = 0.2f;
+
+        // desenha tronco usando cilindro 
+        glPushMatrix();
+            desenhaCilindro(raioTronco, alturaTronco);
+        glPopMatrix();
+
+        // --- Copa (Esfera verde) ---
+        GLfloat corCopa[] = {0.0f, 0.5f, 0.0f, 1.0f}; // Verde escuro
+        defineCor(corCopa);
+
+        glPushMatrix();
+            float raioCopa = 1.2f;
+            glTranslatef(0.0f, alturaTronco + raioCopa * 0.5f, 0.0f); //poiciona a copa sobreposta ao final tronco
+            desenhaEsfera(raioCopa, malhaEsferaCopa, tessEsferaCopa); // desenha a esfera
+        glPopMatrix();
+
+    glPopMatrix(); // Restaura a matriz de transformação
+}
+
+// --- DESENHO INSTANCIADO ---
+// Cada tipo de prop vira uma unica malha composta (as partes ja transformadas e com a cor
+// no vertice). As matrizes e tintas de todos os props ficam em texture buffers, e o vertex
+// shader busca os dados da instancia pelo atributo indiceInstancia (divisor 1), que vem da lista
+// de props visiveis do culling: um glDrawElementsInstanced por tipo.
+
+bool usarInstancias = true; // 'I' alterna com o desenho prop a prop (glPushMatrix + desenha*)
+
+Malha malhaProp[NUM_TIPOS_PROP][NUM_NIVEIS_LOD]; // cada nivel ja e uma unica malha com todas as partes
+void (*const desenhaTipoProp[NUM_TIPOS_PROP])() = { desenhaBanco, desenhaPoste, desenhaArvore };
+
+typedef struct {
+    GLuint programa;          // 0 se o shader nao compilou (fica so o desenho prop a prop)
+    GLint uLuzAtiva;
+    GLint uCorLuminaria;
+    GLint uEmissaoLuminaria;
+    GLuint bufMatrizes, texMatrizes;
+    GLuint bufMateriais, texMateriais;
+    GLuint bufVisiveis;       // indices dos props visiveis, reenviado a cada frame
+} DesenhoInstanciado;
+
+DesenhoInstanciado instancias;
+
+// Atributos de vertice das malhas compostas (os indices viram o location via glBindAttribLocation)
+enum { ATRIB_POSICAO, ATRIB_NORMAL, ATRIB_COR, ATRIB_EMISSIVO, ATRIB_INDICE_INSTANCIA, NUM_ATRIBUTOS };
+const char* const atributosInstancia[NUM_ATRIBUTOS] = { "posicao", "normal", "cor", "emissivo", "indiceInstancia" };
+
+// Inicio comum de todos os shaders (compilaShader o poe antes de cada fonte): a matriz de mundo de
+// cada instancia e a iluminacao do pipeline fixo (GL_LIGHT0 e GL_LIGHT1, observador local)
+const char* fonteComumShaders =
+    "#version 150 compatibility\n"
+    "uniform samplerBuffer matrizesInstancia;  // 4 texels (colunas) por instancia\n"
+    "mat4 matrizInstancia(int i) {\n"
+    "    return mat4(texelFetch(matrizesInstancia, 4 * i), texelFetch(matrizesInstancia, 4 * i + 1),\n"
+    "                texelFetch(matrizesInstancia, 4 * i + 2), texelFetch(matrizesInstancia, 4 * i + 3));\n"
+    "}\n"
+    "const vec3 especularMaterial = vec3(0.05); // deixado no material pelo chao\n"
+    "const float brilhoMaterial = 10.0;\n"
+    "vec3 contribuicaoLuz(int i, vec3 p, vec3 n, vec3 v, vec3 difusa) {\n"
+    "    vec4 posLuz = gl_LightSource[i].position;\n"
+    "    vec3 l = normalize(posLuz.xyz);\n"
+    "    float atenuacao = 1.0;\n"
+    "    if (posLuz.w != 0.0) {\n"
+    "        float d = length(posLuz.xyz - p);\n"
+    "        l = (posLuz.xyz - p) / d;\n"
+    "        atenuacao = 1.0 / (gl_LightSource[i].constantAttenuation + gl_LightSource[i].linearAttenuation * d\n"
+    "                           + gl_LightSource[i].quadraticAttenuation * d * d);\n"
+    "    }\n"
+    "    float nl = max(dot(n, l), 0.0);\n"
+    "    vec3 c = gl_LightSource[i].ambient.rgb * difusa + nl * gl_LightSource[i].diffuse.rgb * difusa;\n"
+    "    if (nl > 0.0) c += pow(max(dot(n, normalize(l + v)), 0.0), brilhoMaterial) * gl_LightSource[i].specular.rgb * especularMaterial;\n"
+    "    return atenuacao * c;\n"
+    "}\n";
+
+// Iluminacao igual a do pipeline fixo (por vertice, GL_LIGHT0 e GL_LIGHT1, observador local)
+const char* fonteVertexInstancias =
+    "in vec3 posicao;\n"
+    "in vec3 normal;\n"
+    "in vec3 cor;\n"
+    "in float emissivo;\n"
+    "in uint indiceInstancia;                  // prop desta instancia (por instancia)\n"
+    "uniform samplerBuffer materiaisInstancia; // 1 texel (tinta) por instancia\n"
+    "uniform vec2 luzAtiva;                    // x = sol (GL_LIGHT0), y = poste (GL_LIGHT1)\n"
+    "uniform vec3 corLuminaria;\n"
+    "uniform vec3 emissaoLuminaria;\n"
+    "out vec4 corVertice;\n"
+    "void main() {\n"
+    "    int i = int(indiceInstancia);\n"
+    "    mat4 modelo = matrizInstancia(i);\n"
+    "    vec4 tinta = texelFetch(materiaisInstancia, i);\n"
+    "    vec4 p = gl_ModelViewMatrix * (modelo * vec4(posicao, 1.0));\n"
+    "    vec3 n = normalize(mat3(gl_ModelViewMatrix) * (mat3(modelo) * normal));\n"
+    "    vec3 v = normalize(-p.xyz);\n"
+    "    vec3 difusa = cor * tinta.rgb;\n"
+    "    vec3 c = vec3(0.0);\n"
+    "    if (emissivo > 0.5) { difusa = corLuminaria; c = emissaoLuminaria; }\n"
+    "    c += gl_LightModel.ambient.rgb * difusa;\n"
+    "    if (luzAtiva.x > 0.5) c += contribuicaoLuz(0, p.xyz, n, v, difusa);\n"
+    "    if (luzAtiva.y > 0.5) c += contribuicaoLuz(1, p.xyz, n, v, difusa);\n"
+    "    corVertice = vec4(clamp(c, 0.0, 1.0), 1.0);\n"
+    "    gl_Position = gl_ProjectionMatrix * p;\n"
+    "}\n";
+
+const char* fonteFragmentInstancias =
+    "in vec4 corVertice;\n"
+    "void main() {\n"
+    "    gl_FragColor = corVertice;\n"
+    "}\n";
+
+GLuint compilaShader(GLenum tipo, const char* fonte) {
+    GLuint s = glCreateShader(tipo);
+    const char* fontes[2] = { fonteComumShaders, fonte };
+    glShaderSource(s, 2, fontes, NULL);
+    glCompileShader(s);
+
+    GLint ok;
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[2048];
+        glGetShaderInfoLog(s, sizeof(log), NULL, log);
+        fprintf(stderr, "Erro ao compilar shader:\n%s\n", log);
+        glDeleteShader(s);
+        return 0;
+    }
+    return s;
+}
+
+// Compila e liga um programa; atributos[i] recebe o location i. Devolve 0 em caso de erro.
+GLuint criaPrograma(const char* fonteVertex, const char* fonteFragment, const char* const* atributos, int numAtributos) {
+    GLuint vs = compilaShader(GL_VERTEX_SHADER, fonteVertex);
+    GLuint fs = compilaShader(GL_FRAGMENT_SHADER, fonteFragment);
+    if (!vs || !fs) return 0;
+
+    GLuint p = glCreateProgram();
+    glAttachShader(p, vs);
+    glAttachShader(p, fs);
+    for (int i = 0; i < numAtributos; i++) glBindAttribLocation(p, i, atributos[i]);
+    glLinkProgram(p);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLint ok;
+    glGetProgramiv(p, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[2048];
+        glGetProgramInfoLog(p, sizeof(log), NULL, log);
+        fprintf(stderr, "Erro ao ligar programa:\n%s\n", log);
+        glDeleteProgram(p);
+        return 0;
+    }
+    return p;
+}
+
+// Monta a malha composta de um prop gravando as partes que a funcao desenha* produziria
+Malha gravaProp(void (*desenha)(), float caixa[6]) {
+    DadosMalha d;
+    alocaDadosMalha(&d, 1024, 4096, FLOATS_POR_VERTICE_COMPOSTO);
+
+    bool imediato = modoImediato;
+    bool luzPoste = luzPontualLigada;
+    modoImediato = false;     // grava sempre as malhas, nunca o caminho glBegin/glEnd
+    luzPontualLigada = true;  // a luminaria entra marcada como emissiva
+
+    malhaEmGravacao = &d;
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+        glLoadIdentity();
+        desenha();
+    glPopMatrix();
+    malhaEmGravacao = NULL;
+
+    modoImediato = imediato;
+    luzPontualLigada = luzPoste;
+
+    // caixa local do prop, usada pela BVH
+    for (int k = 0; k < 3; k++) { caixa[k] = INFINITY; caixa[3 + k] = -INFINITY; }
+    for (int i = 0; i < d.numVertices; i++) {
+        const float* v = d.vertices + i * d.floatsPorVertice;
+        for (int k = 0; k < 3; k++) {
+            caixa[k] = fminf(caixa[k], v[k]);
+            caixa[3 + k] = fmaxf(caixa[3 + k], v[k]);
+        }
+    }
+
+    Malha m = enviaMalha(&d);
+    liberaDadosMalha(&d);
+    return m;
+}
+
+// Envia as matrizes de mundo (da hierarquia) e as tintas de todos os props para os texture buffers, mais uma instancia
+// identidade no fim (indice parque.numProps) para o chao do caminho agrupado
+void enviaParqueGPU() {
+    int n = parque.numProps;
+    float identidade[16];
+    float tintaNeutra[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    matrizIdentidade(identidade);
+
+    glBindBuffer(GL_TEXTURE_BUFFER, instancias.bufMatrizes);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(*parque.matrizes) * (n + 1), NULL, GL_STATIC_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(*parque.matrizes) * n, mundoProp(0));
+    glBufferSubData(GL_TEXTURE_BUFFER, sizeof(*parque.matrizes) * n, sizeof(identidade), identidade);
+    glBindBuffer(GL_TEXTURE_BUFFER, instancias.bufMateriais);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(*parque.materiais) * (n + 1), NULL, GL_STATIC_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(*parque.materiais) * n, parque.materiais);
+    glBufferSubData(GL_TEXTURE_BUFFER, sizeof(*parque.materiais) * n, sizeof(tintaNeutra), tintaNeutra);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void criaDesenhoInstanciado() {
+    instancias.programa = criaPrograma(fonteVertexInstancias, fonteFragmentInstancias, atributosInstancia, NUM_ATRIBUTOS);
+    if (!instancias.programa) {
+        fprintf(stderr, "Desenho instanciado indisponivel, usando desenho prop a prop\n");
+        usarInstancias = false;
+        return;
+    }
+    GLuint p = instancias.programa;
+    instancias.uLuzAtiva = glGetUniformLocation(p, "luzAtiva");
+    instancias.uCorLuminaria = glGetUniformLocation(p, "corLuminaria");
+    instancias.uEmissaoLuminaria = glGetUniformLocation(p, "emissaoLuminaria");
+
+    glUseProgram(p);
+    glUniform1i(glGetUniformLocation(p, "matrizesInstancia"), 1); // unidades de textura 1 e 2
+    glUniform1i(glGetUniformLocation(p, "materiaisInstancia"), 2);
+    glUseProgram(0);
+
+    glGenBuffers(1, &instancias.bufMatrizes);
+    glGenBuffers(1, &instancias.bufMateriais);
+    glGenBuffers(1, &instancias.bufVisiveis);
+    enviaParqueGPU();
+
+    glGenTextures(1, &instancias.texMatrizes);
+    glBindTexture(GL_TEXTURE_BUFFER, instancias.texMatrizes);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instancias.bufMatrizes);
+    glGenTextures(1, &instancias.texMateriais);
+    glBindTexture(GL_TEXTURE_BUFFER, instancias.texMateriais);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instancias.bufMateriais);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+// --- ILUMINACAO AGRUPADA (CLUSTERED FORWARD) ---
+// O pipeline fixo so tem 8 luzes, todas avaliadas por vertice em todo objeto. Neste caminho
+// cada poste do layout e uma luz pontual: o frustum e dividido em CLUSTERS_X x CLUSTERS_Y
+// blocos de tela e CLUSTERS_Z fatias de profundidade exponenciais, a CPU distribui as luzes
+// pelos clusters a cada frame e o fragment shader so soma as luzes do cluster do fragmento.
+// A atenuacao e a mesma de GL_LIGHT1 (constante/linear/quadratica lidas de gl_LightSource[1]),
+// multiplicada por uma janela suave que zera no raio da luz: sem um raio finito toda luz
+// alcancaria todo cluster. As luzes vem de parque.luzes (do arquivo de cena ou uma por poste).
+
+#define CLUSTERS_X 16
+#define CLUSTERS_Y 9
+#define CLUSTERS_Z 24
+#define NUM_CLUSTERS (CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z)
+#define TEXTO(x) #x
+#define TEXTO_MACRO(x) TEXTO(x) // valor de um define dentro da fonte do shader
+
+bool usarLuzesAgrupadas = false; // 'L' liga/desliga
+
+typedef struct {
+    GLuint programa;          // 0 se o shader nao compilou
+    GLint uLuzAtiva;
+    GLint uCorLuminaria;
+    GLint uEmissaoLuminaria;
+    GLint uEscalaCluster;
+    GLuint bufLuzes, texLuzes;        // 2 texels por luz visivel: posicao na vista e raio, cor
+    GLuint bufGrade, texGrade;        // (inicio, quantidade) na lista de indices de cada cluster
+    GLuint bufIndices, texIndices;    // indices das luzes de cada cluster, em sequencia
+    float (*luzesVista)[8];           // luzes que tocam o frustum neste frame
+    int (*faixas)[6];                 // clusters cobertos por cada luz visivel: x0 x1 y0 y1 z0 z1
+    GLuint* indices;
+    int capIndices;
+    GLuint grade[NUM_CLUSTERS][2];
+    // caixa de cada cluster na vista, separavel por eixo: x depende do bloco e da fatia, y
+    // tambem, z so da fatia (recalculada quando a projecao muda)
+    float xMin[CLUSTERS_Z][CLUSTERS_X], xMax[CLUSTERS_Z][CLUSTERS_X];
+    float yMin[CLUSTERS_Z][CLUSTERS_Y], yMax[CLUSTERS_Z][CLUSTERS_Y];
+    float zPerto[CLUSTERS_Z], zLonge[CLUSTERS_Z];   // profundidades positivas
+    float projecaoCaixas[2];                        // matrizProjecao[0] e [5] usadas nas caixas
+} LuzesAgrupadas;
+
+LuzesAgrupadas agrupadas;
+
+typedef struct {
+    int luzes;          // luzes do layout
+    int visiveis;       // luzes que tocam o frustum
+    int referencias;    // soma das luzes de todos os clusters
+    int maxPorCluster;
+} EstatisticasLuzes;
+
+EstatisticasLuzes estatLuzes;
+
+const char* fonteVertexAgrupada =
+    "in vec3 posicao;\n"
+    "in vec3 normal;\n"
+    "in vec3 cor;\n"
+    "in float emissivo;\n"
+    "in uint indiceInstancia;\n"
+    "uniform samplerBuffer materiaisInstancia;\n"
+    "uniform vec3 corLuminaria;\n"
+    "uniform vec3 emissaoLuminaria;\n"
+    "out vec3 posVista;\n"
+    "out vec3 normalVista;\n"
+    "out vec3 difusaVertice;\n"
+    "out vec3 emissaoVertice;\n"
+    "void main() {\n"
+    "    int i = int(indiceInstancia);\n"
+    "    mat4 modelo = matrizInstancia(i);\n"
+    "    vec4 tinta = texelFetch(materiaisInstancia, i);\n"
+    "    vec4 p = gl_ModelViewMatrix * (modelo * vec4(posicao, 1.0));\n"
+    "    posVista = p.xyz;\n"
+    "    normalVista = mat3(gl_ModelViewMatrix) * (mat3(modelo) * normal);\n"
+    "    difusaVertice = cor * tinta.rgb;\n"
+    "    emissaoVertice = vec3(0.0);\n"
+    "    if (emissivo > 0.5) { difusaVertice = corLuminaria; emissaoVertice = emissaoLuminaria; }\n"
+    "    gl_Position = gl_ProjectionMatrix * p;\n"
+    "}\n";
+
+const char* fonteFragmentAgrupada =
+    "in vec3 posVista;\n"
+    "in vec3 normalVista;\n"
+    "in vec3 difusaVertice;\n"
+    "in vec3 emissaoVertice;\n"
+    "uniform usamplerBuffer gradeClusters;  // (inicio, quantidade) por cluster\n"
+    "uniform usamplerBuffer indicesLuzes;\n"
+    "uniform samplerBuffer luzes;           // por luz: xyz na vista e raio, depois a cor\n"
+    "uniform vec2 luzAtiva;                 // x = sol (GL_LIGHT0), y = postes\n"
+    "uniform vec4 escalaCluster;            // clusters por pixel (x, y), fatias por log(z) e plano perto\n"
+    "const ivec3 numClusters = ivec3(" TEXTO_MACRO(CLUSTERS_X) ", " TEXTO_MACRO(CLUSTERS_Y) ", " TEXTO_MACRO(CLUSTERS_Z) ");\n"
+    "vec3 contribuicaoDirecao(gl_LightSourceParameters luz, vec3 l, vec3 n, vec3 v, vec3 difusa) {\n"
+    "    float nl = max(dot(n, l), 0.0);\n"
+    "    vec3 c = luz.ambient.rgb * difusa + nl * luz.diffuse.rgb * difusa;\n"
+    "    if (nl > 0.0) c += pow(max(dot(n, normalize(l + v)), 0.0), brilhoMaterial) * luz.specular.rgb * especularMaterial;\n"
+    "    return c;\n"
+    "}\n"
+    "void main() {\n"
+    "    vec3 n = normalize(normalVista);\n"
+    "    vec3 v = normalize(-posVista);\n"
+    "    vec3 difusa = difusaVertice;\n"
+    "    vec3 c = emissaoVertice + gl_LightModel.ambient.rgb * difusa;\n"
+    "    if (luzAtiva.x > 0.5) c += contribuicaoDirecao(gl_LightSource[0], normalize(gl_LightSource[0].position.xyz), n, v, difusa);\n"
+    "    if (luzAtiva.y > 0.5) {\n"
+    "        ivec3 k = ivec3(int(gl_FragCoord.x * escalaCluster.x), int(gl_FragCoord.y * escalaCluster.y),\n"
+    "                        int(log(-posVista.z / escalaCluster.w) * escalaCluster.z));\n"
+    "        k = clamp(k, ivec3(0), numClusters - 1);\n"
+    "        uvec2 faixa = texelFetch(gradeClusters, (k.z * numClusters.y + k.y) * numClusters.x + k.x).xy;\n"
+    "        for (uint j = 0u; j < faixa.y; j++) {\n"
+    "            int li = int(texelFetch(indicesLuzes, int(faixa.x + j)).x);\n"
+    "            vec4 luz = texelFetch(luzes, 2 * li);\n"
+    "            vec3 d = luz.xyz - posVista;\n"
+    "            float dist = length(d);\n"
+    "            if (dist >= luz.w) continue;\n"
+    "            float atenuacao = 1.0 / (gl_LightSource[1].constantAttenuation + gl_LightSource[1].linearAttenuation * dist\n"
+    "                                     + gl_LightSource[1].quadraticAttenuation * dist * dist);\n"
+    "            float r = dist / luz.w;\n"
+    "            float janela = clamp(1.0 - r * r * r * r, 0.0, 1.0);\n"
+    "            c += atenuacao * janela * janela * texelFetch(luzes, 2 * li + 1).rgb\n"
+    "                 * contribuicaoDirecao(gl_LightSource[1], d / dist, n, v, difusa);\n"
+    "        }\n"
+    "    }\n"
+    "    gl_FragColor = vec4(clamp(c, 0.0, 1.0), 1.0);\n"
+    "}\n";
+
+// Caminho agrupado so existe com as malhas em cache e os dois shaders compilados
+bool luzesAgrupadasAtivas() {
+    return usarLuzesAgrupadas && agrupadas.programa && instancias.programa && !modoImediato;
+}
+
+// Espaco por frame para as luzes do layout
+void atualizaLuzesParque() {
+    LuzesAgrupadas* a = &agrupadas;
+    a->luzesVista = realloc(a->luzesVista, sizeof(*a->luzesVista) * (parque.numLuzes + 1));
+    a->faixas = realloc(a->faixas, sizeof(*a->faixas) * (parque.numLuzes + 1));
+    estatLuzes.luzes = parque.numLuzes;
+}
+
+void criaLuzesAgrupadas() {
+    if (!instancias.programa) return;
+    agrupadas.programa = criaPrograma(fonteVertexAgrupada, fonteFragmentAgrupada, atributosInstancia, NUM_ATRIBUTOS);
+    if (!agrupadas.programa) {
+        fprintf(stderr, "Iluminacao agrupada indisponivel\n");
+        return;
+    }
+    GLuint p = agrupadas.programa;
+    agrupadas.uLuzAtiva = glGetUniformLocation(p, "luzAtiva");
+    agrupadas.uCorLuminaria = glGetUniformLocation(p, "corLuminaria");
+    agrupadas.uEmissaoLuminaria = glGetUniformLocation(p, "emissaoLuminaria");
+    agrupadas.uEscalaCluster = glGetUniformLocation(p, "escalaCluster");
+
+    glUseProgram(p);
+    glUniform1i(glGetUniformLocation(p, "matrizesInstancia"), 1); // mesmas unidades do desenho instanciado
+    glUniform1i(glGetUniformLocation(p, "materiaisInstancia"), 2);
+    glUniform1i(glGetUniformLocation(p, "gradeClusters"), 3);
+    glUniform1i(glGetUniformLocation(p, "indicesLuzes"), 4);
+    glUniform1i(glGetUniformLocation(p, "luzes"), 5);
+    glUseProgram(0);
+
+    GLuint* bufs[3] = { &agrupadas.bufLuzes, &agrupadas.bufGrade, &agrupadas.bufIndices };
+    GLuint* texs[3] = { &agrupadas.texLuzes, &agrupadas.texGrade, &agrupadas.texIndices };
+    GLenum formatos[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+    for (int b = 0; b < 3; b++) {
+        glGenBuffers(1, bufs[b]);
+        glBindBuffer(GL_TEXTURE_BUFFER, *bufs[b]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+        glGenTextures(1, texs[b]);
+        glBindTexture(GL_TEXTURE_BUFFER, *texs[b]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formatos[b], *bufs[b]);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    atualizaLuzesParque();
+}
+
+// Fatia de profundidade (exponencial entre planoPerto e planoLonge) da distancia d
+int fatiaCluster(float d, float escalaZ) {
+    int k = (int)floorf(logf(d / planoPerto) * escalaZ);
+    return k < 0 ? 0 : (k >= CLUSTERS_Z ? CLUSTERS_Z - 1 : k);
+}
+
+int blocoCluster(float ndc, int numBlocos) {
+    int k = (int)floorf((ndc + 1.0f) * 0.5f * numBlocos);
+    return k < 0 ? 0 : (k >= numBlocos ? numBlocos - 1 : k);
+}
+
+void calculaCaixasClusters() {
+    LuzesAgrupadas* a = &agrupadas;
+    float px = matrizProjecao[0], py = matrizProjecao[5];
+    if (a->projecaoCaixas[0] == px && a->projecaoCaixas[1] == py) return;
+    a->projecaoCaixas[0] = px;
+    a->projecaoCaixas[1] = py;
+
+    for (int z = 0; z < CLUSTERS_Z; z++) {
+        float d0 = planoPerto * powf(planoLonge / planoPerto, (float)z / CLUSTERS_Z);
+        float d1 = planoPerto * powf(planoLonge / planoPerto, (float)(z + 1) / CLUSTERS_Z);
+        a->zPerto[z] = d0;
+        a->zLonge[z] = d1;
+        // na vista x = ndc * d / P[0]: o extremo de cada lado esta na fatia mais perto ou mais longe
+        for (int x = 0; x < CLUSTERS_X; x++) {
+            float n0 = -1.0f + 2.0f * x / CLUSTERS_X, n1 = -1.0f + 2.0f * (x + 1) / CLUSTERS_X;
+            a->xMin[z][x] = fminf(n0 * d0, n0 * d1) / px;
+            a->xMax[z][x] = fmaxf(n1 * d0, n1 * d1) / px;
+        }
+        for (int y = 0; y < CLUSTERS_Y; y++) {
+            float n0 = -1.0f + 2.0f * y / CLUSTERS_Y, n1 = -1.0f + 2.0f * (y + 1) / CLUSTERS_Y;
+            a->yMin[z][y] = fminf(n0 * d0, n0 * d1) / py;
+            a->yMax[z][y] = fmaxf(n1 * d0, n1 * d1) / py;
+        }
+    }
+}
+
+// Distancia ao quadrado de v ao intervalo [lo, hi]
+float distanciaIntervalo2(float v, float lo, float hi) {
+    float d = v < lo ? lo - v : (v > hi ? v - hi : 0.0f);
+    return d * d;
+}
+
+// Chama marca(cluster) para cada cluster da faixa f que a esfera (c, r) realmente toca
+#define PARA_CLUSTERS_DA_LUZ(c, r, f, marca)                                                    \
+    for (int z = f[4]; z <= f[5]; z++) {                                                        \
+        float dz2 = distanciaIntervalo2(-(c)[2], a->zPerto[z], a->zLonge[z]);                   \
+        for (int y = f[2]; y <= f[3]; y++) {                                                    \
+            float dzy2 = dz2 + distanciaIntervalo2((c)[1], a->yMin[z][y], a->yMax[z][y]);       \
+            if (dzy2 > (r) * (r)) continue;                                                     \
+            for (int x = f[0]; x <= f[1]; x++) {                                                \
+                if (dzy2 + distanciaIntervalo2((c)[0], a->xMin[z][x], a->xMax[z][x]) > (r) * (r)) continue; \
+                marca(((z * CLUSTERS_Y + y) * CLUSTERS_X + x));                                 \
+            }                                                                                   \
+        }                                                                                       \
+    }
+
+// Distribui as luzes pelos clusters do frame atual e envia as listas para a GPU
+void atribuiLuzesClusters() {
+    LuzesAgrupadas* a = &agrupadas;
+    estatLuzes.visiveis = estatLuzes.referencias = estatLuzes.maxPorCluster = 0;
+    if (!luzesAgrupadasAtivas() || !luzPontualLigada) return;
+
+    const float* V = matrizVista;
+    float escalaZ = CLUSTERS_Z / logf(planoLonge / planoPerto);
+    memset(a->grade, 0, sizeof(a->grade));
+    calculaCaixasClusters();
+
+    // 1) luzes visiveis e a faixa de clusters que cada uma cobre (contando por cluster)
+    int n = 0;
+    for (int i = 0; i < parque.numLuzes; i++) {
+        const LuzCena* luz = &parque.luzes[i];
+        const float* p = luz->posicao;
+        float c[3];
+        for (int k = 0; k < 3; k++) c[k] = V[k] * p[0] + V[4 + k] * p[1] + V[8 + k] * p[2] + V[12 + k];
+        float r = luz->raio;
+        float zMin = -c[2] - r, zMax = -c[2] + r;
+        if (zMax < planoPerto || zMin > planoLonge) continue;
+
+        int* f = a->faixas[n];
+        f[4] = fatiaCluster(fmaxf(zMin, planoPerto), escalaZ);
+        f[5] = fatiaCluster(fminf(zMax, planoLonge), escalaZ);
+        if (zMin <= planoPerto) {
+            // a esfera cruza o plano perto: cobre a tela toda
+            f[0] = 0; f[1] = CLUSTERS_X - 1;
+            f[2] = 0; f[3] = CLUSTERS_Y - 1;
+        } else {
+            // caixa da esfera projetada: x/d com d entre zMin e zMax tem o extremo em uma das pontas
+            float xMin = matrizProjecao[0] * fminf((c[0] - r) / zMin, (c[0] - r) / zMax);
+            float xMax = matrizProjecao[0] * fmaxf((c[0] + r) / zMin, (c[0] + r) / zMax);
+            float yMin = matrizProjecao[5] * fminf((c[1] - r) / zMin, (c[1] - r) / zMax);
+            float yMax = matrizProjecao[5] * fmaxf((c[1] + r) / zMin, (c[1] + r) / zMax);
+            if (xMax < -1.0f || xMin > 1.0f || yMax < -1.0f || yMin > 1.0f) continue;
+            f[0] = blocoCluster(xMin, CLUSTERS_X); f[1] = blocoCluster(xMax, CLUSTERS_X);
+            f[2] = blocoCluster(yMin, CLUSTERS_Y); f[3] = blocoCluster(yMax, CLUSTERS_Y);
+        }
+
+        a->luzesVista[n][0] = c[0];
+        a->luzesVista[n][1] = c[1];
+        a->luzesVista[n][2] = c[2];
+        a->luzesVista[n][3] = r;
+        a->luzesVista[n][4] = luz->cor[0];
+        a->luzesVista[n][5] = luz->cor[1];
+        a->luzesVista[n][6] = luz->cor[2];
+        a->luzesVista[n][7] = 1.0f;
+#define CONTA_CLUSTER(k) a->grade[k][1]++
+        PARA_CLUSTERS_DA_LUZ(c, r, f, CONTA_CLUSTER)
+#undef CONTA_CLUSTER
+        n++;
+    }
+
+    // 2) inicio de cada cluster na lista de indices
+    int total = 0;
+    for (int k = 0; k < NUM_CLUSTERS; k++) {
+        a->grade[k][0] = total;
+        total += a->grade[k][1];
+        if ((int)a->grade[k][1] > estatLuzes.maxPorCluster) estatLuzes.maxPorCluster = a->grade[k][1];
+        a->grade[k][1] = 0;
+    }
+    if (total > a->capIndices) {
+        a->capIndices = total * 2;
+        a->indices = realloc(a->indices, sizeof(GLuint) * a->capIndices);
+    }
+
+    // 3) preenche as listas
+    for (int i = 0; i < n; i++) {
+        const int* f = a->faixas[i];
+        const float* c = a->luzesVista[i];
+#define PREENCHE_CLUSTER(k) a->indices[a->grade[k][0] + a->grade[k][1]++] = i
+        PARA_CLUSTERS_DA_LUZ(c, c[3], f, PREENCHE_CLUSTER)
+#undef PREENCHE_CLUSTER
+    }
+    estatLuzes.visiveis = n;
+    estatLuzes.referencias = total;
+
+    // buffers orfaos a cada frame (nunca vazios: glTexBuffer nao aceita tamanho zero)
+    glBindBuffer(GL_TEXTURE_BUFFER, a->bufLuzes);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(*a->luzesVista) * (n > 0 ? n : 1), a->luzesVista, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, a->bufGrade);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(a->grade), a->grade, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, a->bufIndices);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(GLuint) * (total > 0 ? total : 1), total > 0 ? a->indices : NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// Liga o programa agrupado no lugar do de instancias (chamada por iniciaProgramaInstancias)
+void ligaProgramaAgrupado(const GLfloat* corLuminaria, const GLfloat* emissaoLuminaria) {
+    glUseProgram(agrupadas.programa);
+    glUniform2f(agrupadas.uLuzAtiva, luzDirecionalLigada ? 1.0f : 0.0f, luzPontualLigada ? 1.0f : 0.0f);
+    glUniform3fv(agrupadas.uCorLuminaria, 1, corLuminaria);
+    glUniform3fv(agrupadas.uEmissaoLuminaria, 1, emissaoLuminaria);
+    glUniform4f(agrupadas.uEscalaCluster, (float)CLUSTERS_X / larguraRender, (float)CLUSTERS_Y / alturaRender,
+                CLUSTERS_Z / logf(planoLonge / planoPerto), planoPerto);
+
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_BUFFER, agrupadas.texGrade);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_BUFFER, agrupadas.texIndices);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_BUFFER, agrupadas.texLuzes);
+}
+
+void desligaTexturasAgrupadas() {
+    for (int u = 3; u <= 5; u++) {
+        glActiveTexture(GL_TEXTURE0 + u);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+}
+
+void criaMalhasCena() {
+    DadosMalha d;
+    geraDadosCubo(&d);
+    malhaCubo = enviaMalha(&d);
+    for (int L = 0; L < NUM_NIVEIS_LOD; L++) {
+        geraDadosCilindro(&d, segmentosCilindro[L]);   // no nivel 0, o mesmo numSegmentos do modo imediato
+        malhaCilindro[L] = enviaMalha(&d);
+        geraDadosEsfera(&d, tessEsferaPoste[L][0], tessEsferaPoste[L][1]);
+        malhaEsferaPoste[L] = enviaMalha(&d);
+        geraDadosEsfera(&d, tessEsferaCopa[L][0], tessEsferaCopa[L][1]);
+        malhaEsferaCopa[L] = enviaMalha(&d);
+    }
+
+    // props compostos (uma malha por nivel) para o desenho instanciado; a caixa vem do nivel 0
+    float caixaNivel[6];
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        for (int L = 0; L < NUM_NIVEIS_LOD; L++) {
+            nivelLODAtual = L;
+            malhaProp[t][L] = gravaProp(desenhaTipoProp[t], L == 0 ? caixaTipoProp[t] : caixaNivel);
+        }
+    }
+    nivelLODAtual = 0;
+
+    // a copia na CPU das primitivas so era necessaria para montar os props
+    liberaDadosMalha(&malhaCubo.dados);
+    for (int L = 0; L < NUM_NIVEIS_LOD; L++) {
+        liberaDadosMalha(&malhaCilindro[L].dados);
+        liberaDadosMalha(&malhaEsferaPoste[L].dados);
+        liberaDadosMalha(&malhaEsferaCopa[L].dados);
+    }
+
+    criaDesenhoInstanciado();
+    criaLuzesAgrupadas();
+    criaSombras();
+    criaImpostores();
+}
+
+// Aponta os atributos do shader de instancias para o VBO/IBO de uma malha composta
+void ligaMalhaComposta(const Malha* m) {
+    GLsizei stride = FLOATS_POR_VERTICE_COMPOSTO * sizeof(float);
+    glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ibo);
+    glVertexAttribPointer(ATRIB_POSICAO, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glVertexAttribPointer(ATRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+    glVertexAttribPointer(ATRIB_COR, 3, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
+    glVertexAttribPointer(ATRIB_EMISSIVO, 1, GL_FLOAT, GL_FALSE, stride, (void*)(9 * sizeof(float)));
+}
+
+// --- SOMBRAS EM CACHE ---
+// Mapa de profundidade ortografico para o sol (GL_LIGHT0) e cubo de profundidade para a luz do
+// poste (GL_LIGHT1). Os mapas so sao desenhados de novo quando invalidados: a luz ligou, mudou
+// de posicao (posSol/posPoste), o layout mudou (invalidaSombras) ou, no caso do sol, a camera
+// saiu da celula em que o mapa esta centrado. Nos outros frames as sombras so custam a busca
+// no mapa. Quem faz sombra sao os props (nivel 0 de LOD, so as faces de tras, sem a luminaria,
+// que envolve a luz); o terreno e os props recebem. As sombras usam um programa proprio, com a
+// mesma iluminacao por vertice do desenho instanciado separada em ambiente, sol e poste, e nao
+// existem no caminho prop a prop nem com a iluminacao agrupada.
+
+#define TAMANHO_MAPA_SOL 1024
+#define TAMANHO_MAPA_POSTE 512
+#define META_LADO_SOMBRA_SOL 48.0f   // o mapa do sol cobre 96 x 96 m em volta da camera
+#define CELULA_SOMBRA_SOL 16.0f      // o centro do mapa anda em passos de 16 m
+#define PERTO_SOMBRA_POSTE 0.05f
+#define LONGE_SOMBRA_POSTE 25.0f     // alem disso a luz do poste ja e fraca e nao tem sombra
+
+const char* fonteVertexSombras =
+    "in vec3 posicao;\n"
+    "in vec3 normal;\n"
+    "in vec3 cor;\n"
+    "in float emissivo;\n"
+    "in uint indiceInstancia;\n"
+    "uniform samplerBuffer materiaisInstancia;\n"
+    "uniform vec2 luzAtiva;\n"
+    "uniform vec3 corLuminaria;\n"
+    "uniform vec3 emissaoLuminaria;\n"
+    "uniform mat4 matrizSombraSol;   // mundo -> coordenadas do mapa do sol\n"
+    "uniform vec3 posLuzPoste;       // GL_LIGHT1 no mundo\n"
+    "out vec3 corBase;               // emissao e ambientes (nao ficam na sombra)\n"
+    "out vec3 corSol;                // difusa e especular do sol\n"
+    "out vec3 corPoste;              // difusa e especular do poste, ja atenuadas\n"
+    "out vec4 coordSol;\n"
+    "out vec3 direcaoPoste;          // da luz do poste ate o vertice, no mundo\n"
+    "void separaContribuicaoLuz(int i, vec3 p, vec3 n, vec3 v, vec3 difusa, out vec3 ambiente, out vec3 direta) {\n"
+    "    vec4 posLuz = gl_LightSource[i].position;\n"
+    "    vec3 l = normalize(posLuz.xyz);\n"
+    "    float atenuacao = 1.0;\n"
+    "    if (posLuz.w != 0.0) {\n"
+    "        float d = length(posLuz.xyz - p);\n"
+    "        l = (posLuz.xyz - p) / d;\n"
+    "        atenuacao = 1.0 / (gl_LightSource[i].constantAttenuation + gl_LightSource[i].linearAttenuation * d\n"
+    "                           + gl_LightSource[i].quadraticAttenuation * d * d);\n"
+    "    }\n"
+    "    float nl = max(dot(n, l), 0.0);\n"
+    "    ambiente = atenuacao * gl_LightSource[i].ambient.rgb * difusa;\n"
+    "    direta = nl * gl_LightSource[i].diffuse.rgb * difusa;\n"
+    "    if (nl > 0.0) direta += pow(max(dot(n, normalize(l + v)), 0.0), brilhoMaterial) * gl_LightSource[i].specular.rgb * especularMaterial;\n"
+    "    direta *= atenuacao;\n"
+    "}\n"
+    "void main() {\n"
+    "    int i = int(indiceInstancia);\n"
+    "    mat4 modelo = matrizInstancia(i);\n"
+    "    vec4 tinta = texelFetch(materiaisInstancia, i);\n"
+    "    vec4 mundo = modelo * vec4(posicao, 1.0);\n"
+    "    vec4 p = gl_ModelViewMatrix * mundo;\n"
+    "    vec3 n = normalize(mat3(gl_ModelViewMatrix) * (mat3(modelo) * normal));\n"
+    "    vec3 v = normalize(-p.xyz);\n"
+    "    vec3 difusa = cor * tinta.rgb;\n"
+    "    corBase = vec3(0.0);\n"
+    "    if (emissivo > 0.5) { difusa = corLuminaria; corBase = emissaoLuminaria; }\n"
+    "    corBase += gl_LightModel.ambient.rgb * difusa;\n"
+    "    corSol = vec3(0.0);\n"
+    "    corPoste = vec3(0.0);\n"
+    "    vec3 ambiente;\n"
+    "    if (luzAtiva.x > 0.5) { separaContribuicaoLuz(0, p.xyz, n, v, difusa, ambiente, corSol); corBase += ambiente; }\n"
+    "    if (luzAtiva.y > 0.5) { separaContribuicaoLuz(1, p.xyz, n, v, difusa, ambiente, corPoste); corBase += ambiente; }\n"
+    "    coordSol = matrizSombraSol * mundo;\n"
+    "    direcaoPoste = mundo.xyz - posLuzPoste;\n"
+    "    gl_Position = gl_ProjectionMatrix * p;\n"
+    "}\n";
+
+const char* fonteFragmentSombras =
+    "in vec3 corBase;\n"
+    "in vec3 corSol;\n"
+    "in vec3 corPoste;\n"
+    "in vec4 coordSol;\n"
+    "in vec3 direcaoPoste;\n"
+    "uniform sampler2DShadow mapaSol;\n"
+    "uniform samplerCubeShadow mapaPoste;\n"
+    "uniform vec2 planosPoste;       // perto e longe da projecao de cada face do cubo\n"
+    "float sombraSol() {\n"
+    "    vec3 t = coordSol.xyz / coordSol.w;\n"
+    "    float borda = max(abs(t.x - 0.5), abs(t.y - 0.5)) * 2.0;\n"
+    "    if (borda >= 1.0 || t.z >= 1.0) return 1.0;\n"
+    "    float s = texture(mapaSol, vec3(t.xy, t.z - 0.0005));\n"
+    "    return mix(s, 1.0, smoothstep(0.8, 1.0, borda)); // some aos poucos na borda do mapa\n"
+    "}\n"
+    "float sombraPoste() {\n"
+    "    vec3 a = abs(direcaoPoste);\n"
+    "    float z = max(a.x, max(a.y, a.z)); // profundidade na face do cubo que contem a direcao\n"
+    "    float n = planosPoste.x, f = planosPoste.y;\n"
+    "    if (z >= f) return 1.0;\n"
+    "    float prof = ((f + n) / (f - n) - 2.0 * f * n / ((f - n) * z)) * 0.5 + 0.5;\n"
+    "    return texture(mapaPoste, vec4(direcaoPoste, prof - 0.0002));\n"
+    "}\n"
+    "void main() {\n"
+    "    vec3 c = corBase;\n"
+    "    if (corSol != vec3(0.0)) c += sombraSol() * corSol;\n"
+    "    if (corPoste != vec3(0.0)) c += sombraPoste() * corPoste;\n"
+    "    gl_FragColor = vec4(clamp(c, 0.0, 1.0), 1.0);\n"
+    "}\n";
+
+// Passe de profundidade: so a posicao; a luminaria sai do volume de recorte e nao faz sombra
+const char* fonteVertexProfundidade =
+    "in vec3 posicao;\n"
+    "in float emissivo;\n"
+    "in uint indiceInstancia;\n"
+    "void main() {\n"
+    "    int i = int(indiceInstancia);\n"
+    "    mat4 modelo = matrizInstancia(i);\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * (modelo * vec4(posicao, 1.0));\n"
+    "    if (emissivo > 0.5) gl_Position = vec4(0.0, 0.0, 2.0, 1.0);\n"
+    "}\n";
+
+const char* fonteFragmentProfundidade =
+    "void main() {\n"
+    "}\n";
+
+enum { SOMBRA_SOL = 1, SOMBRA_POSTE = 2 };
+
+typedef struct {
+    GLuint programa;             // receptores (0 se nao compilou: sem sombras)
+    GLint uLuzAtiva, uCorLuminaria, uEmissaoLuminaria, uMatrizSombraSol, uPosLuzPoste;
+    GLuint programaProfundidade;
+    GLuint fbo;
+    GLuint texSol, texPoste;     // GL_TEXTURE_2D e GL_TEXTURE_CUBE_MAP de profundidade
+    GLuint bufProjetores;        // props que fazem sombra no mapa sendo desenhado
+    GLuint* projetores;
+    int validos;                 // SOMBRA_SOL | SOMBRA_POSTE: mapas em dia
+    float centroSol[2];          // celula em que o mapa do sol esta centrado
+    GLfloat posSolMapa[4], posPosteMapa[4]; // posicao das luzes quando os mapas foram feitos
+    GLfloat matrizSol[16];       // mundo -> coordenadas de textura do mapa do sol
+    float planosSol[6][4], planosPoste[6][4]; // volume dos projetores de cada mapa em dia
+} Sombras;
+
+typedef struct {
+    long mapasSol, mapasPoste;   // vezes que cada mapa foi desenhado
+    int projetoresSol, projetoresPoste; // props no ultimo desenho de cada mapa
+    double ultimoMs;             // CPU do ultimo desenho de mapa
+} EstatisticasSombras;
+
+Sombras sombras;
+EstatisticasSombras estatSombras;
+bool usarSombras = false; // 'O' liga/desliga (--sombras)
+
+bool sombrasAtivas() {
+    return usarSombras && sombras.programa && instancias.programa && !modoImediato && !luzesAgrupadasAtivas();
+}
+
+// Algo que faz sombra mudou (layout editado, luz religada): o mapa e refeito quando for usado
+void invalidaSombras(int mapas) {
+    sombras.validos &= ~mapas;
+}
+
+// Caixa de um prop editado (antes e depois da edicao): so os mapas cujo volume de projetores
+// ela toca precisam ser refeitos
+void invalidaSombrasCaixa(const float caixa[6]) {
+    if ((sombras.validos & SOMBRA_SOL) && testaCaixaFrustum(sombras.planosSol, caixa, caixa + 3) != 0) {
+        invalidaSombras(SOMBRA_SOL);
+    }
+    if ((sombras.validos & SOMBRA_POSTE) && testaCaixaFrustum(sombras.planosPoste, caixa, caixa + 3) != 0) {
+        invalidaSombras(SOMBRA_POSTE);
+    }
+}
+
+GLuint criaTexturaProfundidade(GLenum alvo, int tamanho) {
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(alvo, tex);
+    if (alvo == GL_TEXTURE_CUBE_MAP) {
+        for (int f = 0; f < 6; f++) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_DEPTH_COMPONENT24, tamanho, tamanho, 0,
+                         GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        }
+        glTexParameteri(alvo, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    } else {
+        glTexImage2D(alvo, 0, GL_DEPTH_COMPONENT24, tamanho, tamanho, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    }
+    glTexParameteri(alvo, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // comparacao filtrada (PCF 2x2)
+    glTexParameteri(alvo, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(alvo, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(alvo, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(alvo, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(alvo, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(alvo, 0);
+    return tex;
+}
+
+void criaSombras() {
+    if (!instancias.programa) return;
+    sombras.programa = criaPrograma(fonteVertexSombras, fonteFragmentSombras, atributosInstancia, NUM_ATRIBUTOS);
+    sombras.programaProfundidade = criaPrograma(fonteVertexProfundidade, fonteFragmentProfundidade, atributosInstancia, NUM_ATRIBUTOS);
+    if (!sombras.programa || !sombras.programaProfundidade) {
+        fprintf(stderr, "Sombras indisponiveis\n");
+        sombras.programa = 0;
+        usarSombras = false;
+        return;
+    }
+    GLuint p = sombras.programa;
+    sombras.uLuzAtiva = glGetUniformLocation(p, "luzAtiva");
+    sombras.uCorLuminaria = glGetUniformLocation(p, "corLuminaria");
+    sombras.uEmissaoLuminaria = glGetUniformLocation(p, "emissaoLuminaria");
+    sombras.uMatrizSombraSol = glGetUniformLocation(p, "matrizSombraSol");
+    sombras.uPosLuzPoste = glGetUniformLocation(p, "posLuzPoste");
+    glUseProgram(p);
+    glUniform1i(glGetUniformLocation(p, "matrizesInstancia"), 1);
+    glUniform1i(glGetUniformLocation(p, "materiaisInstancia"), 2);
+    glUniform1i(glGetUniformLocation(p, "mapaSol"), 6); // unidades 3 a 5 sao da iluminacao agrupada
+    glUniform1i(glGetUniformLocation(p, "mapaPoste"), 7);
+    glUniform2f(glGetUniformLocation(p, "planosPoste"), PERTO_SOMBRA_POSTE, LONGE_SOMBRA_POSTE);
+    glUseProgram(sombras.programaProfundidade);
+    glUniform1i(glGetUniformLocation(sombras.programaProfundidade, "matrizesInstancia"), 1);
+    glUseProgram(0);
+
+    sombras.texSol = criaTexturaProfundidade(GL_TEXTURE_2D, TAMANHO_MAPA_SOL);
+    sombras.texPoste = criaTexturaProfundidade(GL_TEXTURE_CUBE_MAP, TAMANHO_MAPA_POSTE);
+    glGenFramebuffers(1, &sombras.fbo);
+    glGenBuffers(1, &sombras.bufProjetores);
+    glBindBuffer(GL_ARRAY_BUFFER, sombras.bufProjetores);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * (parque.numProps > 0 ? parque.numProps : 1), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    sombras.projetores = malloc(sizeof(GLuint) * (parque.numProps > 0 ? parque.numProps : 1));
+    sombras.validos = 0;
+}
+
+// Props dentro da regiao (planos) que fazem sombra: envia a lista, separada por tipo, para a GPU
+int selecionaProjetores(const float planos[6][4], int contagem[NUM_TIPOS_PROP]) {
+    EstatisticasCulling descartado = { 0 };
+    GLuint* lista = sombras.projetores;
+    int num = percorreNoBVH(0, planos, lista, &descartado);
+
+    int proximo[NUM_TIPOS_PROP];
+    memset(contagem, 0, sizeof(int) * NUM_TIPOS_PROP);
+    for (int k = 0; k < num; k++) contagem[parque.tipos[lista[k]]]++;
+    GLuint* porTipo = malloc(sizeof(GLuint) * (num > 0 ? num : 1));
+    for (int t = 0, soma = 0; t < NUM_TIPOS_PROP; t++) {
+        proximo[t] = soma;
+        soma += contagem[t];
+    }
+    for (int k = 0; k < num; k++) porTipo[proximo[parque.tipos[lista[k]]]++] = lista[k];
+    glBindBuffer(GL_ARRAY_BUFFER, sombras.bufProjetores);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLuint) * num, porTipo);
+    free(porTipo);
+    return num;
+}
+
+// Desenha a profundidade dos projetores com as matrizes GL atuais (uma chamada por tipo)
+void desenhaProjetores(const int contagem[NUM_TIPOS_PROP]) {
+    GLsizei stride = FLOATS_POR_VERTICE_COMPOSTO * sizeof(float);
+    for (int t = 0, inicio = 0; t < NUM_TIPOS_PROP; inicio += contagem[t], t++) {
+        if (contagem[t] == 0) continue;
+        const Malha* m = &malhaProp[t][0];
+        glBindBuffer(GL_ARRAY_BUFFER, sombras.bufProjetores);
+        glVertexAttribIPointer(ATRIB_INDICE_INSTANCIA, 1, GL_UNSIGNED_INT, 0, (void*)(sizeof(GLuint) * inicio));
+        glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ibo);
+        glVertexAttribPointer(ATRIB_POSICAO, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        glVertexAttribPointer(ATRIB_EMISSIVO, 1, GL_FLOAT, GL_FALSE, stride, (void*)(9 * sizeof(float)));
+        glDrawElementsInstanced(GL_TRIANGLES, m->numIndices, GL_UNSIGNED_INT, (void*)0, contagem[t]);
+    }
+}
+
+// Planos de uma caixa alinhada aos eixos, no formato de extraiFrustum
+void planosCaixa(const float min[3], const float max[3], float planos[6][4]) {
+    memset(planos, 0, sizeof(float) * 24);
+    for (int k = 0; k < 3; k++) {
+        planos[2 * k][k] = 1.0f;
+        planos[2 * k][3] = -min[k];
+        planos[2 * k + 1][k] = -1.0f;
+        planos[2 * k + 1][3] = max[k];
+    }
+}
+
+void desenhaMapaSol() {
+    float d = sqrtf(posSol[0] * posSol[0] + posSol[1] * posSol[1] + posSol[2] * posSol[2]);
+    float cx = sombras.centroSol[0], cz = sombras.centroSol[1];
+    float cy = alturaTerreno(cx, cz);
+    float distancia = 100.0f; // a camera do sol fica longe o bastante para ver as copas mais altas
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(-META_LADO_SOMBRA_SOL, META_LADO_SOMBRA_SOL, -META_LADO_SOMBRA_SOL, META_LADO_SOMBRA_SOL, 1.0, 2.0 * distancia);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    gluLookAt(cx + posSol[0] / d * distancia, cy + posSol[1] / d * distancia, cz + posSol[2] / d * distancia,
+              cx, cy, cz, 0.0f, 1.0f, 0.0f);
+
+    float proj[16], vista[16], planos[6][4];
+    glGetFloatv(GL_PROJECTION_MATRIX, proj);
+    glGetFloatv(GL_MODELVIEW_MATRIX, vista);
+    extraiFrustum(proj, vista, planos);
+    memcpy(sombras.planosSol, planos, sizeof(planos));
+
+    // mundo -> [0, 1]: escala e desloca o volume de recorte da luz
+    float vistaProj[16];
+    float desvio[16] = { 0.5f, 0, 0, 0,  0, 0.5f, 0, 0,  0, 0, 0.5f, 0,  0.5f, 0.5f, 0.5f, 1.0f };
+    matrizMultiplica(vistaProj, proj, vista);
+    matrizMultiplica(sombras.matrizSol, desvio, vistaProj);
+
+    int contagem[NUM_TIPOS_PROP];
+    estatSombras.projetoresSol = selecionaProjetores(planos, contagem);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, sombras.texSol, 0);
+    glViewport(0, 0, TAMANHO_MAPA_SOL, TAMANHO_MAPA_SOL);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    desenhaProjetores(contagem);
+    estatSombras.mapasSol++;
+}
+
+void desenhaMapaPoste() {
+    // orientacao de cada face do cubo (direcao e vetor up da convencao do GL_TEXTURE_CUBE_MAP)
+    static const float faces[6][6] = {
+        { 1, 0, 0,  0, -1, 0 }, { -1, 0, 0,  0, -1, 0 },
+        { 0, 1, 0,  0, 0, 1 },  { 0, -1, 0,  0, 0, -1 },
+        { 0, 0, 1,  0, -1, 0 }, { 0, 0, -1,  0, -1, 0 },
+    };
+    const GLfloat* l = posPoste;
+    float min[3] = { l[0] - LONGE_SOMBRA_POSTE, l[1] - LONGE_SOMBRA_POSTE, l[2] - LONGE_SOMBRA_POSTE };
+    float max[3] = { l[0] + LONGE_SOMBRA_POSTE, l[1] + LONGE_SOMBRA_POSTE, l[2] + LONGE_SOMBRA_POSTE };
+    float planos[6][4];
+    planosCaixa(min, max, planos);
+    memcpy(sombras.planosPoste, planos, sizeof(planos));
+    int contagem[NUM_TIPOS_PROP];
+    estatSombras.projetoresPoste = selecionaProjetores(planos, contagem);
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(90.0, 1.0, PERTO_SOMBRA_POSTE, LONGE_SOMBRA_POSTE);
+    glViewport(0, 0, TAMANHO_MAPA_POSTE, TAMANHO_MAPA_POSTE);
+    for (int f = 0; f < 6; f++) {
+        const float* o = faces[f];
+        glMatrixMode(GL_MODELVIEW);
+        glLoadIdentity();
+        gluLookAt(l[0], l[1], l[2], l[0] + o[0], l[1] + o[1], l[2] + o[2], o[3], o[4], o[5]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, sombras.texPoste, 0);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        desenhaProjetores(contagem);
+    }
+    estatSombras.mapasPoste++;
+}
+
+// Refaz os mapas invalidos das luzes ligadas (chamado no inicio de drawCena)
+void atualizaSombras() {
+    if (!sombrasAtivas()) return;
+
+    // luz movida invalida o seu mapa; a camera fora da celula invalida o do sol
+    if (memcmp(sombras.posSolMapa, posSol, sizeof(posSol)) != 0) invalidaSombras(SOMBRA_SOL);
+    if (memcmp(sombras.posPosteMapa, posPoste, sizeof(posPoste)) != 0) invalidaSombras(SOMBRA_POSTE);
+    float cx = floorf(cameraX / CELULA_SOMBRA_SOL + 0.5f) * CELULA_SOMBRA_SOL;
+    float cz = floorf(cameraZ / CELULA_SOMBRA_SOL + 0.5f) * CELULA_SOMBRA_SOL;
+    if (cx != sombras.centroSol[0] || cz != sombras.centroSol[1]) invalidaSombras(SOMBRA_SOL);
+
+    int refazer = 0;
+    if (luzDirecionalLigada && !(sombras.validos & SOMBRA_SOL)) refazer |= SOMBRA_SOL;
+    if (luzPontualLigada && !(sombras.validos & SOMBRA_POSTE)) refazer |= SOMBRA_POSTE;
+    if (!refazer) return;
+
+    double inicio = tempoAtualMs();
+    GLint fboAnterior;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fboAnterior);
+    glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_POLYGON_BIT | GL_COLOR_BUFFER_BIT);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, sombras.fbo);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT); // so as faces de tras: a propria superficie iluminada nao se sombreia
+    glUseProgram(sombras.programaProfundidade);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, instancias.texMatrizes);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glEnableVertexAttribArray(ATRIB_POSICAO);
+    glEnableVertexAttribArray(ATRIB_EMISSIVO);
+    glEnableVertexAttribArray(ATRIB_INDICE_INSTANCIA);
+    glVertexAttribDivisor(ATRIB_INDICE_INSTANCIA, 1);
+
+    if (refazer & SOMBRA_SOL) {
+        sombras.centroSol[0] = cx;
+        sombras.centroSol[1] = cz;
+        desenhaMapaSol();
+        memcpy(sombras.posSolMapa, posSol, sizeof(posSol));
+    }
+    if (refazer & SOMBRA_POSTE) {
+        desenhaMapaPoste();
+        memcpy(sombras.posPosteMapa, posPoste, sizeof(posPoste));
+    }
+    sombras.validos |= refazer;
+
+    glVertexAttribDivisor(ATRIB_INDICE_INSTANCIA, 0);
+    glDisableVertexAttribArray(ATRIB_INDICE_INSTANCIA);
+    glDisableVertexAttribArray(ATRIB_EMISSIVO);
+    glDisableVertexAttribArray(ATRIB_POSICAO);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, fboAnterior);
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+    glPopAttrib(); // viewport, culling e draw buffer voltam ao do frame
+    estatSombras.ultimoMs = tempoAtualMs() - inicio;
+}
+
+void ligaProgramaSombras(const GLfloat* corLuminaria, const GLfloat* emissaoLuminaria) {
+    glUseProgram(sombras.programa);
+    glUniform2f(sombras.uLuzAtiva, luzDirecionalLigada ? 1.0f : 0.0f, luzPontualLigada ? 1.0f : 0.0f);
+    glUniform3fv(sombras.uCorLuminaria, 1, corLuminaria);
+    glUniform3fv(sombras.uEmissaoLuminaria, 1, emissaoLuminaria);
+    glUniformMatrix4fv(sombras.uMatrizSombraSol, 1, GL_FALSE, sombras.matrizSol);
+    glUniform3fv(sombras.uPosLuzPoste, 1, posPoste);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, sombras.texSol);
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, sombras.texPoste);
+}
+
+void desligaTexturasSombras() {
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// --- MAPAS DE LUZ ---
+// O sol e as luzes dos postes nao mudam, entao a iluminacao difusa da parte estatica da cena pode
+// ser calculada uma vez e so lida no desenho. O calculo e feito no inicio com --mapas-luz, ou
+// na primeira vez que a tecla 'J' liga o modo. Ha quatro conjuntos, um por combinacao das teclas
+// 'A' e 'S'; trocar de luz so troca o conjunto lido (um uniform).
+// - Chao: textura 2D com uma camada por conjunto. Cobre no XZ o parque mais o raio das luzes.
+//   Cada texel guarda a irradiancia no ponto do terreno, com a normal do terreno, e o chao le a
+//   textura por pixel. Fora da textura nao ha postes: ambiente e sol sao avaliados no shader.
+// - Props: as malhas sao compartilhadas entre as instancias, entao nao da para desdobrar cada
+//   prop num mapa proprio. Cada prop tem um cubo de ambiente num texture buffer: a irradiancia
+//   nas 6 direcoes dos eixos, no centro da sua caixa. O vertex shader mistura 3 faces pela normal.
+// Os postes sao as luzes da iluminacao agrupada (parque.luzes, atenuacao de GL_LIGHT1 e janela
+// do raio) e o sol e GL_LIGHT0. So ambiente e difusa sao pre-calculados (o especular depende do
+// observador). O calculo e dividido em tarefas (faixas de linhas do chao e de props), feitas
+// por uma thread por nucleo.
+
+#define TEXEL_MAPA_CHAO 0.25f       // metros por texel (o mapa so fica mais grosso se passar do lado maximo)
+#define LADO_MAX_MAPA_CHAO 1024
+#define NUM_CONJUNTOS_LUZ 4         // bit 0 = sol ('S'), bit 1 = postes ('A')
+#define LINHAS_POR_TAREFA_MAPA 16
+#define PROPS_POR_TAREFA_MAPA 512
+
+typedef struct {
+    GLuint programa;                // 0 se o shader nao compilou
+    GLint uConjunto, uCorLuminaria, uEmissaoLuminaria, uAmbienteFora, uSolFora;
+    GLuint texChao;                 // GL_TEXTURE_2D_ARRAY, uma camada por conjunto
+    GLuint bufSondas, texSondas;    // 6 texels (+X -X +Y -Y +Z -Z) por prop e conjunto
+    bool prontos;
+    int lado;                       // texels por lado do mapa do chao
+    float origem[2], tamanho;       // canto (x, z) e lado em metros do mapa do chao
+
+    // luzes no momento do calculo (cores lidas de GL_LIGHT0/GL_LIGHT1, posicoes no mundo)
+    float ambienteGlobal[3], ambienteSol[3], difusaSol[3], direcaoSol[3];
+    float ambientePoste[3], difusaPoste[3], atenuacao[3];
+
+    // grade das luzes dos postes (celulas do tamanho do maior raio): cada ponto so ve 3 x 3 celulas
+    int gradeLado;
+    float gradeCelula;
+    int* inicioGrade;
+    int* luzesGrade;
+
+    // parcelas calculadas pelas threads (os conjuntos sao somas delas)
+    float (*chaoSol)[3], (*chaoPostes)[3];      // por texel
+    float (*sondasSol)[6][3], (*sondasPostes)[6][3]; // por prop
+    int numTarefasChao, numTarefas;
+    int proximaTarefa;              // atomico
+
+    int threads;
+    double ms;
+} MapasLuz;
+
+MapasLuz mapasLuz;
+bool usarMapasLuz = false; // 'J' liga/desliga (--mapas-luz)
+
+const char* fonteVertexMapasLuz =
+    "in vec3 posicao;\n"
+    "in vec3 normal;\n"
+    "in vec3 cor;\n"
+    "in float emissivo;\n"
+    "in uint indiceInstancia;\n"
+    "uniform samplerBuffer materiaisInstancia;\n"
+    "uniform samplerBuffer sondasLuz;  // 6 texels por prop e conjunto: +X -X +Y -Y +Z -Z\n"
+    "uniform int conjunto;             // bit 0 = sol, bit 1 = postes\n"
+    "uniform int numProps;             // a instancia numProps (identidade) e o chao\n"
+    "uniform vec3 areaMapa;            // canto xz e 1 / lado (m) do mapa do chao\n"
+    "uniform vec3 corLuminaria;\n"
+    "uniform vec3 emissaoLuminaria;\n"
+    "out vec3 difusaVertice;\n"
+    "out vec3 emissaoVertice;\n"
+    "out vec3 luzVertice;\n"
+    "out vec3 normalMundo;\n"
+    "out vec2 coordMapa;\n"
+    "flat out int chao;\n"
+    "void main() {\n"
+    "    int i = int(indiceInstancia);\n"
+    "    mat4 modelo = matrizInstancia(i);\n"
+    "    vec4 tinta = texelFetch(materiaisInstancia, i);\n"
+    "    vec4 mundo = modelo * vec4(posicao, 1.0);\n"
+    "    vec3 n = normalize(mat3(modelo) * normal);\n"
+    "    difusaVertice = cor * tinta.rgb;\n"
+    "    emissaoVertice = vec3(0.0);\n"
+    "    if (emissivo > 0.5) { difusaVertice = corLuminaria; emissaoVertice = emissaoLuminaria; }\n"
+    "    chao = i == numProps ? 1 : 0;\n"
+    "    normalMundo = n;\n"
+    "    coordMapa = (mundo.xz - areaMapa.xy) * areaMapa.z;\n"
+    "    luzVertice = vec3(0.0);\n"
+    "    if (chao == 0) {\n"
+    "        vec3 q = n * n;\n"
+    "        int base = 6 * (conjunto * numProps + i);\n"
+    "        luzVertice = q.x * texelFetch(sondasLuz, base + (n.x < 0.0 ? 1 : 0)).rgb\n"
+    "                   + q.y * texelFetch(sondasLuz, base + (n.y < 0.0 ? 3 : 2)).rgb\n"
+    "                   + q.z * texelFetch(sondasLuz, base + (n.z < 0.0 ? 5 : 4)).rgb;\n"
+    "    }\n"
+    "    gl_Position = gl_ProjectionMatrix * (gl_ModelViewMatrix * mundo);\n"
+    "}\n";
+
+const char* fonteFragmentMapasLuz =
+    "in vec3 difusaVertice;\n"
+    "in vec3 emissaoVertice;\n"
+    "in vec3 luzVertice;\n"
+    "in vec3 normalMundo;\n"
+    "in vec2 coordMapa;\n"
+    "flat in int chao;\n"
+    "uniform sampler2DArray mapaChao;\n"
+    "uniform int conjunto;\n"
+    "uniform vec3 ambienteFora;        // fora do mapa: ambiente global e do sol\n"
+    "uniform vec3 solFora;             // e a difusa do sol (zero com o sol desligado)\n"
+    "uniform vec3 direcaoSol;\n"
+    "void main() {\n"
+    "    vec3 luz = luzVertice;\n"
+    "    if (chao != 0) {\n"
+    "        if (all(greaterThanEqual(coordMapa, vec2(0.0))) && all(lessThanEqual(coordMapa, vec2(1.0))))\n"
+    "            luz = texture(mapaChao, vec3(coordMapa, float(conjunto))).rgb;\n"
+    "        else\n"
+    "            luz = ambienteFora + max(dot(normalize(normalMundo), direcaoSol), 0.0) * solFora;\n"
+    "    }\n"
+    "    gl_FragColor = vec4(clamp(emissaoVertice + difusaVertice * luz, 0.0, 1.0), 1.0);\n"
+    "}\n";
+
+// Caminho dos mapas de luz: so com as malhas em cache e sem a iluminacao agrupada ou as sombras
+bool mapasLuzAtivos() {
+    return usarMapasLuz && mapasLuz.programa && mapasLuz.prontos && instancias.programa && !modoImediato
+           && !luzesAgrupadasAtivas() && !sombrasAtivas();
+}
+
+void criaMapasLuz() {
+    MapasLuz* m = &mapasLuz;
+    if (!instancias.programa) {
+        usarMapasLuz = false;
+        return;
+    }
+    m->programa = criaPrograma(fonteVertexMapasLuz, fonteFragmentMapasLuz, atributosInstancia, NUM_ATRIBUTOS);
+    if (!m->programa) {
+        fprintf(stderr, "Mapas de luz indisponiveis\n");
+        usarMapasLuz = false;
+        return;
+    }
+    GLuint p = m->programa;
+    m->uConjunto = glGetUniformLocation(p, "conjunto");
+    m->uCorLuminaria = glGetUniformLocation(p, "corLuminaria");
+    m->uEmissaoLuminaria = glGetUniformLocation(p, "emissaoLuminaria");
+    m->uAmbienteFora = glGetUniformLocation(p, "ambienteFora");
+    m->uSolFora = glGetUniformLocation(p, "solFora");
+    glUseProgram(p);
+    glUniform1i(glGetUniformLocation(p, "matrizesInstancia"), 1);
+    glUniform1i(glGetUniformLocation(p, "materiaisInstancia"), 2);
+    glUniform1i(glGetUniformLocation(p, "mapaChao"), 11); // 8 a 10 sao do atlas dos impostores
+    glUniform1i(glGetUniformLocation(p, "sondasLuz"), 12);
+    glUniform1i(glGetUniformLocation(p, "numProps"), parque.numProps);
+    glUseProgram(0);
+
+    glGenTextures(1, &m->texChao);
+    glGenBuffers(1, &m->bufSondas);
+    glGenTextures(1, &m->texSondas);
+    m->prontos = false;
+    if (usarMapasLuz) calculaMapasLuz(); // --mapas-luz: calculados ja no inicio
+}
+
+// Peso (atenuacao de GL_LIGHT1 vezes a janela do raio, como no shader agrupado) e direcao da
+// luz l vista do ponto p; 0 fora do alcance
+float pesoLuzPoste(const LuzCena* l, const float p[3], float direcao[3]) {
+    float d[3] = { l->posicao[0] - p[0], l->posicao[1] - p[1], l->posicao[2] - p[2] };
+    float dist = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    if (dist >= l->raio || dist <= 0.0f) return 0.0f;
+    const float* a = mapasLuz.atenuacao;
+    float r = dist / l->raio;
+    float janela = 1.0f - r * r * r * r;
+    for (int k = 0; k < 3; k++) direcao[k] = d[k] / dist;
+    return janela * janela / (a[0] + a[1] * dist + a[2] * dist * dist);
+}
+
+int celulaGradeLuz(float v, int eixo) {
+    MapasLuz* m = &mapasLuz;
+    int c = (int)floorf((v - m->origem[eixo]) / m->gradeCelula);
+    return c < 0 ? 0 : (c >= m->gradeLado ? m->gradeLado - 1 : c);
+}
+
+// Luz dos postes no ponto p. Com normal, a irradiancia nessa normal (e[0..2]); sem normal, o
+// cubo de ambiente (e[6][3], faces +X -X +Y -Y +Z -Z)
+void luzPostesPonto(const float p[3], const float* normal, float* e) {
+    MapasLuz* m = &mapasLuz;
+    int cx = celulaGradeLuz(p[0], 0), cz = celulaGradeLuz(p[2], 1);
+    for (int gz = cz - 1; gz <= cz + 1; gz++) {
+        if (gz < 0 || gz >= m->gradeLado) continue;
+        for (int gx = cx - 1; gx <= cx + 1; gx++) {
+            if (gx < 0 || gx >= m->gradeLado) continue;
+            int c = gz * m->gradeLado + gx;
+            for (int k = m->inicioGrade[c]; k < m->inicioGrade[c + 1]; k++) {
+                const LuzCena* l = &parque.luzes[m->luzesGrade[k]];
+                float dir[3];
+                float peso = pesoLuzPoste(l, p, dir);
+                if (peso == 0.0f) continue;
+                if (normal) {
+                    float nl = fmaxf(normal[0] * dir[0] + normal[1] * dir[1] + normal[2] * dir[2], 0.0f);
+                    for (int j = 0; j < 3; j++) e[j] += peso * l->cor[j] * (m->ambientePoste[j] + nl * m->difusaPoste[j]);
+                    continue;
+                }
+                for (int f = 0; f < 6; f++) {
+                    float nl = fmaxf(f & 1 ? -dir[f >> 1] : dir[f >> 1], 0.0f);
+                    for (int j = 0; j < 3; j++) e[f * 3 + j] += peso * l->cor[j] * (m->ambientePoste[j] + nl * m->difusaPoste[j]);
+                }
+            }
+        }
+    }
+}
+
+// Sol (ambiente + difusa) numa normal
+void luzSolNormal(const float n[3], float e[3]) {
+    MapasLuz* m = &mapasLuz;
+    float nl = fmaxf(n[0] * m->direcaoSol[0] + n[1] * m->direcaoSol[1] + n[2] * m->direcaoSol[2], 0.0f);
+    for (int j = 0; j < 3; j++) e[j] = m->ambienteSol[j] + nl * m->difusaSol[j];
+}
+
+void calculaLinhasChao(int inicio, int fim) {
+    MapasLuz* m = &mapasLuz;
+    float texel = m->tamanho / m->lado;
+    float passo = TAMANHO_BLOCO / (LADO_BLOCO - 1); // mesma normal dos vertices do terreno
+    for (int iz = inicio; iz < fim; iz++) {
+        for (int ix = 0; ix < m->lado; ix++) {
+            float x = m->origem[0] + (ix + 0.5f) * texel, z = m->origem[1] + (iz + 0.5f) * texel;
+            float dx = (alturaTerreno(x + passo, z) - alturaTerreno(x - passo, z)) / (2.0f * passo);
+            float dz = (alturaTerreno(x, z + passo) - alturaTerreno(x, z - passo)) / (2.0f * passo);
+            float len = sqrtf(dx * dx + 1.0f + dz * dz);
+            float n[3] = { -dx / len, 1.0f / len, -dz / len };
+            float p[3] = { x, alturaTerreno(x, z), z };
+            int t = iz * m->lado + ix;
+            luzSolNormal(n, m->chaoSol[t]);
+            memset(m->chaoPostes[t], 0, sizeof(m->chaoPostes[t]));
+            luzPostesPonto(p, n, m->chaoPostes[t]);
+        }
+    }
+}
+
+void calculaSondasProps(int inicio, int fim) {
+    MapasLuz* m = &mapasLuz;
+    for (int i = inicio; i < fim; i++) {
+        const float* c = bvh.caixas[i];
+        float p[3] = { (c[0] + c[3]) * 0.5f, (c[1] + c[4]) * 0.5f, (c[2] + c[5]) * 0.5f };
+        for (int f = 0; f < 6; f++) {
+            float eixo[3] = { 0.0f, 0.0f, 0.0f };
+            eixo[f >> 1] = f & 1 ? -1.0f : 1.0f;
+            luzSolNormal(eixo, m->sondasSol[i][f]);
+        }
+        memset(m->sondasPostes[i], 0, sizeof(m->sondasPostes[i]));
+        luzPostesPonto(p, NULL, &m->sondasPostes[i][0][0]);
+    }
+}
+
+void* trabalhadorMapasLuz(void* arg) {
+    (void)arg;
+    MapasLuz* m = &mapasLuz;
+    for (;;) {
+        int t = __atomic_fetch_add(&m->proximaTarefa, 1, __ATOMIC_RELAXED);
+        if (t >= m->numTarefas) break;
+        if (t < m->numTarefasChao) {
+            int inicio = t * LINHAS_POR_TAREFA_MAPA;
+            calculaLinhasChao(inicio, inicio + LINHAS_POR_TAREFA_MAPA < m->lado ? inicio + LINHAS_POR_TAREFA_MAPA : m->lado);
+        } else {
+            int inicio = (t - m->numTarefasChao) * PROPS_POR_TAREFA_MAPA;
+            int fim = inicio + PROPS_POR_TAREFA_MAPA;
+            calculaSondasProps(inicio, fim < parque.numProps ? fim : parque.numProps);
+        }
+    }
+    return NULL;
+}
+
+// Agrupa as luzes dos postes numa grade sobre a area do mapa (counting sort por celula)
+void montaGradeLuzes() {
+    MapasLuz* m = &mapasLuz;
+    float raio = 1.0f;
+    for (int k = 0; k < parque.numLuzes; k++) raio = fmaxf(raio, parque.luzes[k].raio);
+    m->gradeCelula = raio;
+    m->gradeLado = (int)ceilf(m->tamanho / raio);
+    if (m->gradeLado < 1) m->gradeLado = 1;
+    int numCelulas = m->gradeLado * m->gradeLado;
+    m->inicioGrade = calloc(numCelulas + 1, sizeof(int));
+    m->luzesGrade = malloc(sizeof(int) * (parque.numLuzes > 0 ? parque.numLuzes : 1));
+    int* celula = malloc(sizeof(int) * (parque.numLuzes > 0 ? parque.numLuzes : 1));
+    for (int k = 0; k < parque.numLuzes; k++) {
+        celula[k] = celulaGradeLuz(parque.luzes[k].posicao[2], 1) * m->gradeLado + celulaGradeLuz(parque.luzes[k].posicao[0], 0);
+        m->inicioGrade[celula[k] + 1]++;
+    }
+    for (int c = 0; c < numCelulas; c++) m->inicioGrade[c + 1] += m->inicioGrade[c];
+    int* proximo = malloc(sizeof(int) * numCelulas);
+    memcpy(proximo, m->inicioGrade, sizeof(int) * numCelulas);
+    for (int k = 0; k < parque.numLuzes; k++) m->luzesGrade[proximo[celula[k]]++] = k;
+    free(proximo);
+    free(celula);
+}
+
+// float de 32 bits para 16 (GL_RGBA16F do texture buffer); valores pequenos viram zero
+uint16_t meioFloat(float v) {
+    uint32_t b;
+    memcpy(&b, &v, sizeof(b));
+    uint16_t sinal = (b >> 16) & 0x8000;
+    int expoente = (int)((b >> 23) & 0xFF) - 127 + 15;
+    if (expoente <= 0) return sinal;
+    if (expoente >= 31) return sinal | 0x7BFF; // satura no maior valor finito
+    return sinal | (uint16_t)(expoente << 10) | (uint16_t)((b >> 13) & 0x3FF);
+}
+
+// Calcula os quatro conjuntos (chao e sondas dos props) em paralelo e envia para a GPU
+void calculaMapasLuz() {
+    MapasLuz* m = &mapasLuz;
+    if (!m->programa) return;
+    double inicio = tempoAtualMs();
+
+    // cores e atenuacao das luzes como configuraIluminacao as deixa (posicoes no mundo)
+    float v[4];
+    configuraIluminacao();
+    glGetFloatv(GL_LIGHT_MODEL_AMBIENT, v);
+    memcpy(m->ambienteGlobal, v, sizeof(m->ambienteGlobal));
+    glGetLightfv(GL_LIGHT0, GL_AMBIENT, v);
+    memcpy(m->ambienteSol, v, sizeof(m->ambienteSol));
+    glGetLightfv(GL_LIGHT0, GL_DIFFUSE, v);
+    memcpy(m->difusaSol, v, sizeof(m->difusaSol));
+    glGetLightfv(GL_LIGHT1, GL_AMBIENT, v);
+    memcpy(m->ambientePoste, v, sizeof(m->ambientePoste));
+    glGetLightfv(GL_LIGHT1, GL_DIFFUSE, v);
+    memcpy(m->difusaPoste, v, sizeof(m->difusaPoste));
+    glGetLightfv(GL_LIGHT1, GL_CONSTANT_ATTENUATION, &m->atenuacao[0]);
+    glGetLightfv(GL_LIGHT1, GL_LINEAR_ATTENUATION, &m->atenuacao[1]);
+    glGetLightfv(GL_LIGHT1, GL_QUADRATIC_ATTENUATION, &m->atenuacao[2]);
+    float len = sqrtf(posSol[0] * posSol[0] + posSol[1] * posSol[1] + posSol[2] * posSol[2]);
+    for (int j = 0; j < 3; j++) m->direcaoSol[j] = posSol[j] / len;
+
+    // area: o parque mais o alcance das luzes (alem dela o chao so tem ambiente e sol)
+    float raio = 0.0f;
+    for (int k = 0; k < parque.numLuzes; k++) raio = fmaxf(raio, parque.luzes[k].raio);
+    float meio = parque.extensao + raio;
+    m->tamanho = 2.0f * meio;
+    m->origem[0] = m->origem[1] = -meio;
+    m->lado = (int)ceilf(m->tamanho / TEXEL_MAPA_CHAO);
+    if (m->lado > LADO_MAX_MAPA_CHAO) m->lado = LADO_MAX_MAPA_CHAO;
+    montaGradeLuzes();
+
+    int texels = m->lado * m->lado, n = parque.numProps;
+    m->chaoSol = malloc(sizeof(*m->chaoSol) * texels);
+    m->chaoPostes = malloc(sizeof(*m->chaoPostes) * texels);
+    m->sondasSol = malloc(sizeof(*m->sondasSol) * (n > 0 ? n : 1));
+    m->sondasPostes = malloc(sizeof(*m->sondasPostes) * (n > 0 ? n : 1));
+    m->numTarefasChao = (m->lado + LINHAS_POR_TAREFA_MAPA - 1) / LINHAS_POR_TAREFA_MAPA;
+    m->numTarefas = m->numTarefasChao + (n + PROPS_POR_TAREFA_MAPA - 1) / PROPS_POR_TAREFA_MAPA;
+    m->proximaTarefa = 0;
+
+    long nucleos = sysconf(_SC_NPROCESSORS_ONLN);
+    m->threads = nucleos > 1 ? (int)nucleos : 1;
+    pthread_t* threads = malloc(sizeof(pthread_t) * m->threads);
+    for (int i = 0; i < m->threads; i++) pthread_create(&threads[i], NULL, trabalhadorMapasLuz, NULL);
+    for (int i = 0; i < m->threads; i++) pthread_join(threads[i], NULL);
+    free(threads);
+
+    // cada conjunto e ambiente global + sol? + postes?
+    float (*camada)[3] = malloc(sizeof(*camada) * texels);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m->texChao);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R11F_G11F_B10F, m->lado, m->lado, NUM_CONJUNTOS_LUZ, 0, GL_RGB, GL_FLOAT, NULL);
+    for (int s = 0; s < NUM_CONJUNTOS_LUZ; s++) {
+        for (int t = 0; t < texels; t++) {
+            for (int j = 0; j < 3; j++) {
+                camada[t][j] = m->ambienteGlobal[j] + (s & 1 ? m->chaoSol[t][j] : 0.0f) + (s & 2 ? m->chaoPostes[t][j] : 0.0f);
+            }
+        }
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, s, m->lado, m->lado, 1, GL_RGB, GL_FLOAT, camada);
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    free(camada);
+
+    size_t numSondas = (size_t)NUM_CONJUNTOS_LUZ * (n > 0 ? n : 1) * 6;
+    uint16_t (*sondas)[4] = calloc(numSondas, sizeof(*sondas));
+    for (int s = 0; s < NUM_CONJUNTOS_LUZ; s++) {
+        for (int i = 0; i < n; i++) {
+            for (int f = 0; f < 6; f++) {
+                uint16_t* d = sondas[((size_t)s * n + i) * 6 + f];
+                for (int j = 0; j < 3; j++) {
+                    d[j] = meioFloat(m->ambienteGlobal[j] + (s & 1 ? m->sondasSol[i][f][j] : 0.0f)
+                                     + (s & 2 ? m->sondasPostes[i][f][j] : 0.0f));
+                }
+                d[3] = meioFloat(1.0f);
+            }
+        }
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, m->bufSondas);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(*sondas) * numSondas, sondas, GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, m->texSondas);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA16F, m->bufSondas);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    free(sondas);
+
+    // o que nao muda com as teclas fica fixo no programa
+    glUseProgram(m->programa);
+    glUniform3f(glGetUniformLocation(m->programa, "areaMapa"), m->origem[0], m->origem[1], 1.0f / m->tamanho);
+    glUniform3fv(glGetUniformLocation(m->programa, "direcaoSol"), 1, m->direcaoSol);
+    glUseProgram(0);
+
+    free(m->chaoSol);
+    free(m->chaoPostes);
+    free(m->sondasSol);
+    free(m->sondasPostes);
+    free(m->inicioGrade);
+    free(m->luzesGrade);
+    m->prontos = true;
+    m->ms = tempoAtualMs() - inicio;
+    fprintf(stderr, "Mapas de luz: chao %dx%d (%.2f m por texel), %d props, %d luzes, %d threads em %.1f ms\n",
+            m->lado, m->lado, m->tamanho / m->lado, n, parque.numLuzes, m->threads, m->ms);
+}
+
+// Liga o programa dos mapas no lugar do de instancias (chamada por iniciaProgramaInstancias)
+void ligaProgramaMapasLuz(const GLfloat* corLuminaria, const GLfloat* emissaoLuminaria) {
+    MapasLuz* m = &mapasLuz;
+    int conjunto = (luzDirecionalLigada ? 1 : 0) | (luzPontualLigada ? 2 : 0);
+    float ambienteFora[3], solFora[3];
+    for (int j = 0; j < 3; j++) {
+        ambienteFora[j] = m->ambienteGlobal[j] + (luzDirecionalLigada ? m->ambienteSol[j] : 0.0f);
+        solFora[j] = luzDirecionalLigada ? m->difusaSol[j] : 0.0f;
+    }
+    glUseProgram(m->programa);
+    glUniform1i(m->uConjunto, conjunto);
+    glUniform3fv(m->uCorLuminaria, 1, corLuminaria);
+    glUniform3fv(m->uEmissaoLuminaria, 1, emissaoLuminaria);
+    glUniform3fv(m->uAmbienteFora, 1, ambienteFora);
+    glUniform3fv(m->uSolFora, 1, solFora);
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m->texChao);
+    glActiveTexture(GL_TEXTURE12);
+    glBindTexture(GL_TEXTURE_BUFFER, m->texSondas);
+}
+
+void desligaTexturasMapasLuz() {
+    glActiveTexture(GL_TEXTURE12);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// --- HIERARQUIA DE TRANSFORMACOES ---
+// Raiz -> setores (quadrados de TAMANHO_SETOR do parque) -> props -> partes (assento, encosto,
+// pernas...). Os nos ficam em estrutura de arrays, em ordem topologica (o pai sempre antes dos
+// filhos): pai, filhos, matriz de mundo e marca de sujo em arrays separados. A matriz local da
+// raiz e dos setores fica em localGrupo, a de cada prop e a do layout (parque.matrizes) e a de
+// cada parte vem do molde do tipo (partesTipo, gravado uma vez de desenhaBanco/Poste/Arvore).
+// As matrizes de mundo ficam em cache e so as subarvores marcadas como sujas sao recalculadas,
+// com um kernel SSE 4x4: num parque parado o custo por frame e zero. O mundo dos props alimenta
+// a BVH e os texture buffers das instancias; o das partes, o desenho prop a prop.
+
+#define TAMANHO_SETOR 32.0f
+
+typedef struct {
+    int numNos;
+    int numGrupos;              // raiz (no 0) e setores: nos [0, numGrupos)
+    int primeiroProp;           // o prop i e o no primeiroProp + i
+    int primeiraParte;          // partes a partir daqui, continuas por prop
+    int* inicioPartes;          // primeiro no de parte de cada prop
+    int* pai;
+    int* inicioFilhos;          // filhos do no n: filhos[inicioFilhos[n] .. inicioFilhos[n + 1])
+    int* filhos;
+    float (*localGrupo)[16];
+    float (*mundo)[16];         // alinhado em 16 bytes (kernel SSE)
+    unsigned char* sujo;
+    int* pendentes;             // nos marcados desde a ultima atualizacao
+    int numPendentes;
+    int* pilha;                 // percurso das subarvores sujas
+    int* propsAlterados;        // props cujo mundo mudou na ultima atualizacao
+    int numPropsAlterados;
+} Hierarquia;
+
+// Contadores do ultimo frame (tecla 'C' imprime)
+typedef struct {
+    int nosAtualizados;   // matrizes de mundo recalculadas
+    int propsAlterados;
+    double ms;
+} EstatisticasHierarquia;
+
+Hierarquia hierarquia;
+EstatisticasHierarquia estatHierarquia;
+PartesProp partesTipo[NUM_TIPOS_PROP];
+int edicoesPorQuadro = 0; // --edicoes N: gira N props por frame (mede a atualizacao so das subarvores)
+
+// r = a * b (coluna maior). Cada coluna de r soma as colunas de a pesadas pela coluna de b.
+// r precisa estar alinhado em 16 bytes e nao pode ser a nem b.
+void multiplicaMatrizSSE(float r[16], const float a[16], const float b[16]) {
+#ifdef __SSE__
+    __m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+    for (int c = 0; c < 4; c++) {
+        __m128 col = _mm_mul_ps(a0, _mm_set1_ps(b[c * 4]));
+        col = _mm_add_ps(col, _mm_mul_ps(a1, _mm_set1_ps(b[c * 4 + 1])));
+        col = _mm_add_ps(col, _mm_mul_ps(a2, _mm_set1_ps(b[c * 4 + 2])));
+        col = _mm_add_ps(col, _mm_mul_ps(a3, _mm_set1_ps(b[c * 4 + 3])));
+        _mm_store_ps(r + c * 4, col);
+    }
+#else
+    matrizMultiplica(r, a, b);
+#endif
+}
+
+float* mundoProp(int i) {
+    return hierarquia.mundo[hierarquia.primeiroProp + i];
+}
+
+const float* localNo(int n) {
+    Hierarquia* h = &hierarquia;
+    if (n < h->primeiroProp) return h->localGrupo[n];
+    if (n < h->primeiraParte) return parque.matrizes[n - h->primeiroProp];
+    int prop = h->pai[n] - h->primeiroProp;
+    return partesTipo[parque.tipos[prop]].partes[n - h->inicioPartes[prop]].local;
+}
+
+void marcaSujo(int n) {
+    Hierarquia* h = &hierarquia;
+    if (h->sujo[n]) return;
+    h->sujo[n] = 1;
+    h->pendentes[h->numPendentes++] = n;
+}
+
+// Troca a matriz local do prop i (o layout continua em parque.matrizes) e marca a subarvore
+void defineLocalProp(int i, const float m[16]) {
+    memcpy(parque.matrizes[i], m, sizeof(parque.matrizes[i]));
+    marcaSujo(hierarquia.primeiroProp + i);
+}
+
+// Troca a matriz local de um setor (n em [1, numGrupos)): move todos os props dele juntos
+void defineLocalGrupo(int n, const float m[16]) {
+    memcpy(hierarquia.localGrupo[n], m, sizeof(hierarquia.localGrupo[n]));
+    marcaSujo(n);
+}
+
+// Grava as partes de cada tipo de prop, como gravaProp faz com a malha composta
+void gravaPartesTipos() {
+    bool imediato = modoImediato;
+    bool luzPoste = luzPontualLigada;
+    modoImediato = false;
+    luzPontualLigada = true;
+
+    glMatrixMode(GL_MODELVIEW);
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        partesEmGravacao = &partesTipo[t];
+        partesTipo[t].numPartes = 0;
+        for (int L = 0; L < NUM_NIVEIS_LOD; L++) {
+            nivelLODAtual = L;
+            glPushMatrix();
+                glLoadIdentity();
+                desenhaTipoProp[t]();
+            glPopMatrix();
+        }
+    }
+    partesEmGravacao = NULL;
+    nivelLODAtual = 0;
+
+    modoImediato = imediato;
+    luzPontualLigada = luzPoste;
+}
+
+int comparaInt(const void* a, const void* b) {
+    int va = *(const int*)a, vb = *(const int*)b;
+    return (va > vb) - (va < vb);
+}
+
+// Recalcula o mundo das subarvores marcadas. Depois de ordenar, um no marcado dentro da
+// subarvore de outro ja sai limpo pelo percurso do ancestral e e pulado.
+void propagaHierarquia() {
+    Hierarquia* h = &hierarquia;
+    h->numPropsAlterados = 0;
+    estatHierarquia.nosAtualizados = 0;
+    if (h->numPendentes == 0) return;
+
+    qsort(h->pendentes, h->numPendentes, sizeof(int), comparaInt);
+    for (int k = 0; k < h->numPendentes; k++) {
+        if (!h->sujo[h->pendentes[k]]) continue;
+        int topo = 0;
+        h->pilha[topo++] = h->pendentes[k];
+        while (topo > 0) {
+            int n = h->pilha[--topo];
+            h->sujo[n] = 0;
+            if (n == 0) memcpy(h->mundo[0], h->localGrupo[0], sizeof(h->mundo[0]));
+            else multiplicaMatrizSSE(h->mundo[n], h->mundo[h->pai[n]], localNo(n));
+            estatHierarquia.nosAtualizados++;
+            if (n >= h->primeiroProp && n < h->primeiraParte) h->propsAlterados[h->numPropsAlterados++] = n - h->primeiroProp;
+            for (int f = h->inicioFilhos[n]; f < h->inicioFilhos[n + 1]; f++) h->pilha[topo++] = h->filhos[f];
+        }
+    }
+    h->numPendentes = 0;
+}
+
+void criaHierarquia() {
+    Hierarquia* h = &hierarquia;
+    gravaPartesTipos();
+
+    int n = parque.numProps;
+    int lado = (int)ceilf(2.0f * parque.extensao / TAMANHO_SETOR);
+    if (lado < 1) lado = 1;
+    int numPartes = 0;
+    for (int i = 0; i < n; i++) numPartes += partesTipo[parque.tipos[i]].numPartes;
+
+    h->numGrupos = 1 + lado * lado;
+    h->primeiroProp = h->numGrupos;
+    h->primeiraParte = h->primeiroProp + n;
+    h->numNos = h->primeiraParte + numPartes;
+    int total = h->numNos;
+    h->inicioPartes = malloc(sizeof(int) * (n > 0 ? n : 1));
+    h->pai = malloc(sizeof(int) * total);
+    h->inicioFilhos = calloc(total + 1, sizeof(int));
+    h->filhos = malloc(sizeof(int) * total);
+    h->localGrupo = malloc(sizeof(*h->localGrupo) * h->numGrupos);
+    if (posix_memalign((void**)&h->mundo, 16, sizeof(*h->mundo) * total) != 0) h->mundo = NULL;
+    h->sujo = calloc(total, 1);
+    h->pendentes = malloc(sizeof(int) * total);
+    h->pilha = malloc(sizeof(int) * total);
+    h->propsAlterados = malloc(sizeof(int) * (n > 0 ? n : 1));
+    h->numPendentes = 0;
+
+    // pais: setores na raiz, cada prop no setor da sua posicao, partes no prop
+    h->pai[0] = -1;
+    for (int s = 1; s < h->numGrupos; s++) h->pai[s] = 0;
+    for (int g = 0; g < h->numGrupos; g++) matrizIdentidade(h->localGrupo[g]);
+    int parte = h->primeiraParte;
+    for (int i = 0; i < n; i++) {
+        const float* m = parque.matrizes[i];
+        int sx = (int)floorf((m[12] + parque.extensao) / TAMANHO_SETOR);
+        int sz = (int)floorf((m[14] + parque.extensao) / TAMANHO_SETOR);
+        sx = sx < 0 ? 0 : (sx >= lado ? lado - 1 : sx);
+        sz = sz < 0 ? 0 : (sz >= lado ? lado - 1 : sz);
+        h->pai[h->primeiroProp + i] = 1 + sz * lado + sx;
+        h->inicioPartes[i] = parte;
+        for (int k = 0; k < partesTipo[parque.tipos[i]].numPartes; k++) h->pai[parte++] = h->primeiroProp + i;
+    }
+
+    // filhos de cada no em faixas continuas (contagem + soma prefixada)
+    for (int v = 1; v < total; v++) h->inicioFilhos[h->pai[v] + 1]++;
+    for (int v = 0; v < total; v++) h->inicioFilhos[v + 1] += h->inicioFilhos[v];
+    int* proximo = malloc(sizeof(int) * total);
+    memcpy(proximo, h->inicioFilhos, sizeof(int) * total);
+    for (int v = 1; v < total; v++) h->filhos[proximo[h->pai[v]]++] = v;
+    free(proximo);
+
+    // primeira propagacao: tudo a partir da raiz
+    marcaSujo(0);
+    propagaHierarquia();
+    h->numPropsAlterados = 0;
+}
+
+// Refaz as caixas da BVH do prop ate a raiz (a arvore nao muda, so as caixas crescem/encolhem)
+void reajustaBVH(int prop) {
+    int no = bvh.folhaProp[prop];
+    NoBVH* n = &bvh.nos[no];
+    for (int k = 0; k < 3; k++) { n->min[k] = INFINITY; n->max[k] = -INFINITY; }
+    for (int i = n->primeiro; i < n->primeiro + n->quantidade; i++) {
+        const float* c = bvh.caixas[bvh.indices[i]];
+        for (int k = 0; k < 3; k++) {
+            n->min[k] = fminf(n->min[k], c[k]);
+            n->max[k] = fmaxf(n->max[k], c[3 + k]);
+        }
+    }
+    for (no = bvh.pais[no]; no >= 0; no = bvh.pais[no]) {
+        n = &bvh.nos[no];
+        const NoBVH* a = &bvh.nos[n->filho];
+        const NoBVH* b = &bvh.nos[n->filho + 1];
+        for (int k = 0; k < 3; k++) {
+            n->min[k] = fminf(a->min[k], b->min[k]);
+            n->max[k] = fmaxf(a->max[k], b->max[k]);
+        }
+    }
+}
+
+// Gira edicoesPorQuadro props sorteados em volta do proprio eixo Y (benchmark de edicao)
+void editaPropsAleatorios() {
+    static unsigned int semente = 12345;
+    float giro[16], m[16];
+    matrizProp(giro, 0.0f, 0.0f, 0.0f, 5.0f, 1.0f);
+    for (int k = 0; k < edicoesPorQuadro && parque.numProps > 0; k++) {
+        semente = semente * 1103515245u + 12345u;
+        int i = (semente >> 8) % parque.numProps;
+        matrizMultiplica(m, parque.matrizes[i], giro);
+        defineLocalProp(i, m);
+    }
+}
+
+// Aplica as edicoes do frame: mundo das subarvores, caixas da BVH, texture buffer das matrizes
+// e os mapas de sombra que alcancam os props editados. Sem nada marcado nao faz nada.
+void atualizaHierarquia() {
+    Hierarquia* h = &hierarquia;
+    if (edicoesPorQuadro > 0) editaPropsAleatorios();
+    if (h->numPendentes == 0) {
+        estatHierarquia.nosAtualizados = 0;
+        estatHierarquia.propsAlterados = 0;
+        estatHierarquia.ms = 0.0;
+        return;
+    }
+    double inicio = tempoAtualMs();
+    if (travessiaAtiva()) esperaTravessia(); // as threads leem as caixas da BVH
+
+    propagaHierarquia();
+    if (instancias.programa) glBindBuffer(GL_TEXTURE_BUFFER, instancias.bufMatrizes);
+    for (int k = 0; k < h->numPropsAlterados; k++) {
+        int i = h->propsAlterados[k];
+        invalidaSombrasCaixa(bvh.caixas[i]);
+        transformaCaixa(mundoProp(i), caixaTipoProp[parque.tipos[i]], bvh.caixas[i]);
+        invalidaSombrasCaixa(bvh.caixas[i]);
+        reajustaBVH(i);
+        atualizaHashProp(i);
+        if (instancias.programa) glBufferSubData(GL_TEXTURE_BUFFER, sizeof(float) * 16 * i, sizeof(float) * 16, mundoProp(i));
+    }
+    if (instancias.programa) glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    estatHierarquia.propsAlterados = h->numPropsAlterados;
+    estatHierarquia.ms = tempoAtualMs() - inicio;
+}
+
+// Desenha o prop i pelas partes do nivel L, cada uma com a sua matriz de mundo em cache
+void desenhaPartesProp(int i, int L) {
+    Hierarquia* h = &hierarquia;
+    const PartesProp* tipo = &partesTipo[parque.tipos[i]];
+    const GLfloat* corAnterior = NULL;
+    for (int k = 0; k < tipo->numPartes; k++) {
+        const ParteProp* p = &tipo->partes[k];
+        if (!(p->niveis & (1 << L))) continue;
+        if (p->emissiva) defineMaterialLuminaria();
+        else if (!corAnterior || memcmp(corAnterior, p->cor, sizeof(p->cor)) != 0) defineCor(p->cor);
+        corAnterior = p->emissiva ? NULL : p->cor;
+
+        const float* mundo = h->mundo[h->inicioPartes[i] + k];
+        if (p->primitiva == PRIM_CILINDRO) desenhaMalhaMundo(&malhaCilindro[L], mundo);
+        else if (p->primitiva == PRIM_ESFERA_POSTE) desenhaMalhaMundo(&malhaEsferaPoste[L], mundo);
+        else if (p->primitiva == PRIM_ESFERA_COPA) desenhaMalhaMundo(&malhaEsferaCopa[L], mundo);
+        else desenhaMalhaMundo(&malhaCubo, mundo);
+        if (p->emissiva) defineEmissao(emisOff);
+    }
+}
+
+// --- HASH ESPACIAL ---
+// Grade uniforme no plano XZ guardada numa tabela de hash: cada celula de TAMANHO_CELULA_HASH
+// metros cai num balde, e o balde encadeia as entradas dos volumes que tocam a celula. Os
+// volumes sao as caixas no mundo das partes do nivel 0 de cada prop (assento, pernas, tronco,
+// copa...), e nao a caixa do prop inteiro: da para passar embaixo da copa e entre as pernas do
+// banco. Cada entrada leva uma copia da caixa, e na montagem as entradas de um balde ficam
+// seguidas no pool; o hash e por ladrilho de 4x4 celulas, com as 16 celulas em baldes vizinhos.
+// Assim uma consulta le so a memoria das celulas que toca, em poucas linhas de cache. Um prop
+// editado atualiza as copias; o volume que muda de celula sai das antigas e entra nas novas.
+
+#define TAMANHO_CELULA_HASH 2.0f
+#define RAIO_CAMERA 0.3f       // corpo da camera: cilindro em volta do olho
+#define ALTURA_DEGRAU 0.25f    // volumes mais baixos que isso nao barram a camera
+#define ITERACOES_COLISAO 4
+#define MIN_BALDES_HASH 1024   // cenas pequenas: um raio longo nao volta sempre aos mesmos baldes
+
+typedef struct {
+    float caixa[6];
+    int volume;
+    int proxima;           // proxima entrada do mesmo balde (-1 no fim)
+} EntradaHash;
+
+typedef struct {
+    int numVolumes;
+    float (*caixas)[6];    // AABB de cada volume no mundo: min xyz, max xyz
+    int* prop;             // prop dono de cada volume
+    int* inicioVolumes;    // volumes do prop i: [inicioVolumes[i], inicioVolumes[i + 1])
+    int numBaldes;         // potencia de 2, em grupos de 16 (um ladrilho)
+    int* balde;            // primeira entrada de cada balde (-1 = vazio)
+    EntradaHash* entradas; // pool: um volume tem uma entrada em cada celula que cobre
+    int numEntradas, capEntradas;
+    int livres;            // entradas soltas por volumes que mudaram de celula (encadeadas)
+} HashEspacial;
+
+// Contadores (tecla 'C' imprime)
+typedef struct {
+    int volumesMovidos;    // volumes que trocaram de celula por edicao
+    int volumesColisao;    // volumes testados na ultima consulta de colisao
+    int volumesSelecao;    // e na ultima selecao
+    int celulasSelecao;    // celulas percorridas pelo raio da ultima selecao
+} EstatisticasHash;
+
+HashEspacial hashEspacial;
+EstatisticasHash estatHash;
+bool usarColisao = true;   // 'K' liga/desliga (--sem-colisao)
+int propSelecionado = -1;  // ultimo prop escolhido pelo centro da tela (-1 = nenhum)
+
+// caixa local de cada primitiva unitaria (cubo centrado, cilindro com a base em Y=0, esferas de raio 1)
+const float caixaPrimitiva[4][6] = {
+    { -0.5f, -0.5f, -0.5f, 0.5f, 0.5f, 0.5f },
+    { -1.0f, 0.0f, -1.0f, 1.0f, 1.0f, 1.0f },
+    { -1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f },
+    { -1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f },
+};
+
+int celulaHash(float v) {
+    return (int)floorf(v / TAMANHO_CELULA_HASH);
+}
+
+int baldeHash(int cx, int cz) {
+    unsigned ladrilho = ((unsigned)(cx >> 2) * 73856093u ^ (unsigned)(cz >> 2) * 19349663u) & (unsigned)(hashEspacial.numBaldes / 16 - 1);
+    return (int)(ladrilho << 4 | (unsigned)(cz & 3) << 2 | (unsigned)(cx & 3));
+}
+
+// Caixas no mundo das partes do nivel 0 do prop i (a hierarquia ja tem o mundo de cada parte)
+void calculaVolumesProp(int i) {
+    HashEspacial* h = &hashEspacial;
+    const PartesProp* tipo = &partesTipo[parque.tipos[i]];
+    int v = h->inicioVolumes[i];
+    for (int k = 0; k < tipo->numPartes; k++) {
+        const ParteProp* p = &tipo->partes[k];
+        if (!(p->niveis & 1)) continue;
+        transformaCaixa(hierarquia.mundo[hierarquia.inicioPartes[i] + k], caixaPrimitiva[p->primitiva], h->caixas[v++]);
+    }
+}
+
+// Poe o volume v no balde b (reaproveita uma entrada solta se houver)
+void insereEntradaHash(int b, int v) {
+    HashEspacial* h = &hashEspacial;
+    int e = h->livres;
+    if (e >= 0) h->livres = h->entradas[e].proxima;
+    else {
+        if (h->numEntradas == h->capEntradas) {
+            h->capEntradas = h->capEntradas * 2 + 64;
+            h->entradas = realloc(h->entradas, sizeof(EntradaHash) * h->capEntradas);
+        }
+        e = h->numEntradas++;
+    }
+    memcpy(h->entradas[e].caixa, h->caixas[v], sizeof(h->entradas[e].caixa));
+    h->entradas[e].volume = v;
+    h->entradas[e].proxima = h->balde[b];
+    h->balde[b] = e;
+}
+
+void removeEntradaHash(int b, int v) {
+    HashEspacial* h = &hashEspacial;
+    for (int* e = &h->balde[b]; *e >= 0; e = &h->entradas[*e].proxima) {
+        if (h->entradas[*e].volume != v) continue;
+        int solta = *e;
+        *e = h->entradas[solta].proxima;
+        h->entradas[solta].proxima = h->livres;
+        h->livres = solta;
+        return;
+    }
+}
+
+void criaHashEspacial() {
+    HashEspacial* h = &hashEspacial;
+    int n = parque.numProps;
+    h->inicioVolumes = malloc(sizeof(int) * (n + 1));
+    h->numVolumes = 0;
+    for (int i = 0; i < n; i++) {
+        h->inicioVolumes[i] = h->numVolumes;
+        const PartesProp* tipo = &partesTipo[parque.tipos[i]];
+        for (int k = 0; k < tipo->numPartes; k++) h->numVolumes += tipo->partes[k].niveis & 1;
+    }
+    h->inicioVolumes[n] = h->numVolumes;
+
+    int total = h->numVolumes > 0 ? h->numVolumes : 1;
+    h->caixas = malloc(sizeof(*h->caixas) * total);
+    h->prop = malloc(sizeof(int) * total);
+    for (int i = 0; i < n; i++) {
+        for (int v = h->inicioVolumes[i]; v < h->inicioVolumes[i + 1]; v++) h->prop[v] = i;
+        calculaVolumesProp(i);
+    }
+
+    h->numBaldes = MIN_BALDES_HASH;
+    while (h->numBaldes < 2 * total) h->numBaldes <<= 1;
+    h->balde = malloc(sizeof(int) * h->numBaldes);
+    h->livres = -1;
+
+    // entradas de cada balde seguidas no pool (contagem + soma prefixada), encadeadas em ordem
+    int* inicio = calloc(h->numBaldes + 1, sizeof(int));
+    for (int v = 0; v < h->numVolumes; v++) {
+        const float* c = h->caixas[v];
+        for (int cz = celulaHash(c[2]); cz <= celulaHash(c[5]); cz++)
+            for (int cx = celulaHash(c[0]); cx <= celulaHash(c[3]); cx++) inicio[baldeHash(cx, cz) + 1]++;
+    }
+    for (int b = 0; b < h->numBaldes; b++) inicio[b + 1] += inicio[b];
+    h->numEntradas = inicio[h->numBaldes];
+    h->capEntradas = h->numEntradas + h->numEntradas / 8 + 64;
+    h->entradas = malloc(sizeof(EntradaHash) * h->capEntradas);
+    for (int b = 0; b < h->numBaldes; b++) h->balde[b] = inicio[b] < inicio[b + 1] ? inicio[b] : -1;
+    int* proximo = malloc(sizeof(int) * h->numBaldes);
+    memcpy(proximo, inicio, sizeof(int) * h->numBaldes);
+    for (int v = 0; v < h->numVolumes; v++) {
+        const float* c = h->caixas[v];
+        for (int cz = celulaHash(c[2]); cz <= celulaHash(c[5]); cz++) {
+            for (int cx = celulaHash(c[0]); cx <= celulaHash(c[3]); cx++) {
+                int b = baldeHash(cx, cz);
+                EntradaHash* e = &h->entradas[proximo[b]++];
+                memcpy(e->caixa, c, sizeof(e->caixa));
+                e->volume = v;
+                e->proxima = proximo[b] < inicio[b + 1] ? proximo[b] : -1;
+            }
+        }
+    }
+    free(proximo);
+    free(inicio);
+    estatHash.volumesMovidos = 0;
+}
+
+// O prop i foi editado: recalcula as caixas e acerta as entradas de cada volume
+void atualizaHashProp(int i) {
+    HashEspacial* h = &hashEspacial;
+    int v0 = h->inicioVolumes[i], v1 = h->inicioVolumes[i + 1];
+    int antigas[MAX_PARTES_PROP][4];
+    for (int v = v0; v < v1; v++) {
+        const float* c = h->caixas[v];
+        antigas[v - v0][0] = celulaHash(c[0]); antigas[v - v0][1] = celulaHash(c[2]);
+        antigas[v - v0][2] = celulaHash(c[3]); antigas[v - v0][3] = celulaHash(c[5]);
+    }
+    calculaVolumesProp(i);
+    for (int v = v0; v < v1; v++) {
+        const float* c = h->caixas[v];
+        const int* a = antigas[v - v0];
+        int x0 = celulaHash(c[0]), z0 = celulaHash(c[2]), x1 = celulaHash(c[3]), z1 = celulaHash(c[5]);
+        if (a[0] == x0 && a[1] == z0 && a[2] == x1 && a[3] == z1) {
+            // mesmas celulas: so a copia da caixa muda
+            for (int cz = z0; cz <= z1; cz++) {
+                for (int cx = x0; cx <= x1; cx++) {
+                    for (int e = h->balde[baldeHash(cx, cz)]; e >= 0; e = h->entradas[e].proxima)
+                        if (h->entradas[e].volume == v) memcpy(h->entradas[e].caixa, c, sizeof(h->entradas[e].caixa));
+                }
+            }
+            continue;
+        }
+        for (int cz = a[1]; cz <= a[3]; cz++)
+            for (int cx = a[0]; cx <= a[2]; cx++) removeEntradaHash(baldeHash(cx, cz), v);
+        for (int cz = z0; cz <= z1; cz++)
+            for (int cx = x0; cx <= x1; cx++) insereEntradaHash(baldeHash(cx, cz), v);
+        estatHash.volumesMovidos++;
+    }
+}
+
+// Empurra o circulo (x, z) de raio RAIO_CAMERA para fora dos volumes que cruzam a faixa de
+// altura [base, topo]. Tirar so a componente que entra no volume faz a camera deslizar pela
+// superficie em vez de parar. Um volume em varias celulas da consulta so e tratado na primeira
+// delas (a do seu canto minimo dentro da faixa). Retorna se houve colisao.
+bool resolveColisao(float* x, float* z, float base, float topo) {
+    HashEspacial* h = &hashEspacial;
+    const float r = RAIO_CAMERA;
+    bool colidiu = false;
+    estatHash.volumesColisao = 0;
+    for (int it = 0; it < ITERACOES_COLISAO; it++) {
+        bool empurrou = false;
+        int cx0 = celulaHash(*x - r), cx1 = celulaHash(*x + r);
+        int cz0 = celulaHash(*z - r), cz1 = celulaHash(*z + r);
+        for (int cz = cz0; cz <= cz1; cz++) {
+            for (int cx = cx0; cx <= cx1; cx++) {
+                for (int e = h->balde[baldeHash(cx, cz)]; e >= 0; e = h->entradas[e].proxima) {
+                    const float* c = h->entradas[e].caixa;
+                    estatHash.volumesColisao++;
+                    if (c[4] < base || c[1] > topo) continue;
+                    int px = celulaHash(c[0]), pz = celulaHash(c[2]);
+                    if ((px > cx0 ? px : cx0) != cx || (pz > cz0 ? pz : cz0) != cz) continue;
+
+                    // ponto da caixa (no XZ) mais perto do centro da camera
+                    float qx = *x < c[0] ? c[0] : (*x > c[3] ? c[3] : *x);
+                    float qz = *z < c[2] ? c[2] : (*z > c[5] ? c[5] : *z);
+                    float dx = *x - qx, dz = *z - qz;
+                    float d2 = dx * dx + dz * dz;
+                    if (d2 >= r * r) continue;
+                    if (d2 > 1e-12f) {
+                        float d = sqrtf(d2);
+                        *x = qx + dx / d * r;
+                        *z = qz + dz / d * r;
+                    } else {
+                        // centro dentro da caixa: sai pela face mais proxima
+                        float saidas[4] = { *x - c[0], c[3] - *x, *z - c[2], c[5] - *z };
+                        int f = 0;
+                        for (int k = 1; k < 4; k++) if (saidas[k] < saidas[f]) f = k;
+                        if (f == 0) *x = c[0] - r;
+                        else if (f == 1) *x = c[3] + r;
+                        else if (f == 2) *z = c[2] - r;
+                        else *z = c[5] + r;
+                    }
+                    empurrou = true;
+                }
+            }
+        }
+        if (!empurrou) break;
+        colidiu = true;
+    }
+    return colidiu;
+}
+
+#define PASSO_RAIO_TERRENO 0.5f // o espacamento da grade do terreno; a menor onda do relevo tem 7 m
+
+// Primeiro t em [t0, t1] com o raio abaixo do terreno, ou INFINITY: amostras a cada
+// PASSO_RAIO_TERRENO e bissecao entre a ultima acima e a primeira abaixo. Trechos inteiros
+// acima de ALTURA_MAXIMA_TERRENO nem sao amostrados.
+float raioTerreno(const float o[3], const float d[3], float t0, float t1) {
+    if (o[1] + t0 * d[1] > ALTURA_MAXIMA_TERRENO && o[1] + t1 * d[1] > ALTURA_MAXIMA_TERRENO) return INFINITY;
+    int amostras = (int)ceilf((t1 - t0) / PASSO_RAIO_TERRENO);
+    if (amostras < 1) amostras = 1;
+    float acima = t0;
+    for (int k = 0; k <= amostras; k++) {
+        float t = k == amostras ? t1 : t0 + k * PASSO_RAIO_TERRENO;
+        if (o[1] + t * d[1] > alturaTerreno(o[0] + t * d[0], o[2] + t * d[2])) {
+            acima = t;
+            continue;
+        }
+        if (t == acima) return t; // ja comeca abaixo
+        float abaixo = t;
+        for (int b = 0; b < 8; b++) {
+            float m = (acima + abaixo) * 0.5f;
+            if (o[1] + m * d[1] > alturaTerreno(o[0] + m * d[0], o[2] + m * d[2])) acima = m;
+            else abaixo = m;
+        }
+        return abaixo;
+    }
+    return INFINITY;
+}
+
+// Prop do primeiro volume atingido pelo raio o + t * d (d unitario, t ate maximo), ou -1.
+// O raio percorre as celulas do XZ em ordem (DDA) e para assim que o acerto mais perto ja
+// fica antes da saida da celula atual: os volumes das celulas seguintes estao mais longe.
+// Um volume em varias celulas do caminho e testado de novo em cada uma (da o mesmo t).
+// O terreno tambem para o raio: depois dos volumes da celula, o trecho dela ate o acerto
+// mais perto e marchado contra alturaTerreno, e um morro no caminho corta o raio ali.
+int lancaRaio(const float o[3], const float d[3], float maximo, float* distancia) {
+    HashEspacial* h = &hashEspacial;
+    estatHash.volumesSelecao = 0;
+    estatHash.celulasSelecao = 0;
+
+    int cx = celulaHash(o[0]), cz = celulaHash(o[2]);
+    int passoX = d[0] > 0.0f ? 1 : -1, passoZ = d[2] > 0.0f ? 1 : -1;
+    float proximoX = d[0] != 0.0f ? ((cx + (passoX > 0)) * TAMANHO_CELULA_HASH - o[0]) / d[0] : INFINITY;
+    float proximoZ = d[2] != 0.0f ? ((cz + (passoZ > 0)) * TAMANHO_CELULA_HASH - o[2]) / d[2] : INFINITY;
+    float deltaX = d[0] != 0.0f ? TAMANHO_CELULA_HASH / fabsf(d[0]) : INFINITY;
+    float deltaZ = d[2] != 0.0f ? TAMANHO_CELULA_HASH / fabsf(d[2]) : INFINITY;
+    float inverso[3];
+    for (int k = 0; k < 3; k++) inverso[k] = 1.0f / d[k]; // +-inf num eixo parado: o teste de placas continua valendo
+
+    int melhor = -1;
+    float tMelhor = maximo;
+    float entrada = 0.0f;
+    for (;;) {
+        estatHash.celulasSelecao++;
+        for (int e = h->balde[baldeHash(cx, cz)]; e >= 0; e = h->entradas[e].proxima) {
+            estatHash.volumesSelecao++;
+            // teste das placas: intervalo de t dentro da caixa em cada eixo
+            const float* c = h->entradas[e].caixa;
+            float t0 = 0.0f, t1 = tMelhor;
+            for (int k = 0; k < 3 && t0 <= t1; k++) {
+                float a = (c[k] - o[k]) * inverso[k], bb = (c[3 + k] - o[k]) * inverso[k];
+                if (a != a || bb != bb) { // eixo parado com a origem na face: 0 * inf
+                    if (o[k] < c[k] || o[k] > c[3 + k]) t0 = INFINITY;
+                    continue;
+                }
+                // comparacoes diretas: fminf/fmaxf viram chamadas da libm sem -ffast-math
+                if (a > bb) { float troca = a; a = bb; bb = troca; }
+                if (a > t0) t0 = a;
+                if (bb < t1) t1 = bb;
+            }
+            if (t0 <= t1) {
+                tMelhor = t0;
+                melhor = h->prop[h->entradas[e].volume];
+            }
+        }
+        float saida = proximoX < proximoZ ? proximoX : proximoZ;
+        float chao = raioTerreno(o, d, entrada, saida < tMelhor ? saida : tMelhor);
+        if (chao < tMelhor) {
+            melhor = -1; // o que foi atingido esta atras do morro
+            tMelhor = maximo = chao;
+        }
+        if ((melhor >= 0 && tMelhor <= saida) || saida > maximo) break;
+        entrada = saida;
+        if (proximoX < proximoZ) { cx += passoX; proximoX += deltaX; }
+        else { cz += passoZ; proximoZ += deltaZ; }
+    }
+    if (distancia) *distancia = tMelhor;
+    return melhor;
+}
+
+// Raio do olho pelo centro da tela (a mesma direcao do gluLookAt de display)
+int propNoCentro(float* distancia) {
+    float yawRad = angleYaw * M_PI / 180.0f;
+    float pitchRad = anglePitch * M_PI / 180.0f;
+    float o[3] = { cameraX, cameraY, cameraZ };
+    float d[3] = { sinf(yawRad) * cosf(pitchRad), sinf(pitchRad), -cosf(yawRad) * cosf(pitchRad) };
+    return lancaRaio(o, d, planoLonge, distancia);
+}
+
+// Benchmark: tempo medio (ns) de um passo de colisao de uma caminhada a partir da camera atual
+// (passos de 10 cm na direcao do olhar, deslizando pelo que encontrar, como avancaCamera) e de
+// um raio da camera atual, em leque na horizontal. O leque roda duas vezes: logo depois do
+// frame o llvmpipe deixou os caches frios (selecaoFriaNs), na segunda vez ja estao quentes.
+#define CONSULTAS_MEDIDAS_HASH 64
+
+double medeLequeRaios() {
+    float o[3] = { cameraX, cameraY, cameraZ };
+    double inicio = tempoAtualMs();
+    for (int k = 0; k < CONSULTAS_MEDIDAS_HASH; k++) {
+        float yawRad = (angleYaw + k * (360.0f / CONSULTAS_MEDIDAS_HASH)) * M_PI / 180.0f;
+        float d[3] = { sinf(yawRad), 0.0f, -cosf(yawRad) };
+        lancaRaio(o, d, planoLonge, NULL);
+    }
+    return (tempoAtualMs() - inicio) * 1.0e6 / CONSULTAS_MEDIDAS_HASH;
+}
+
+void medeConsultasHash(double* colisaoNs, double* selecaoFriaNs, double* selecaoNs) {
+    *selecaoFriaNs = medeLequeRaios();
+    *selecaoNs = medeLequeRaios();
+
+    float yawCamera = angleYaw * M_PI / 180.0f;
+    float x = cameraX, z = cameraZ;
+    double inicio = tempoAtualMs();
+    for (int k = 0; k < CONSULTAS_MEDIDAS_HASH; k++) {
+        x += sinf(yawCamera) * 0.1f;
+        z -= cosf(yawCamera) * 0.1f;
+        float chao = alturaTerreno(x, z);
+        resolveColisao(&x, &z, chao + ALTURA_DEGRAU, chao + alturaOlhos + 0.1f);
+    }
+    *colisaoNs = (tempoAtualMs() - inicio) * 1.0e6 / CONSULTAS_MEDIDAS_HASH;
+}
+
+// Clique ou tecla: escolhe o prop no centro da tela (mira do mouse) e imprime
+void selecionaCentro() {
+    float distancia;
+    double inicio = tempoAtualMs();
+    propSelecionado = propNoCentro(&distancia);
+    double us = (tempoAtualMs() - inicio) * 1000.0;
+    if (propSelecionado < 0) {
+        fprintf(stderr, "Selecao: nenhum prop no centro da tela (%d celulas, %.2f us)\n", estatHash.celulasSelecao, us);
+        return;
+    }
+    const float* m = parque.matrizes[propSelecionado];
+    fprintf(stderr, "Selecao: %s %d em (%.1f, %.1f) a %.2f m (%d volumes em %d celulas, %.2f us)\n",
+            nomesTiposProp[parque.tipos[propSelecionado]], propSelecionado, m[12], m[14], distancia,
+            estatHash.volumesSelecao, estatHash.celulasSelecao, us);
+}
+
+// Contorno da caixa do prop escolhido (linhas sem luz, por cima da cena ja desenhada)
+void desenhaSelecao() {
+    if (propSelecionado < 0 || propSelecionado >= parque.numProps) return;
+    const float* c = bvh.caixas[propSelecionado];
+    glMatrixMode(GL_MODELVIEW);
+    glLoadMatrixf(matrizVista);
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glColor3f(1.0f, 0.9f, 0.2f);
+    glBegin(GL_LINES);
+    for (int k = 0; k < 12; k++) {
+        // 4 arestas em cada eixo: os outros dois eixos variam entre min e max
+        int eixo = k / 4, a = (eixo + 1) % 3, b = (eixo + 2) % 3;
+        float p[3];
+        p[a] = c[(k & 1) ? 3 + a : a];
+        p[b] = c[(k & 2) ? 3 + b : b];
+        p[eixo] = c[eixo];
+        glVertex3fv(p);
+        p[eixo] = c[3 + eixo];
+        glVertex3fv(p);
+    }
+    glEnd();
+    glPopAttrib();
+}
+
+// --- IMPOSTORES ---
+// De longe um prop ocupa poucos pixels mas custa a malha inteira. Em init() cada tipo e
+// desenhado de NUM_VISTAS_IMPOSTOR direcoes em volta do eixo Y num atlas (uma celula por tipo
+// e vista): cor sem luz, normal no espaco do prop e profundidade. Alem de distanciaImpostor o
+// prop vira um retangulo virado para a camera (girando so em Y), todos num unico
+// glDrawArraysInstanced: o vertex shader escolhe a vista mais proxima da direcao da camera e o
+// fragment shader ilumina com a normal do atlas (sol e poste, como o shader de instancias).
+// A profundidade e a do plano vertical pelo centro do prop; com --impostor-profundidade cada
+// fragmento recebe a profundidade do atlas (cruza com o terreno e os vizinhos como a malha),
+// mas escrever gl_FragDepth desliga o teste de profundidade antecipado e no llvmpipe o
+// impostor passa a custar mais que a malha que substitui.
+
+#define NUM_VISTAS_IMPOSTOR 8
+#define LADO_CELULA_IMPOSTOR 128
+#define FOLGA_IMPOSTOR 0.05f  // histerese da distancia (como folgaLOD)
+
+typedef struct {
+    GLuint programa;          // 0 se o shader nao compilou (sem impostores)
+    GLint uLuzAtiva;
+    GLint uCorLuminaria;
+    GLint uEmissaoLuminaria;
+    GLint uPosCamera;
+    GLuint texCor, texNormal, texProfundidade;
+    GLuint bufLista;          // indices dos props desenhados como impostor, reenviado a cada frame
+    GLuint* lista;
+    int numLista;
+    GLuint* visiveis;         // o resto da lista de visiveis (mesmas faixas por tipo e nivel)
+    unsigned char* ativo;     // prop desenhado como impostor no ultimo frame (histerese)
+    float volume[NUM_TIPOS_PROP][4]; // centro local da caixa e meia largura (qualquer giro em Y)
+    float meiaAltura[NUM_TIPOS_PROP];
+} Impostores;
+
+Impostores impostores;
+float distanciaImpostor = 40.0f; // --distancia-impostor D (metros; 0 desliga)
+bool usarImpostores = false;     // 'B' liga/desliga (--impostores)
+bool profundidadeImpostor = false; // --impostor-profundidade: profundidade do atlas por fragmento
+
+// Monta o atlas: cor (rgb) e cobertura (a) / normal (rgb) e emissivo (a) / profundidade
+const char* fonteVertexAtlas =
+    "in vec3 posicao;\n"
+    "in vec3 normal;\n"
+    "in vec3 cor;\n"
+    "in float emissivo;\n"
+    "out vec3 corAtlas;\n"
+    "out vec3 normalAtlas;\n"
+    "out float emissivoAtlas;\n"
+    "void main() {\n"
+    "    corAtlas = cor;\n"
+    "    normalAtlas = normal;\n"
+    "    emissivoAtlas = emissivo;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(posicao, 1.0);\n"
+    "}\n";
+
+const char* fonteFragmentAtlas =
+    "in vec3 corAtlas;\n"
+    "in vec3 normalAtlas;\n"
+    "in float emissivoAtlas;\n"
+    "void main() {\n"
+    "    gl_FragData[0] = vec4(corAtlas, 1.0);\n"
+    "    gl_FragData[1] = vec4(normalize(normalAtlas) * 0.5 + 0.5, emissivoAtlas);\n"
+    "}\n";
+
+// Retangulo de cada impostor: os 4 cantos saem de gl_VertexID (GL_TRIANGLE_STRIP)
+const char* fonteVertexImpostor =
+    "in uint indiceInstancia;\n"
+    "uniform samplerBuffer materiaisInstancia;\n"
+    "uniform ivec2 primeiroTipo;      // primeiro prop dos tipos 1 e 2 (o layout e ordenado por tipo)\n"
+    "uniform vec4 volumeTipo[3];      // centro local da caixa e meia largura de cada tipo\n"
+    "uniform float meiaAlturaTipo[3];\n"
+    "uniform int numVistas;\n"
+    "uniform vec3 posCamera;\n"
+    "out vec2 coordAtlas;\n"
+    "out vec3 posVista;\n"
+    "out vec3 paraCamera;             // direcao (vista) do centro para a camera, no plano horizontal\n"
+    "out float meiaProfundidade;      // meia largura no mundo (a celula vai de -ela a +ela em profundidade)\n"
+    "flat out mat3 rotacao;           // prop -> vista (para as normais do atlas)\n"
+    "flat out vec3 tinta;\n"
+    "const float PI = 3.14159265;\n"
+    "void main() {\n"
+    "    int i = int(indiceInstancia);\n"
+    "    int tipo = i >= primeiroTipo.y ? 2 : (i >= primeiroTipo.x ? 1 : 0);\n"
+    "    mat4 modelo = matrizInstancia(i);\n"
+    "    tinta = texelFetch(materiaisInstancia, i).rgb;\n"
+    "    vec4 volume = volumeTipo[tipo];\n"
+    "    float escala = length(modelo[0].xyz);\n"
+    "    vec3 centro = (modelo * vec4(volume.xyz, 1.0)).xyz;\n"
+    "    float largura = volume.w * escala;\n"
+    "    float altura = meiaAlturaTipo[tipo] * escala;\n"
+    "    vec3 d = posCamera - centro;\n"
+    "    d.y = 0.0;\n"
+    "    d = length(d) > 1e-4 ? normalize(d) : vec3(0.0, 0.0, 1.0);\n"
+    "    // vista do atlas mais proxima da direcao da camera no espaco do prop\n"
+    "    vec3 dLocal = transpose(mat3(modelo)) * d;\n"
+    "    float azimute = atan(dLocal.x, dLocal.z);\n"
+    "    int vista = int(floor(azimute / (2.0 * PI) * float(numVistas) + 0.5));\n"
+    "    vista = (vista % numVistas + numVistas) % numVistas;\n"
+    "    vec2 canto = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+    "    vec3 direita = vec3(d.z, 0.0, -d.x);\n"
+    "    vec3 p = centro + (canto.x * 2.0 - 1.0) * largura * direita + (canto.y * 2.0 - 1.0) * altura * vec3(0.0, 1.0, 0.0);\n"
+    "    coordAtlas = (vec2(vista, tipo) + canto) / vec2(numVistas, 3.0);\n"
+    "    posVista = (gl_ModelViewMatrix * vec4(p, 1.0)).xyz;\n"
+    "    paraCamera = mat3(gl_ModelViewMatrix) * d;\n"
+    "    meiaProfundidade = largura;\n"
+    "    rotacao = mat3(gl_ModelViewMatrix) * mat3(modelo) / escala;\n"
+    "    gl_Position = gl_ProjectionMatrix * vec4(posVista, 1.0);\n"
+    "}\n";
+
+// criaImpostores junta o #define PROFUNDIDADE_POR_FRAGMENTO na frente quando pedido
+const char* fonteFragmentImpostor =
+    "in vec2 coordAtlas;\n"
+    "in vec3 posVista;\n"
+    "in vec3 paraCamera;\n"
+    "in float meiaProfundidade;\n"
+    "flat in mat3 rotacao;\n"
+    "flat in vec3 tinta;\n"
+    "uniform sampler2D atlasCor;\n"
+    "uniform sampler2D atlasNormal;\n"
+    "uniform sampler2D atlasProfundidade;\n"
+    "uniform vec2 luzAtiva;\n"
+    "uniform vec3 corLuminaria;\n"
+    "uniform vec3 emissaoLuminaria;\n"
+    "void main() {\n"
+    "    vec4 cor = texture(atlasCor, coordAtlas);\n"
+    "    if (cor.a < 0.5) discard;\n"
+    "    vec4 normal = texture(atlasNormal, coordAtlas);\n"
+    "    vec3 p = posVista;\n"
+    "#ifdef PROFUNDIDADE_POR_FRAGMENTO\n"
+    "    // profundidade do atlas: 0 na frente da caixa, 1 atras (projecao ortografica)\n"
+    "    float z = texture(atlasProfundidade, coordAtlas).r;\n"
+    "    p += paraCamera * (1.0 - 2.0 * z) * meiaProfundidade;\n"
+    "    vec4 clip = gl_ProjectionMatrix * vec4(p, 1.0);\n"
+    "    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;\n"
+    "#endif\n"
+    "    vec3 n = normalize(rotacao * (normal.xyz * 2.0 - 1.0));\n"
+    "    vec3 v = normalize(-p);\n"
+    "    vec3 difusa = cor.rgb * tinta;\n"
+    "    vec3 c = vec3(0.0);\n"
+    "    if (normal.a > 0.5) { difusa = corLuminaria; c = emissaoLuminaria; }\n"
+    "    c += gl_LightModel.ambient.rgb * difusa;\n"
+    "    if (luzAtiva.x > 0.5) c += contribuicaoLuz(0, p, n, v, difusa);\n"
+    "    if (luzAtiva.y > 0.5) c += contribuicaoLuz(1, p, n, v, difusa);\n"
+    "    gl_FragColor = vec4(clamp(c, 0.0, 1.0), 1.0);\n"
+    "}\n";
+
+GLuint criaTexturaAtlas(GLenum formatoInterno, GLenum formato, GLenum tipo, GLenum filtro) {
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, formatoInterno, LADO_CELULA_IMPOSTOR * NUM_VISTAS_IMPOSTOR,
+                 LADO_CELULA_IMPOSTOR * NUM_TIPOS_PROP, 0, formato, tipo, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filtro);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filtro);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return tex;
+}
+
+// Desenha o nivel 0 de cada tipo, de cada direcao, na sua celula do atlas
+void desenhaAtlasImpostores(GLuint programaAtlas) {
+    GLuint fbo;
+    GLint fboAnterior;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fboAnterior);
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, impostores.texCor, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, impostores.texNormal, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, impostores.texProfundidade, 0);
+    static const GLenum saidas[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, saidas);
+
+    glPushAttrib(GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT | GL_ENABLE_BIT);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+    glUseProgram(programaAtlas);
+    for (int a = ATRIB_POSICAO; a <= ATRIB_EMISSIVO; a++) glEnableVertexAttribArray(a);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        const float* c = impostores.volume[t];
+        float r = c[3], h = impostores.meiaAltura[t];
+        ligaMalhaComposta(&malhaProp[t][0]);
+        for (int v = 0; v < NUM_VISTAS_IMPOSTOR; v++) {
+            float azimute = 2.0f * (float)M_PI * v / NUM_VISTAS_IMPOSTOR;
+            glViewport(v * LADO_CELULA_IMPOSTOR, t * LADO_CELULA_IMPOSTOR, LADO_CELULA_IMPOSTOR, LADO_CELULA_IMPOSTOR);
+            glMatrixMode(GL_PROJECTION);
+            glLoadIdentity();
+            glOrtho(-r, r, -h, h, 0.0, 2.0 * r);
+            glMatrixMode(GL_MODELVIEW);
+            glLoadIdentity();
+            gluLookAt(c[0] + sinf(azimute) * r, c[1], c[2] + cosf(azimute) * r, c[0], c[1], c[2], 0.0f, 1.0f, 0.0f);
+            glDrawElements(GL_TRIANGLES, malhaProp[t][0].numIndices, GL_UNSIGNED_INT, (void*)0);
+        }
+    }
+
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+    for (int a = ATRIB_POSICAO; a <= ATRIB_EMISSIVO; a++) glDisableVertexAttribArray(a);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glUseProgram(0);
+    glPopAttrib();
+    glBindFramebuffer(GL_FRAMEBUFFER, fboAnterior);
+    glDeleteFramebuffers(1, &fbo);
+
+    glBindTexture(GL_TEXTURE_2D, impostores.texCor);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, impostores.texNormal);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void criaImpostores() {
+    Impostores* im = &impostores;
+    if (!instancias.programa) {
+        usarImpostores = false;
+        return;
+    }
+    GLuint programaAtlas = criaPrograma(fonteVertexAtlas, fonteFragmentAtlas, atributosInstancia, ATRIB_INDICE_INSTANCIA);
+    char* fonteFragment = malloc(strlen(fonteFragmentImpostor) + 128);
+    sprintf(fonteFragment, "%s%s",
+            profundidadeImpostor ? "#define PROFUNDIDADE_POR_FRAGMENTO\n" : "", fonteFragmentImpostor);
+    im->programa = criaPrograma(fonteVertexImpostor, fonteFragment, atributosInstancia, NUM_ATRIBUTOS);
+    free(fonteFragment);
+    if (!programaAtlas || !im->programa) {
+        fprintf(stderr, "Impostores indisponiveis\n");
+        im->programa = 0;
+        usarImpostores = false;
+        return;
+    }
+
+    // retangulo e celula do atlas justos na caixa local: a largura cobre a caixa vista de qualquer direcao
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        const float* c = caixaTipoProp[t];
+        for (int k = 0; k < 3; k++) im->volume[t][k] = (c[k] + c[3 + k]) * 0.5f;
+        float mx = (c[3] - c[0]) * 0.5f, mz = (c[5] - c[2]) * 0.5f;
+        im->volume[t][3] = sqrtf(mx * mx + mz * mz);
+        im->meiaAltura[t] = (c[4] - c[1]) * 0.5f;
+    }
+
+    im->texCor = criaTexturaAtlas(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_LINEAR);
+    im->texNormal = criaTexturaAtlas(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_LINEAR);
+    im->texProfundidade = criaTexturaAtlas(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, im->texCor);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, im->texNormal);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    desenhaAtlasImpostores(programaAtlas);
+    glDeleteProgram(programaAtlas);
+
+    GLuint p = im->programa;
+    im->uLuzAtiva = glGetUniformLocation(p, "luzAtiva");
+    im->uCorLuminaria = glGetUniformLocation(p, "corLuminaria");
+    im->uEmissaoLuminaria = glGetUniformLocation(p, "emissaoLuminaria");
+    im->uPosCamera = glGetUniformLocation(p, "posCamera");
+    glUseProgram(p);
+    glUniform1i(glGetUniformLocation(p, "matrizesInstancia"), 1);
+    glUniform1i(glGetUniformLocation(p, "materiaisInstancia"), 2);
+    glUniform1i(glGetUniformLocation(p, "atlasCor"), 8); // 3 a 7 sao das luzes agrupadas e das sombras
+    glUniform1i(glGetUniformLocation(p, "atlasNormal"), 9);
+    glUniform1i(glGetUniformLocation(p, "atlasProfundidade"), 10);
+    glUniform1i(glGetUniformLocation(p, "numVistas"), NUM_VISTAS_IMPOSTOR);
+    glUniform2i(glGetUniformLocation(p, "primeiroTipo"), parque.primeiro[1], parque.primeiro[2]);
+    glUniform4fv(glGetUniformLocation(p, "volumeTipo"), NUM_TIPOS_PROP, &im->volume[0][0]);
+    glUniform1fv(glGetUniformLocation(p, "meiaAlturaTipo"), NUM_TIPOS_PROP, im->meiaAltura);
+    glUseProgram(0);
+
+    int n = parque.numProps > 0 ? parque.numProps : 1;
+    glGenBuffers(1, &im->bufLista);
+    im->lista = malloc(sizeof(GLuint) * n);
+    im->visiveis = malloc(sizeof(GLuint) * n);
+    im->ativo = calloc(n, 1);
+}
+
+// O atlas so tem o sol e o poste: com as luzes agrupadas, as sombras ou os mapas de luz os
+// impostores ficariam com outra luz que as malhas em volta, entao eles saem
+bool impostoresAtivos() {
+    return usarImpostores && impostores.programa && distanciaImpostor > 0.0f && !modoImediato
+        && !luzesAgrupadasAtivas() && !sombrasAtivas() && !mapasLuzAtivos();
+}
+
+// Tira de listaVisiveis os props alem de distanciaImpostor e junta-os na lista de impostores
+void separaImpostores() {
+    Impostores* im = &impostores;
+    im->numLista = 0;
+    if (!impostoresAtivos()) return;
+
+    float longe2 = distanciaImpostor * (1.0f + FOLGA_IMPOSTOR);
+    float perto2 = distanciaImpostor * (1.0f - FOLGA_IMPOSTOR);
+    longe2 *= longe2;
+    perto2 *= perto2;
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        int saida = parque.primeiro[t];
+        for (int L = 0; L < NUM_NIVEIS_LOD; L++) {
+            const GLuint* faixa = listaVisiveis + parque.primeiro[t] + inicioNivel[t][L];
+            int inicio = saida;
+            for (int k = 0; k < numVisiveisNivel[t][L]; k++) {
+                int prop = faixa[k];
+                const float* c = bvh.caixas[prop];
+                float dx = (c[0] + c[3]) * 0.5f - cameraX;
+                float dz = (c[2] + c[5]) * 0.5f - cameraZ;
+                float d2 = dx * dx + dz * dz;
+                im->ativo[prop] = im->ativo[prop] ? d2 > perto2 : d2 > longe2;
+                if (im->ativo[prop]) im->lista[im->numLista++] = prop;
+                else im->visiveis[saida++] = prop;
+            }
+            estatLOD.props[L] -= numVisiveisNivel[t][L] - (saida - inicio);
+            inicioNivel[t][L] = inicio - parque.primeiro[t];
+            numVisiveisNivel[t][L] = saida - inicio;
+        }
+        numVisiveis[t] = saida - parque.primeiro[t];
+    }
+    listaVisiveis = im->visiveis;
+}
+
+// Todos os impostores do frame numa chamada so
+void desenhaImpostores() {
+    Impostores* im = &impostores;
+    if (im->numLista == 0) return;
+
+    glUseProgram(im->programa);
+    glUniform2f(im->uLuzAtiva, luzDirecionalLigada ? 1.0f : 0.0f, luzPontualLigada ? 1.0f : 0.0f);
+    glUniform3fv(im->uCorLuminaria, 1, luzPontualLigada ? corLuminariaOn : corLuminariaOff);
+    glUniform3fv(im->uEmissaoLuminaria, 1, luzPontualLigada ? emisOn : emisOff);
+    glUniform3f(im->uPosCamera, cameraX, cameraY, cameraZ);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, instancias.texMatrizes);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_BUFFER, instancias.texMateriais);
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, im->texCor);
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, im->texNormal);
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_2D, im->texProfundidade);
+
+    glBindBuffer(GL_ARRAY_BUFFER, im->bufLista);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * im->numLista, im->lista, GL_STREAM_DRAW);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glEnableVertexAttribArray(ATRIB_INDICE_INSTANCIA);
+    glVertexAttribIPointer(ATRIB_INDICE_INSTANCIA, 1, GL_UNSIGNED_INT, 0, (void*)0);
+    glVertexAttribDivisor(ATRIB_INDICE_INSTANCIA, 1);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, im->numLista);
+    glVertexAttribDivisor(ATRIB_INDICE_INSTANCIA, 0);
+    glDisableVertexAttribArray(ATRIB_INDICE_INSTANCIA);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(0);
+}
+
+// Liga o programa de instancias com os uniforms de luz do frame e os texture buffers do parque
+void iniciaProgramaInstancias() {
+    // cores da luminaria iguais as de desenhaPoste
+    GLfloat corLuminaria[3] = {0.4f, 0.4f, 0.3f};
+    GLfloat emissaoLuminaria[3] = {0.0f, 0.0f, 0.0f};
+    if (luzPontualLigada) {
+        corLuminaria[0] = 1.0f; corLuminaria[1] = 0.9f; corLuminaria[2] = 0.6f;
+        emissaoLuminaria[0] = 0.8f; emissaoLuminaria[1] = 0.7f; emissaoLuminaria[2] = 0.3f;
+    }
+
+    if (luzesAgrupadasAtivas()) {
+        ligaProgramaAgrupado(corLuminaria, emissaoLuminaria);
+    } else if (sombrasAtivas()) {
+        ligaProgramaSombras(corLuminaria, emissaoLuminaria);
+    } else if (mapasLuzAtivos()) {
+        ligaProgramaMapasLuz(corLuminaria, emissaoLuminaria);
+    } else {
+        glUseProgram(instancias.programa);
+        glUniform2f(instancias.uLuzAtiva, luzDirecionalLigada ? 1.0f : 0.0f, luzPontualLigada ? 1.0f : 0.0f);
+        glUniform3fv(instancias.uCorLuminaria, 1, corLuminaria);
+        glUniform3fv(instancias.uEmissaoLuminaria, 1, emissaoLuminaria);
+    }
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, instancias.texMatrizes);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_BUFFER, instancias.texMateriais);
+
+    // o shader usa atributos genericos no lugar de glVertexPointer/glNormalPointer
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    for (int a = ATRIB_POSICAO; a <= ATRIB_EMISSIVO; a++) glEnableVertexAttribArray(a);
+}
+
+void terminaProgramaInstancias() {
+    for (int a = ATRIB_POSICAO; a <= ATRIB_EMISSIVO; a++) glDisableVertexAttribArray(a);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    if (luzesAgrupadasAtivas()) desligaTexturasAgrupadas();
+    else if (sombrasAtivas()) desligaTexturasSombras();
+    else if (mapasLuzAtivos()) desligaTexturasMapasLuz();
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(0);
+}
+
+// Chao pelo programa agrupado (ou pelo das sombras ou dos mapas de luz): os blocos do terreno usam a instancia
+// identidade do fim dos texture buffers, com a cor da grama constante no lugar do atributo por vertice
+void desenhaChaoAgrupado() {
+    iniciaProgramaInstancias();
+    glDisableVertexAttribArray(ATRIB_COR);
+    glDisableVertexAttribArray(ATRIB_EMISSIVO);
+    glVertexAttrib3fv(ATRIB_COR, corGrama);
+    glVertexAttrib1f(ATRIB_EMISSIVO, 0.0f);
+    glVertexAttribI1ui(ATRIB_INDICE_INSTANCIA, parque.numProps);
+    for (int k = 0; k < terreno.numVisiveis; k++) {
+        const Malha* m = &terreno.blocos[terreno.visiveis[k]].malhas[terreno.niveis[k]];
+        glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ibo);
+        glVertexAttribPointer(ATRIB_POSICAO, 3, GL_FLOAT, GL_FALSE, FLOATS_POR_VERTICE * sizeof(float), (void*)0);
+        glVertexAttribPointer(ATRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, FLOATS_POR_VERTICE * sizeof(float), (void*)(3 * sizeof(float)));
+        glDrawElements(GL_TRIANGLES, m->numIndices, GL_UNSIGNED_INT, (void*)0);
+    }
+    terminaProgramaInstancias();
+}
+
+void desenhaPropsInstanciados() {
+    iniciaProgramaInstancias();
+
+    // lista de visiveis do frame (buffer orfao a cada frame para nao esperar o uso anterior)
+    glBindBuffer(GL_ARRAY_BUFFER, instancias.bufVisiveis);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * parque.numProps, NULL, GL_STREAM_DRAW);
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        if (numVisiveis[t] == 0) continue;
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(GLuint) * parque.primeiro[t], sizeof(GLuint) * numVisiveis[t],
+                        listaVisiveis + parque.primeiro[t]);
+    }
+    glEnableVertexAttribArray(ATRIB_INDICE_INSTANCIA);
+    glVertexAttribDivisor(ATRIB_INDICE_INSTANCIA, 1);
+
+    // uma chamada por tipo e nivel de LOD
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        perfilInicio(FASE_BANCO + t);
+        for (int L = 0; L < NUM_NIVEIS_LOD; L++) {
+            if (numVisiveisNivel[t][L] == 0) continue;
+            glBindBuffer(GL_ARRAY_BUFFER, instancias.bufVisiveis);
+            glVertexAttribIPointer(ATRIB_INDICE_INSTANCIA, 1, GL_UNSIGNED_INT, 0,
+                                   (void*)(sizeof(GLuint) * (parque.primeiro[t] + inicioNivel[t][L])));
+            ligaMalhaComposta(&malhaProp[t][L]);
+            glDrawElementsInstanced(GL_TRIANGLES, malhaProp[t][L].numIndices, GL_UNSIGNED_INT, (void*)0, numVisiveisNivel[t][L]);
+        }
+        perfilFim(FASE_BANCO + t);
+    }
+
+    glVertexAttribDivisor(ATRIB_INDICE_INSTANCIA, 0);
+    glDisableVertexAttribArray(ATRIB_INDICE_INSTANCIA);
+    terminaProgramaInstancias();
+}
+
+// Conta os vertices enviados no frame (e quantos seriam sem LOD)
+void contaVerticesLOD() {
+    estatLOD.vertices = 0;
+    estatLOD.verticesSemLOD = 0;
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        for (int L = 0; L < NUM_NIVEIS_LOD; L++) {
+            estatLOD.vertices += (long)numVisiveisNivel[t][L] * malhaProp[t][L].numVertices;
+        }
+        estatLOD.verticesSemLOD += (long)numVisiveis[t] * malhaProp[t][0].numVertices;
+    }
+    // impostores: 4 vertices cada (sem eles seria a malha do nivel 0)
+    estatLOD.vertices += 4L * impostores.numLista;
+    for (int k = 0; k < impostores.numLista; k++) {
+        estatLOD.verticesSemLOD += malhaProp[parque.tipos[impostores.lista[k]]][0].numVertices;
+    }
+}
+
+// Desenha os props visiveis do layout: instanciado (uma chamada por tipo e nivel) ou prop a prop
+void desenhaProps() {
+    perfilInicio(FASE_CULLING);
+    if (travessiaAtiva()) usaListaTravessia();
+    else {
+        cullingFrustum();
+        selecionaLOD();
+    }
+    filtraOclusao(); // folhas que as consultas do frame anterior acharam ocultas
+    separaImpostores();
+    contaVerticesLOD();
+    perfilFim(FASE_CULLING);
+
+    // o caminho agrupado, o das sombras e o dos mapas de luz sao sempre instanciados (o prop a prop usa a iluminacao do pipeline fixo)
+    if ((usarInstancias || luzesAgrupadasAtivas() || sombrasAtivas() || mapasLuzAtivos()) && !modoImediato) {
+        desenhaPropsInstanciados();
+        return;
+    }
+
+    // prop a prop: as partes de cada prop com as primitivas do nivel escolhido, cada uma com a
+    // matriz de mundo da hierarquia (o modo imediato ainda monta a pilha de matrizes a cada frame)
+    int ultimoNivelPartes = (modoImediato || !instancias.programa) ? NUM_NIVEIS_LOD - 1 : NUM_NIVEIS_LOD - 2;
+    glMatrixMode(GL_MODELVIEW);
+    for (int t = 0; t < NUM_TIPOS_PROP; t++) {
+        perfilInicio(FASE_BANCO + t);
+        for (int L = 0; L <= ultimoNivelPartes; L++) {
+            nivelLODAtual = L;
+            for (int k = 0; k < numVisiveisNivel[t][L]; k++) {
+                int i = listaVisiveis[parque.primeiro[t] + inicioNivel[t][L] + k];
+                memcpy(tintaAtual, parque.materiais[i], sizeof(tintaAtual));
+                if (!modoImediato) {
+                    desenhaPartesProp(i, L);
+                    continue;
+                }
+                glPushMatrix();
+                    glMultMatrixf(parque.matrizes[i]);
+                    desenhaTipoProp[t]();
+                glPopMatrix();
+            }
+        }
+        if (!modoImediato) glLoadMatrixf(matrizVista);
+        nivelLODAtual = 0;
+        tintaAtual[0] = tintaAtual[1] = tintaAtual[2] = tintaAtual[3] = 1.0f;
+
+        // no nivel mais baixo as partes ja estao juntas numa malha so: um glDrawElements por prop
+        int L = NUM_NIVEIS_LOD - 1;
+        if (ultimoNivelPartes < L && numVisiveisNivel[t][L] > 0) {
+            iniciaProgramaInstancias();
+            ligaMalhaComposta(&malhaProp[t][L]);
+            for (int k = 0; k < numVisiveisNivel[t][L]; k++) {
+                glVertexAttribI1ui(ATRIB_INDICE_INSTANCIA, listaVisiveis[parque.primeiro[t] + inicioNivel[t][L] + k]);
+                glDrawElements(GL_TRIANGLES, malhaProp[t][L].numIndices, GL_UNSIGNED_INT, (void*)0);
+            }
+            terminaProgramaInstancias();
+        }
+        perfilFim(FASE_BANCO + t);
+    }
+}
+
+void configuraIluminacao() {
+    // Esta função configura a iluminação mesmo quando as luzes estão desligadas
+
+    // --- LUZ AMBIENTE GERAL (Escuro de Entardecer) ---
+
+    // Define um nivel mais baixo de luz para que ambiente seja viivel, nao 100% preto
+    GLfloat luzAmbienteGlobal[] = {0.05f, 0.05f, 0.07f, 1.0f}; // tom azulado escuro
+    glLightModelfv(GL_LIGHT_MODEL_AMBIENT, luzAmbienteGlobal);
+
+    // Habilita a atenuação de luz especular (mais realista)
+    glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, GL_TRUE);
+
+
+    // --- LUZ DIRECIONAL - SOL POENTE (GL_LIGHT0) ---
+    // simula o por do sol
 
     // cor do sol: laranja/amarelo
     GLfloat corSolDifusa[] = {0.8f, 0.4f, 0.1f, 1.0f};
     GLfloat corSolAmbiente[] = {0.2f, 0.1f, 0.05f, 1.0f};
     GLfloat corSolEspecular[] = {1.0f, 0.6f, 0.3f, 1.0f};
 
-    // W=0.0 -> luz direcional
-    GLfloat posSol[] = {3.0f, 3.0f, 3.0f, 0.0f};
+    // W=0.0 -> luz direcional (posSol, global)
+
+    glLightfv(GL_LIGHT0, GL_AMBIENT, corSolAmbiente); //define propriedade da cor do sol
+    glLightfv(GL_LIGHT0, GL_DIFFUSE, corSolDifusa);
+    glLightfv(GL_LIGHT0, GL_SPECULAR, corSolEspecular);
+    glLightfv(GL_LIGHT0, GL_POSITION, posSol);
+
+
+    // --- LUZ PONTUAL - POSTE (GL_LIGHT1) ---
+    // simula a lampada no topo do poste
+
+
+    // cor do poste: branco quente (difusa) e posicao pontual
+    GLfloat corPosteDifusa[] = {1.2f, 1.05f, 0.85f, 1.0f}; // levemente mais forte para iluminar o chao
+    GLfloat corPosteAmbiente[] = {0.02f, 0.02f, 0.02f, 1.0f};
+    GLfloat corPosteEspecular[] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+    // W=1.0 -> luz pontual (posPoste, global)
+
+    glLightfv(GL_LIGHT1, GL_AMBIENT, corPosteAmbiente); //define a propriedade da luz do poste 
+    glLightfv(GL_LIGHT1, GL_DIFFUSE, corPosteDifusa);
+    glLightfv(GL_LIGHT1, GL_SPECULAR, corPosteEspecular);
+    glLightfv(GL_LIGHT1, GL_POSITION, posPoste);
+
+    // Atenuacao da luz pontual ajustada para melhor pool de luz no chao
+    // diminuimos o termo quadratico e linear para ampliar o alcance perceptivel
+    glLightf(GL_LIGHT1, GL_CONSTANT_ATTENUATION, 0.8f); //diminui intensidade base
+    glLightf(GL_LIGHT1, GL_LINEAR_ATTENUATION, 0.03f);
+    glLightf(GL_LIGHT1, GL_QUADRATIC_ATTENUATION, 0.005f); // faz a luz sumir de maneira suave
+}
+
+void drawCena() {
+    // Função que desenha todos os objetos da cena
+    // Chamada a cada frame para renderizar a cena completa
+    // mapas de sombra invalidos sao refeitos antes de tudo (nos outros frames nao custa nada)
+    perfilInicio(FASE_SOMBRAS);
+    atualizaSombras();
+    perfilFim(FASE_SOMBRAS);
+
+    if (!modoImediato) iniciaDesenhoMalhas();
+    iniciaFila();
+
+    perfilInicio(FASE_LUZES);
+    atribuiLuzesClusters(); // listas de luzes por cluster (so no caminho agrupado)
+    perfilFim(FASE_LUZES);
+
+    perfilInicio(FASE_CHAO);
+    atualizaTerreno(ENVIOS_TERRENO_POR_QUADRO);
+    selecionaBlocosTerreno();
+    if (luzesAgrupadasAtivas() || sombrasAtivas() || mapasLuzAtivos()) desenhaChaoAgrupado();
+    else desenhaChao();      // Desenha o chão gramado
+    perfilFim(FASE_CHAO);
+    executaFila();
+    desenhaProps();     // Desenha os bancos, postes e arvores do layout do parque
+
+    // props distantes: um retangulo com a imagem do atlas, todos numa chamada
+    perfilInicio(FASE_IMPOSTORES);
+    desenhaImpostores();
+    perfilFim(FASE_IMPOSTORES);
+
+    // as malhas enviadas acima sao desenhadas aqui, ordenadas por material (cada lote conta
+    // na fase que o enviou; a fase fila fica so com a ordenacao)
+    terminaFila();
+
+    // caixas das folhas contra a profundidade ja pronta; as respostas valem no proximo frame
+    perfilInicio(FASE_OCLUSAO);
+    emiteConsultasOclusao();
+    perfilFim(FASE_OCLUSAO);
+
+    if (!modoImediato) terminaDesenhoMalhas();
+
+    desenhaSelecao(); // contorno do prop escolhido pelo clique
+}
+
+// --- RESOLUCAO DINAMICA ---
+// Com um orcamento de tempo por frame (--resolucao-dinamica MS ou tecla 'R'), a cena e desenhada
+// num FBO do tamanho da janela, mas so numa area escala x janela dele (viewport e tesoura), e
+// depois ampliada para a janela por um retangulo com um shader de nitidez. A escala segue o
+// tempo dos frames: o custo do llvmpipe cresce com os pixels (escala^2), entao a escala alvo e
+// escala * sqrt(orcamento / tempo filtrado), com uma faixa morta para nao oscilar. Na escala 1
+// a cena vai direto para a janela (sem FBO nem passo extra). As ultimas escalas ficam num
+// historico circular (HUD, tecla 'C', CSV do perfil e JSON do benchmark).
+
+#define ESCALA_MINIMA 0.35f
+#define PASSOS_ESCALA 64.0f          // escala arredondada em 1/64 (a area nao muda a cada frame)
+#define SUAVIZACAO_TEMPO_QUADRO 0.25 // media movel do tempo dos frames
+#define FOLGA_ESCALA 0.1             // so aumenta com 10% de sobra no orcamento
+#define TAMANHO_HISTORICO_ESCALA 256
+
+typedef struct {
+    GLuint programa;
+    GLint uEscalaUV, uTamanho, uLimite, uNitidez;
+    GLuint fbo, texCor, rbProfundidade;
+    int largura, altura;        // tamanho alocado (o da janela)
+    GLint fboDestino;           // janela ou FBO do modo headless
+    bool desenhandoNoFBO;       // o frame atual foi para o FBO reduzido
+    double tempoFiltrado;       // ms
+    float historico[TAMANHO_HISTORICO_ESCALA];
+    float historicoMs[TAMANHO_HISTORICO_ESCALA];
+    int posHistorico, numHistorico;
+} ResolucaoDinamica;
+
+ResolucaoDinamica resolucao;
+float orcamentoQuadroMs = 16.6f;    // --resolucao-dinamica MS
+float nitidezAmpliacao = 0.6f;      // --nitidez K: forca do realce na menor escala (0 = so bilinear)
+
+const char* fonteVertexAmpliacao =
+    "out vec2 coord;\n"
+    "void main() {\n"
+    "    vec2 canto = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+    "    coord = canto;\n"
+    "    gl_Position = vec4(canto * 2.0 - 1.0, 0.0, 1.0);\n"
+    "}\n";
+
+// Amplia com o filtro bilinear e realca pela diferenca para os 4 texels vizinhos (mascara de
+// nitidez), limitado ao minimo e maximo da vizinhanca para nao criar halos nas bordas. Os
+// vizinhos sao lidos com texelFetch (sem filtro), bem mais barato no llvmpipe que 5 texture().
+const char* fonteFragmentAmpliacao =
+    "in vec2 coord;\n"
+    "uniform sampler2D cena;\n"
+    "uniform vec2 escalaUV;           // parte usada da textura\n"
+    "uniform vec2 tamanho;            // tamanho da textura em texels\n"
+    "uniform ivec2 limite;            // ultimo texel da parte usada\n"
+    "uniform float nitidez;\n"
+    "void main() {\n"
+    "    vec2 p = min(coord * escalaUV, (vec2(limite) + 0.5) / tamanho); // sem puxar o texel de fora\n"
+    "    vec3 c = texture(cena, p).rgb;\n"
+    "    ivec2 t = ivec2(p * tamanho);\n"
+    "    vec3 n = texelFetch(cena, min(t + ivec2(0, 1), limite), 0).rgb;\n"
+    "    vec3 s = texelFetch(cena, max(t - ivec2(0, 1), ivec2(0)), 0).rgb;\n"
+    "    vec3 l = texelFetch(cena, min(t + ivec2(1, 0), limite), 0).rgb;\n"
+    "    vec3 o = texelFetch(cena, max(t - ivec2(1, 0), ivec2(0)), 0).rgb;\n"
+    "    vec3 minimo = min(c, min(min(n, s), min(l, o)));\n"
+    "    vec3 maximo = max(c, max(max(n, s), max(l, o)));\n"
+    "    vec3 realce = c + nitidez * (c - (n + s + l + o) * 0.25);\n"
+    "    gl_FragColor = vec4(clamp(realce, minimo, maximo), 1.0);\n"
+    "}\n";
+
+void criaResolucaoDinamica() {
+    ResolucaoDinamica* r = &resolucao;
+    r->programa = criaPrograma(fonteVertexAmpliacao, fonteFragmentAmpliacao, NULL, 0);
+    if (!r->programa) {
+        fprintf(stderr, "Resolucao dinamica indisponivel (shader de ampliacao)\n");
+        usarResolucaoDinamica = false;
+        return;
+    }
+    glUseProgram(r->programa);
+    glUniform1i(glGetUniformLocation(r->programa, "cena"), 0);
+    r->uEscalaUV = glGetUniformLocation(r->programa, "escalaUV");
+    r->uTamanho = glGetUniformLocation(r->programa, "tamanho");
+    r->uLimite = glGetUniformLocation(r->programa, "limite");
+    r->uNitidez = glGetUniformLocation(r->programa, "nitidez");
+    glUseProgram(0);
+
+    glGenFramebuffers(1, &r->fbo);
+    glGenTextures(1, &r->texCor);
+    glGenRenderbuffers(1, &r->rbProfundidade);
+    r->largura = r->altura = 0;
+    escalaRender = 1.0f;
+    r->tempoFiltrado = 0.0;
+}
+
+// Cor e profundidade do tamanho da janela (chamada quando a janela muda)
+void alocaFBOResolucao(int largura, int altura) {
+    ResolucaoDinamica* r = &resolucao;
+    glBindTexture(GL_TEXTURE_2D, r->texCor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, largura, altura, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, r->rbProfundidade);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, largura, altura);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    GLint fboAnterior;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fboAnterior);
+    glBindFramebuffer(GL_FRAMEBUFFER, r->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, r->texCor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, r->rbProfundidade);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "FBO da resolucao dinamica incompleto\n");
+        usarResolucaoDinamica = false;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, fboAnterior);
+    r->largura = largura;
+    r->altura = altura;
+}
+
+// Inicio do frame: escolhe onde a cena e desenhada (FBO reduzido ou a janela) e limpa so a
+// area usada (a tesoura fica ligada para o glClear de display, que a desliga em seguida)
+void iniciaResolucaoDinamica() {
+    ResolucaoDinamica* r = &resolucao;
+    r->desenhandoNoFBO = usarResolucaoDinamica && r->programa && escalaRender < 1.0f;
+    if (!r->desenhandoNoFBO) {
+        larguraRender = windowWidth;
+        alturaRender = windowHeight;
+        return;
+    }
+    if (r->largura != windowWidth || r->altura != windowHeight) alocaFBOResolucao(windowWidth, windowHeight);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &r->fboDestino);
+    larguraRender = (int)(windowWidth * escalaRender + 0.5f);
+    alturaRender = (int)(windowHeight * escalaRender + 0.5f);
+    glBindFramebuffer(GL_FRAMEBUFFER, r->fbo);
+    glViewport(0, 0, larguraRender, alturaRender);
+    glScissor(0, 0, larguraRender, alturaRender);
+    glEnable(GL_SCISSOR_TEST);
+}
+
+// Depois da cena: amplia a area usada do FBO para a janela com o shader de nitidez
+void ampliaResolucaoDinamica() {
+    ResolucaoDinamica* r = &resolucao;
+    if (!r->desenhandoNoFBO) return;
+    glBindFramebuffer(GL_FRAMEBUFFER, r->fboDestino);
+    glViewport(0, 0, windowWidth, windowHeight);
+
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_LIGHTING);
+    glUseProgram(r->programa);
+    glUniform2f(r->uEscalaUV, (float)larguraRender / r->largura, (float)alturaRender / r->altura);
+    glUniform2f(r->uTamanho, (float)r->largura, (float)r->altura);
+    glUniform2i(r->uLimite, larguraRender - 1, alturaRender - 1);
+    // na escala 1 seria uma copia: o realce cresce conforme a escala cai
+    glUniform1f(r->uNitidez, nitidezAmpliacao * (1.0f - escalaRender) / (1.0f - ESCALA_MINIMA));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, r->texCor);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+    glPopAttrib();
+
+    larguraRender = windowWidth;
+    alturaRender = windowHeight;
+}
+
+// Fim do frame: guarda a escala usada no historico e escolhe a do proximo frame
+void ajustaResolucaoDinamica(double ms) {
+    ResolucaoDinamica* r = &resolucao;
+    r->historico[r->posHistorico] = escalaRender;
+    r->historicoMs[r->posHistorico] = (float)ms;
+    r->posHistorico = (r->posHistorico + 1) % TAMANHO_HISTORICO_ESCALA;
+    if (r->numHistorico < TAMANHO_HISTORICO_ESCALA) r->numHistorico++;
+
+    if (!usarResolucaoDinamica || !r->programa) {
+        escalaRender = 1.0f;
+        r->tempoFiltrado = 0.0;
+        return;
+    }
+    if (r->tempoFiltrado <= 0.0) r->tempoFiltrado = ms;
+    else r->tempoFiltrado += (ms - r->tempoFiltrado) * SUAVIZACAO_TEMPO_QUADRO;
+
+    // acima do orcamento reduz logo; abaixo so aumenta com folga (faixa morta contra oscilacao)
+    double razao = orcamentoQuadroMs / r->tempoFiltrado;
+    if (razao >= 1.0 && razao <= 1.0 + FOLGA_ESCALA) return;
+    float alvo = escalaRender * sqrtf((float)razao);
+    float escala = escalaRender + (alvo - escalaRender) * 0.5f;
+    escala = roundf(escala * PASSOS_ESCALA) / PASSOS_ESCALA;
+    if (escala < ESCALA_MINIMA) escala = ESCALA_MINIMA;
+    if (escala > 1.0f) escala = 1.0f;
+    escalaRender = escala;
+}
+
+// Minimo, media e maximo das ultimas n escalas do historico
+void resumoHistoricoEscala(int n, float* minimo, float* media, float* maximo) {
+    ResolucaoDinamica* r = &resolucao;
+    if (n > r->numHistorico) n = r->numHistorico;
+    *minimo = *maximo = *media = escalaRender;
+    if (n == 0) return;
+    double soma = 0.0;
+    *minimo = 1.0f;
+    *maximo = 0.0f;
+    for (int k = 1; k <= n; k++) {
+        float e = r->historico[(r->posHistorico - k + TAMANHO_HISTORICO_ESCALA) % TAMANHO_HISTORICO_ESCALA];
+        soma += e;
+        *minimo = fminf(*minimo, e);
+        *maximo = fmaxf(*maximo, e);
+    }
+    *media = (float)(soma / n);
+}
+
+// Linha do HUD com a escala e, abaixo dela, o grafico do historico: escala (amarelo) e
+// tempo do frame em relacao a duas vezes o orcamento (ciano; o meio do grafico e o orcamento)
+void desenhaHUDResolucao(int x, int y) {
+    ResolucaoDinamica* r = &resolucao;
+    char linha[128];
+    float minimo, media, maximo;
+    resumoHistoricoEscala(TAMANHO_HISTORICO_ESCALA, &minimo, &media, &maximo);
+    if (usarResolucaoDinamica) {
+        snprintf(linha, sizeof(linha), "escala %.3f (%dx%d)  min %.2f max %.2f  orcamento %.1f ms", escalaRender,
+                 (int)(windowWidth * escalaRender + 0.5f), (int)(windowHeight * escalaRender + 0.5f),
+                 minimo, maximo, orcamentoQuadroMs);
+    } else {
+        snprintf(linha, sizeof(linha), "resolucao dinamica desligada ('R')");
+    }
+    escreveTexto(x, y, linha);
+
+    int n = r->numHistorico;
+    if (n < 2 || !usarResolucaoDinamica) return;
+    int largura = TAMANHO_HISTORICO_ESCALA, altura = 50;
+    y -= altura + 8;
+    glColor3f(0.4f, 0.4f, 0.4f);
+    glBegin(GL_LINE_LOOP);
+    glVertex2i(x, y); glVertex2i(x + largura, y); glVertex2i(x + largura, y + altura); glVertex2i(x, y + altura);
+    glEnd();
+    for (int serie = 0; serie < 2; serie++) {
+        if (serie == 0) glColor3f(1.0f, 1.0f, 0.3f);
+        else glColor3f(0.3f, 0.9f, 1.0f);
+        glBegin(GL_LINE_STRIP);
+        for (int k = 0; k < n; k++) {
+            int i = (r->posHistorico - n + k + TAMANHO_HISTORICO_ESCALA) % TAMANHO_HISTORICO_ESCALA;
+            float v = serie == 0 ? r->historico[i] : r->historicoMs[i] / (2.0f * orcamentoQuadroMs);
+            glVertex2f(x + (float)k * largura / (TAMANHO_HISTORICO_ESCALA - 1), y + fminf(v, 1.0f) * altura);
+        }
+        glEnd();
+    }
+    glColor3f(1.0f, 1.0f, 0.6f);
+}
+
+// --- ESCALONADOR DE FRAMES ---
+// Os eventos de entrada nao desenham mais nada: o mouse acumula o deslocamento e as setas
+// so marcam a tecla (sem a repeticao automatica do sistema). O laco ocioso do GLUT aplica
+// a entrada uma vez por frame, avanca a camera em passos fixos de PASSO_SIMULACAO e desenha
+// a posicao interpolada entre os dois ultimos passos, respeitando o limite de fps (--fps)
+// ou o vsync (--vsync). Sem tecla pressionada, HUD ou bloco de terreno chegando, o laco
+// se desliga (glutIdleFunc(NULL)) e a janela fica parada ate o proximo evento. O tempo vem de
+// relogioEscalonador, que a gravacao da entrada quantiza para a reproducao repetir os passos.
+
+#define PASSO_SIMULACAO (1.0 / 120.0) // s
+#define MAX_PASSOS_POR_QUADRO 12      // depois de uma pausa longa descarta o atraso em vez de simular tudo
+
+enum { SETA_FRENTE, SETA_TRAS, SETA_ESQUERDA, SETA_DIREITA, NUM_SETAS };
+
+typedef struct {
+    float anterior[3], atual[3]; // posicao da camera nos dois ultimos passos da simulacao
+    double acumulador;           // tempo real ainda nao simulado (s)
+    double ultimoTempo;          // ms do ultimo frame (relogioEscalonador)
+    double proximoQuadro;        // ms em que o proximo frame pode comecar (limite de fps)
+    bool ativo;                  // laco ocioso registrado no GLUT
+} Escalonador;
+
+typedef struct {
+    long eventos;  // eventos de entrada recebidos (mouse, teclado, setas)
+    long quadros;  // frames desenhados
+    long passos;   // passos fixos da simulacao
+} EstatisticasEscalonador;
+
+Escalonador escalonador;
+EstatisticasEscalonador estatEscalonador;
+bool setas[NUM_SETAS];          // setas pressionadas
+float velocidadeCamera = 6.0f;  // m/s com a seta pressionada (antes: 0.5 por repeticao de tecla)
+int limiteFPS = 60;             // --fps N (0 = sem limite)
+bool usarVsync = false;         // --vsync: troca de buffers sincronizada com o monitor
+
+void quadroEscalonado();
+
+// Religa o laco de frames (chamado por todo evento de entrada e pela exposicao da janela)
+void acordaEscalonador() {
+    estatEscalonador.eventos++;
+    if (escalonador.ativo || modoHeadless || reproducaoAtiva()) return; // reproduzindo, o log diz quando religar
+    escalonador.ativo = true;
+    escalonador.ultimoTempo = relogioEscalonador(); // o tempo parado nao vira passos de simulacao
+    escalonador.acumulador = 0.0;
+    gravaAcordaEntrada();
+    glutIdleFunc(quadroEscalonado);
+}
+
+// Um passo fixo da camera: anda na direcao do olhar conforme as setas pressionadas
+void avancaCamera(float dt) {
+    float moveSpeed = velocidadeCamera * dt; // distancia percorrida neste passo
+    
+    // converte angulos para radianos
+    float yawRad = angleYaw * M_PI / 180.0f;
+    
+    // Pitch e ignorado pois se o user olhasse para o chao e apertasse para frente, ele iria para baixo
+    // Direção frontal 
+    float dirX = sin(yawRad); //cria seta invisivel que aponta para frente da camera
+    float dirZ = -cos(yawRad);
+    
+    // Direção para a direita (perpendicular à frente)
+    float rightX = cos(yawRad); // cria seta invisivel que aponta para a direita da camera. permitindo movimento lateral
+    float rightZ = sin(yawRad);
+    
+    float* p = escalonador.atual;
+    memcpy(escalonador.anterior, p, sizeof(escalonador.anterior));
+    if (setas[SETA_FRENTE]) { p[0] += dirX * moveSpeed; p[2] += dirZ * moveSpeed; }     // soma o vetor frente
+    if (setas[SETA_TRAS]) { p[0] -= dirX * moveSpeed; p[2] -= dirZ * moveSpeed; }       // subtrai o vetor frente
+    if (setas[SETA_ESQUERDA]) { p[0] -= rightX * moveSpeed; p[2] -= rightZ * moveSpeed; } // subtrai o vetor direita
+    if (setas[SETA_DIREITA]) { p[0] += rightX * moveSpeed; p[2] += rightZ * moveSpeed; }  // soma o vetor direita
+
+    // o corpo da camera (do degrau ate um pouco acima dos olhos) desliza pelos props que encosta
+    if (usarColisao) {
+        float chao = alturaTerreno(p[0], p[2]);
+        resolveColisao(&p[0], &p[2], chao + ALTURA_DEGRAU, chao + alturaOlhos + 0.1f);
+    }
+
+    // a camera anda sobre o terreno
+    p[1] = alturaTerreno(p[0], p[2]) + alturaOlhos;
+}
+
+// Liga o vsync pela extensao GLX disponivel (MESA, EXT ou SGI)
+void configuraVsync(int intervalo) {
+    typedef int (*TrocaIntervaloMESA)(unsigned int);
+    typedef void (*TrocaIntervaloEXT)(Display*, GLXDrawable, int);
+    typedef int (*TrocaIntervaloSGI)(int);
+    TrocaIntervaloMESA mesa = (TrocaIntervaloMESA)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalMESA");
+    TrocaIntervaloEXT ext = (TrocaIntervaloEXT)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalEXT");
+    TrocaIntervaloSGI sgi = (TrocaIntervaloSGI)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalSGI");
+    if (mesa) mesa(intervalo);
+    else if (ext) ext(glXGetCurrentDisplay(), glXGetCurrentDrawable(), intervalo);
+    else if (sgi) sgi(intervalo);
+    else fprintf(stderr, "Vsync indisponivel (sem glXSwapInterval*)\n");
+}
+
+void iniciaEscalonador() {
+    glutIgnoreKeyRepeat(1); // soltar a tecla chega por specialKeysUp; a repeticao do sistema e ignorada
+    if (usarVsync) configuraVsync(1);
+    float inicial[3] = { cameraX, cameraY, cameraZ };
+    memcpy(escalonador.anterior, inicial, sizeof(inicial));
+    memcpy(escalonador.atual, inicial, sizeof(inicial));
+    escalonador.proximoQuadro = relogioEscalonador();
+    acordaEscalonador();
+}
+
+// Aplica a entrada acumulada, simula ate o instante agora e interpola a camera do frame
+void simulaQuadro(double agora) {
+    Escalonador* e = &escalonador;
+    e->acumulador += (agora - e->ultimoTempo) / 1000.0;
+    e->ultimoTempo = agora;
+
+    aplicaMouse();
+    int passos = 0;
+    while (e->acumulador >= PASSO_SIMULACAO) {
+        if (passos == MAX_PASSOS_POR_QUADRO) {
+            e->acumulador = 0.0;
+            break;
+        }
+        avancaCamera(PASSO_SIMULACAO);
+        e->acumulador -= PASSO_SIMULACAO;
+        passos++;
+    }
+    estatEscalonador.passos += passos;
+
+    // desenha entre o passo anterior e o atual, na fracao do passo que ja passou
+    float alfa = (float)(e->acumulador / PASSO_SIMULACAO);
+    cameraX = e->anterior[0] + (e->atual[0] - e->anterior[0]) * alfa;
+    cameraY = e->anterior[1] + (e->atual[1] - e->anterior[1]) * alfa;
+    cameraZ = e->anterior[2] + (e->atual[2] - e->anterior[2]) * alfa;
+}
+
+// Laco ocioso: espera o horario do frame, aplica a entrada acumulada, simula e desenha
+void quadroEscalonado() {
+    Escalonador* e = &escalonador;
+    double agora = relogioEscalonador();
+    if (limiteFPS > 0) {
+        if (agora < e->proximoQuadro) {
+            usleep((useconds_t)((e->proximoQuadro - agora) * 1000.0)); // os eventos que chegarem esperam o frame
+            return;
+        }
+        e->proximoQuadro += 1000.0 / limiteFPS;
+        if (e->proximoQuadro < agora) e->proximoQuadro = agora; // atrasado: nao tenta compensar com frames seguidos
+    }
+
+    gravaQuadroEntrada(); // instante e escala deste frame, para a reproducao
+    simulaQuadro(agora);
+    display();
+    estatEscalonador.quadros++;
+
+    // continua enquanto a camera anda, o HUD mede os frames, o layout e editado, a oclusao ainda
+    // muda com as respostas, a captura grava ou o terreno ainda esta chegando
+    bool andando = memcmp(e->anterior, e->atual, sizeof(e->atual)) != 0;
+    for (int i = 0; i < NUM_SETAS; i++) andando = andando || setas[i];
+    if (!andando && !mostrarHUD && edicoesPorQuadro == 0 && !oclusaoAcomodando() && !capturaPendente() && estatTerreno.pendentes == 0 && !travessiaDesatualizada()) {
+        e->ativo = false;
+        glutIdleFunc(NULL);
+    }
+}
+
+// Exposicao e redimensionamento da janela: o proximo frame sai pelo escalonador
+void redesenhaJanela() {
+    acordaEscalonador();
+}
+
+// --- CAPTURA DE FRAMES ---
+// Gravacao de video e fotos sem travar o frame: o glReadPixels vai para um anel de pixel
+// buffer objects (PBOs) e so volta para a CPU NUM_PBOS_CAPTURA - 1 frames depois, quando a
+// GPU ja terminou aquele frame. A copia mapeada vai para uma fila de quadros e uma thread
+// escritora converte (Y4M, PPM em sequencia ou RGB cru) e grava no arquivo ou pipe. Se a
+// escritora ficar para tras o quadro e descartado (e contado) em vez de segurar o desenho; o
+// video nao marca o buraco, so fica mais curto.
+// O video tem tamanho fixo, entao redimensionar a janela fecha a gravacao. Se ela for retomada
+// depois, o arquivo continua num segmento numerado (video.y4m -> video_001.y4m) em vez de
+// truncar o que ja foi gravado; saida padrao e pipe nao podem ser reabertos.
+
+#define NUM_PBOS_CAPTURA 3
+#define NUM_QUADROS_ESCRITA 8
+
+enum { FORMATO_Y4M, FORMATO_PPM, FORMATO_RGB };
+
+typedef struct {
+    unsigned char* pixels;   // RGBA, de baixo para cima como o glReadPixels devolve
+    bool foto;               // vai para um PPM proprio em vez do video
+    bool cheio;
+} QuadroCaptura;
+
+typedef struct {
+    bool ativa;                      // PBOs e thread criados
+    bool gravando;                   // quadros vao para o video
+    bool fotoPedida;                 // o proximo quadro vira uma foto
+    int largura, altura;
+    GLuint pbos[NUM_PBOS_CAPTURA];
+    bool pboCheio[NUM_PBOS_CAPTURA];
+    bool pboFoto[NUM_PBOS_CAPTURA];
+    long quadro;
+    QuadroCaptura fila[NUM_QUADROS_ESCRITA];
+    int produzidos, consumidos;      // posicoes da fila (modulo NUM_QUADROS_ESCRITA)
+    bool encerrar;
+    pthread_t escritora;
+    pthread_mutex_t mutex;
+    pthread_cond_t temQuadro;
+    FILE* saida;
+    bool saidaPipe;
+    int segmentos;                   // vezes que a saida do video ja foi aberta
+    int formato;
+    int numFoto;
+    unsigned char* conversao;        // linha convertida / planos YUV (so a escritora usa)
+} Captura;
+
+typedef struct {
+    long lidos;          // glReadPixels emitidos
+    long gravados;       // quadros escritos pela thread (atomico: a escritora soma, o frame le)
+    long descartados;    // fila da escritora cheia: o quadro falta no video
+    long fotos;
+} EstatisticasCaptura;
+
+Captura captura;
+EstatisticasCaptura estatCaptura;
+const char* arquivoGravacao = NULL; // --grava arquivo (.y4m, .ppm, outro = RGB cru; "-" = saida padrao; "|comando" = pipe)
+
+// RGBA de baixo para cima -> Y4M 4:2:0 (BT.601 faixa completa, C420jpeg)
+void escreveQuadroY4M(Captura* c, const unsigned char* rgba) {
+    int w = c->largura, h = c->altura, wc = (w + 1) / 2, hc = (h + 1) / 2;
+    unsigned char* y = c->conversao;
+    unsigned char* u = y + w * h;
+    unsigned char* v = u + wc * hc;
+    for (int l = 0; l < h; l++) {
+        const unsigned char* p = rgba + (size_t)(h - 1 - l) * w * 4;
+        for (int x = 0; x < w; x++, p += 4) y[l * w + x] = (unsigned char)(0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2] + 0.5f);
+    }
+    for (int l = 0; l < hc; l++) {
+        for (int x = 0; x < wc; x++) {
+            float r = 0.0f, g = 0.0f, b = 0.0f;
+            for (int k = 0; k < 4; k++) {
+                int px = 2 * x + (k & 1), py = 2 * l + (k >> 1);
+                if (px >= w) px = w - 1;
+                if (py >= h) py = h - 1;
+                const unsigned char* p = rgba + ((size_t)(h - 1 - py) * w + px) * 4;
+                r += p[0]; g += p[1]; b += p[2];
+            }
+            r *= 0.25f; g *= 0.25f; b *= 0.25f;
+            u[l * wc + x] = (unsigned char)fminf(fmaxf(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b + 0.5f, 0.0f), 255.0f);
+            v[l * wc + x] = (unsigned char)fminf(fmaxf(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b + 0.5f, 0.0f), 255.0f);
+        }
+    }
+    fputs("FRAME\n", c->saida);
+    fwrite(c->conversao, 1, (size_t)w * h + 2 * wc * hc, c->saida);
+}
+
+// RGBA de baixo para cima -> RGB de cima para baixo (PPM ou cru)
+void escreveQuadroRGB(Captura* c, FILE* f, const unsigned char* rgba, bool cabecalho) {
+    int w = c->largura, h = c->altura;
+    if (cabecalho) fprintf(f, "P6\n%d %d\n255\n", w, h);
+    for (int l = h - 1; l >= 0; l--) {
+        const unsigned char* p = rgba + (size_t)l * w * 4;
+        for (int x = 0; x < w; x++) {
+            c->conversao[x * 3] = p[x * 4];
+            c->conversao[x * 3 + 1] = p[x * 4 + 1];
+            c->conversao[x * 3 + 2] = p[x * 4 + 2];
+        }
+        fwrite(c->conversao, 1, (size_t)w * 3, f);
+    }
+}
 
-    glLightfv(GL_LIGHT0, GL_AMBIENT, corSolAmbiente); //define propriedade da cor do sol
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, corSolDifusa);
-    glLightfv(GL_LIGHT0, GL_SPECULAR, corSolEspecular);
-    glLightfv(GL_LIGHT0, GL_POSITION, posSol);
+void* escritoraCaptura(void* arg) {
+    Captura* c = arg;
+    for (;;) {
+        pthread_mutex_lock(&c->mutex);
+        while (c->consumidos == c->produzidos && !c->encerrar) pthread_cond_wait(&c->temQuadro, &c->mutex);
+        if (c->consumidos == c->produzidos) {
+            pthread_mutex_unlock(&c->mutex);
+            return NULL;
+        }
+        QuadroCaptura* q = &c->fila[c->consumidos % NUM_QUADROS_ESCRITA];
+        pthread_mutex_unlock(&c->mutex);
 
+        if (q->foto) {
+            char nome[64];
+            snprintf(nome, sizeof(nome), "captura_%03d.ppm", c->numFoto++);
+            FILE* f = fopen(nome, "wb");
+            if (f) {
+                escreveQuadroRGB(c, f, q->pixels, true);
+                fclose(f);
+                fprintf(stderr, "Foto gravada em %s\n", nome);
+            } else {
+                fprintf(stderr, "Nao foi possivel gravar %s\n", nome);
+            }
+        } else if (c->saida) {
+            if (c->formato == FORMATO_Y4M) escreveQuadroY4M(c, q->pixels);
+            else escreveQuadroRGB(c, c->saida, q->pixels, c->formato == FORMATO_PPM);
+            __atomic_add_fetch(&estatCaptura.gravados, 1, __ATOMIC_RELAXED);
+        }
 
-    // --- LUZ PONTUAL - POSTE (GL_LIGHT1) ---
-    // simula a lampada no topo do poste
+        pthread_mutex_lock(&c->mutex);
+        q->cheio = false;
+        c->consumidos++;
+        pthread_mutex_unlock(&c->mutex);
+    }
+}
 
+// Abre o arquivo (ou pipe) do video; o formato vem da extensao. Da segunda vez em diante o
+// arquivo vira um segmento numerado.
+bool abreSaidaCaptura(Captura* c, const char* caminho, int fps) {
+    const char* ext = strrchr(caminho, '.');
+    c->formato = FORMATO_RGB;
+    if (ext && strcmp(ext, ".y4m") == 0) c->formato = FORMATO_Y4M;
+    else if (ext && strcmp(ext, ".ppm") == 0) c->formato = FORMATO_PPM;
 
-    // cor do poste: branco quente (difusa) e posicao pontual
-    GLfloat corPosteDifusa[] = {1.2f, 1.05f, 0.85f, 1.0f}; // levemente mais forte para iluminar o chao
-    GLfloat corPosteAmbiente[] = {0.02f, 0.02f, 0.02f, 1.0f};
-    GLfloat corPosteEspecular[] = {1.0f, 1.0f, 1.0f, 1.0f};
+    c->saidaPipe = caminho[0] == '|';
+    bool padrao = strcmp(caminho, "-") == 0;
+    char segmento[1024];
+    if (c->segmentos > 0) {
+        if (padrao || c->saidaPipe) {
+            fprintf(stderr, "%s ja recebeu o video com o tamanho antigo e nao pode ser reaberto\n", caminho);
+            return false;
+        }
+        int base = ext && !strchr(ext, '/') ? (int)(ext - caminho) : (int)strlen(caminho);
+        snprintf(segmento, sizeof(segmento), "%.*s_%03d%s", base, caminho, c->segmentos, caminho + base);
+        caminho = segmento;
+    }
+    if (padrao) c->saida = stdout;
+    else if (c->saidaPipe) c->saida = popen(caminho + 1, "w");
+    else c->saida = fopen(caminho, "wb");
+    if (!c->saida) {
+        fprintf(stderr, "Nao foi possivel abrir %s para a gravacao\n", caminho);
+        return false;
+    }
+    if (c->segmentos++ > 0) fprintf(stderr, "Gravacao continua em %s\n", caminho);
+    if (c->formato == FORMATO_Y4M) fprintf(c->saida, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", c->largura, c->altura, fps);
+    return true;
+}
 
-    // W=1.0 -> luz pontual
-    GLfloat posPoste[] = {-3.0f, 3.1f, 0.0f, 1.0f};
+// Cria os PBOs, a fila e a thread escritora para quadros largura x altura
+void criaCaptura(int largura, int altura) {
+    Captura* c = &captura;
+    c->largura = largura;
+    c->altura = altura;
+    size_t tamanho = (size_t)largura * altura * 4;
+    glGenBuffers(NUM_PBOS_CAPTURA, c->pbos);
+    for (int k = 0; k < NUM_PBOS_CAPTURA; k++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, c->pbos[k]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, tamanho, NULL, GL_STREAM_READ);
+        c->pboCheio[k] = false;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    for (int k = 0; k < NUM_QUADROS_ESCRITA; k++) {
+        c->fila[k].pixels = malloc(tamanho);
+        c->fila[k].cheio = false;
+    }
+    c->conversao = malloc(tamanho);
+    c->produzidos = c->consumidos = 0;
+    c->encerrar = false;
+    pthread_mutex_init(&c->mutex, NULL);
+    pthread_cond_init(&c->temQuadro, NULL);
+    pthread_create(&c->escritora, NULL, escritoraCaptura, c);
+    c->ativa = true;
+}
 
-    glLightfv(GL_LIGHT1, GL_AMBIENT, corPosteAmbiente); //define a propriedade da luz do poste 
-    glLightfv(GL_LIGHT1, GL_DIFFUSE, corPosteDifusa);
-    glLightfv(GL_LIGHT1, GL_SPECULAR, corPosteEspecular);
-    glLightfv(GL_LIGHT1, GL_POSITION, posPoste);
+// Copia o PBO k (lido frames atras) para a fila da escritora
+void entregaPBOCaptura(int k) {
+    Captura* c = &captura;
+    c->pboCheio[k] = false;
+    pthread_mutex_lock(&c->mutex);
+    QuadroCaptura* q = &c->fila[c->produzidos % NUM_QUADROS_ESCRITA];
+    bool livre = !q->cheio;
+    pthread_mutex_unlock(&c->mutex);
+    if (!livre) {
+        if (estatCaptura.descartados++ == 0 && !c->pboFoto[k]) {
+            fprintf(stderr, "Captura: a escritora ficou para tras; quadros descartados faltam no video\n");
+        }
+        return;
+    }
 
-    // Atenuacao da luz pontual ajustada para melhor pool de luz no chao
-    // diminuimos o termo quadratico e linear para ampliar o alcance perceptivel
-    glLightf(GL_LIGHT1, GL_CONSTANT_ATTENUATION, 0.8f); //diminui intensidade base
-    glLightf(GL_LIGHT1, GL_LINEAR_ATTENUATION, 0.03f);
-    glLightf(GL_LIGHT1, GL_QUADRATIC_ATTENUATION, 0.005f); // faz a luz sumir de maneira suave
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, c->pbos[k]);
+    const void* dados = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (dados) {
+        memcpy(q->pixels, dados, (size_t)c->largura * c->altura * 4);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!dados) return;
+
+    q->foto = c->pboFoto[k];
+    pthread_mutex_lock(&c->mutex);
+    q->cheio = true;
+    c->produzidos++;
+    pthread_cond_signal(&c->temQuadro);
+    pthread_mutex_unlock(&c->mutex);
 }
 
-void drawCena() {
-    // Função que desenha todos os objetos da cena
-    // Chamada a cada frame para renderizar a cena completa
-    desenhaChao();      // Desenha o chão gramado
-    desenhaBanco();     // Desenha o banco de praça
-    desenhaPoste();     // Desenha o poste de iluminação
-    desenhaArvore();    // Desenha a árvore
+// Entrega o que ainda esta no anel, do mais antigo ao mais novo
+void esvaziaAnelCaptura() {
+    Captura* c = &captura;
+    for (int i = 0; i < NUM_PBOS_CAPTURA; i++) {
+        int k = (c->quadro + i) % NUM_PBOS_CAPTURA;
+        if (c->pboCheio[k]) entregaPBOCaptura(k);
+    }
+}
+
+// Fim do frame: le o quadro atual para um PBO e entrega o mais antigo do anel
+void capturaQuadro() {
+    Captura* c = &captura;
+    if (!c->ativa) return;
+    if (!c->gravando && !c->fotoPedida) {
+        esvaziaAnelCaptura(); // gravacao pausada: so termina de entregar o que ja foi lido
+        return;
+    }
+    int atual = c->quadro % NUM_PBOS_CAPTURA;
+    int antigo = (c->quadro + 1) % NUM_PBOS_CAPTURA; // lido NUM_PBOS_CAPTURA - 1 frames atras
+    if (c->pboCheio[atual]) entregaPBOCaptura(atual);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, c->pbos[atual]);
+    glReadPixels(0, 0, c->largura, c->altura, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    c->pboCheio[atual] = true;
+    c->pboFoto[atual] = c->fotoPedida;
+    if (c->fotoPedida) estatCaptura.fotos++;
+    c->fotoPedida = false;
+    estatCaptura.lidos++;
+    c->quadro++;
+
+    if (c->pboCheio[antigo]) entregaPBOCaptura(antigo);
+}
+
+// Entrega o anel, espera a escritora esvaziar a fila, fecha o video e libera PBOs e fila
+// (criaCaptura cria tudo de novo quando a gravacao e retomada)
+void terminaCaptura() {
+    Captura* c = &captura;
+    if (!c->ativa) return;
+    esvaziaAnelCaptura();
+    pthread_mutex_lock(&c->mutex);
+    c->encerrar = true;
+    pthread_cond_signal(&c->temQuadro);
+    pthread_mutex_unlock(&c->mutex);
+    pthread_join(c->escritora, NULL);
+    pthread_mutex_destroy(&c->mutex);
+    pthread_cond_destroy(&c->temQuadro);
+    if (c->saida && c->saidaPipe) pclose(c->saida);
+    else if (c->saida && c->saida != stdout) fclose(c->saida);
+    else if (c->saida) fflush(c->saida);
+    c->saida = NULL;
+    glDeleteBuffers(NUM_PBOS_CAPTURA, c->pbos);
+    for (int k = 0; k < NUM_QUADROS_ESCRITA; k++) {
+        free(c->fila[k].pixels);
+        c->fila[k].pixels = NULL;
+    }
+    free(c->conversao);
+    c->conversao = NULL;
+    c->ativa = false;
+    c->gravando = false;
+    if (estatCaptura.lidos > 0) {
+        fprintf(stderr, "Captura: %ld quadros lidos, %ld gravados, %ld descartados (faltam no video), %ld fotos\n",
+                estatCaptura.lidos, estatCaptura.gravados, estatCaptura.descartados, estatCaptura.fotos);
+    }
+}
+
+// Liga a captura no tamanho atual da janela; com --grava ja comeca gravando
+void iniciaCaptura(int largura, int altura) {
+    criaCaptura(largura, altura);
+    if (arquivoGravacao) captura.gravando = abreSaidaCaptura(&captura, arquivoGravacao, limiteFPS > 0 ? limiteFPS : 60);
+}
+
+// 'G': pausa/retoma a gravacao (a primeira vez abre --grava ou gravacao.y4m)
+void alternaGravacao() {
+    Captura* c = &captura;
+    if (!c->ativa) criaCaptura(windowWidth, windowHeight);
+    if (!c->saida && !abreSaidaCaptura(c, arquivoGravacao ? arquivoGravacao : "gravacao.y4m", limiteFPS > 0 ? limiteFPS : 60)) return;
+    c->gravando = !c->gravando;
+}
+
+// 'X': o proximo frame vira captura_NNN.ppm
+void pedeFoto() {
+    if (!captura.ativa) criaCaptura(windowWidth, windowHeight);
+    captura.fotoPedida = true;
+}
+
+// O video tem tamanho fixo: mudar a janela fecha a gravacao em andamento
+void capturaJanelaRedimensionada(int largura, int altura) {
+    if (!captura.ativa || (largura == captura.largura && altura == captura.altura)) return;
+    if (captura.gravando) fprintf(stderr, "Janela redimensionada: gravacao encerrada\n");
+    terminaCaptura();
+}
+
+// Quadros ainda no anel ou gravacao em andamento: o escalonador continua desenhando
+bool capturaPendente() {
+    const Captura* c = &captura;
+    if (!c->ativa) return false;
+    bool anel = false;
+    for (int k = 0; k < NUM_PBOS_CAPTURA; k++) anel = anel || c->pboCheio[k];
+    return c->gravando || c->fotoPedida || anel;
 }
 
 void keyboard(unsigned char key, int x, int y) {
@@ -453,6 +6687,7 @@ void keyboard(unsigned char key, int x, int y) {
         case 'a': // Tecla "a": liga/desliga a luz pontual do poste 
         case 'A':
             luzPontualLigada = !luzPontualLigada;
+            invalidaSombras(SOMBRA_POSTE);
             if (luzPontualLigada)
                 glEnable(GL_LIGHT1);
             else
@@ -462,86 +6697,962 @@ void keyboard(unsigned char key, int x, int y) {
         case 's': // Tecla "s": liga/desliga a luz direcional (sol) 
         case 'S':
             luzDirecionalLigada = !luzDirecionalLigada;
+            invalidaSombras(SOMBRA_SOL);
             if (luzDirecionalLigada)
                 glEnable(GL_LIGHT0);
             else
                 glDisable(GL_LIGHT0);
             break;
-    }
-    glutPostRedisplay(); 
-}
 
-void specialKeys(int key, int x, int y) {
-    float moveSpeed = 0.5f; // define a velocidade de movimento
-    
-    // converte angulos para radianos
-    float yawRad = angleYaw * M_PI / 180.0f;
-    float pitchRad = anglePitch * M_PI / 180.0f;
-    
-    // Pitch e ignorado pois se o user olhasse para o chao e apertasse para frente, ele iria para baixo
-    // Direção frontal 
-    float dirX = sin(yawRad); //cria seta invisivel que aponta para frente da camera
-    float dirZ = -cos(yawRad);
-    
-    // Direção para a direita (perpendicular à frente)
-    float rightX = cos(yawRad); // cria seta invisivel que aponta para a direita da camera. permitindo movimento lateral
-    float rightZ = sin(yawRad);
-    
-    
-    switch (key) {
-        case GLUT_KEY_UP:
-            // Avança na direção para a qual está olhando
-            cameraX += dirX * moveSpeed; //Soma o vetor frente
-            cameraZ += dirZ * moveSpeed;
+        case 'm': // Tecla "m": alterna malhas em cache / modo imediato (para comparar frame a frame)
+        case 'M':
+            modoImediato = !modoImediato;
+            fprintf(stderr, "Modo de desenho: %s\n", modoImediato ? "imediato (glBegin/glEnd)" : "malhas em cache (VBO/IBO)");
+            break;
+
+        case 'i': // Tecla "i": alterna desenho instanciado (uma chamada por tipo) / prop a prop
+        case 'I':
+            usarInstancias = !usarInstancias && instancias.programa != 0;
+            fprintf(stderr, "Props: %s\n", usarInstancias ? "instanciados" : "prop a prop");
+            break;
+
+        case 'f': // Tecla "f": liga/desliga o culling por frustum (BVH)
+        case 'F':
+            usarCulling = !usarCulling;
+            fprintf(stderr, "Culling por frustum: %s\n", usarCulling ? "ligado" : "desligado");
+            break;
+
+        case 'c': // Tecla "c": mostra os contadores de culling do ultimo frame
+        case 'C':
+            fprintf(stderr, "Culling: %d nos visitados, %d props descartados, %d props desenhados (de %d)\n",
+                    estatCulling.nosVisitados, estatCulling.descartados, estatCulling.desenhados, parque.numProps);
+            fprintf(stderr, "LOD: props por nivel %d/%d/%d, %d impostores, %ld vertices (%ld sem LOD)\n",
+                    estatLOD.props[0], estatLOD.props[1], estatLOD.props[2], impostores.numLista,
+                    estatLOD.vertices, estatLOD.verticesSemLOD);
+            fprintf(stderr, "Fila: %d itens, glMaterial %d -> %d, trocas de malha %d -> %d (sem -> com ordenacao)\n",
+                    estatFila.itens, estatFila.materialAntes, estatFila.materialDepois,
+                    estatFila.malhaAntes, estatFila.malhaDepois);
+            fprintf(stderr, "Terreno: %d blocos desenhados, %d na GPU (de %d), %d pendentes, %d faltando\n",
+                    estatTerreno.desenhados, estatTerreno.residentes, terreno.numBlocos,
+                    estatTerreno.pendentes, estatTerreno.faltando);
+            fprintf(stderr, "Luzes: %d visiveis de %d, %d referencias em clusters, no maximo %d por cluster\n",
+                    estatLuzes.visiveis, estatLuzes.luzes, estatLuzes.referencias, estatLuzes.maxPorCluster);
+            fprintf(stderr, "Sombras: mapa do sol desenhado %ld vezes (%d props), do poste %ld vezes (%d props), ultimo em %.2f ms\n",
+                    estatSombras.mapasSol, estatSombras.projetoresSol, estatSombras.mapasPoste,
+                    estatSombras.projetoresPoste, estatSombras.ultimoMs);
+            if (mapasLuz.prontos) {
+                fprintf(stderr, "Mapas de luz: chao %dx%d (%.2f m por texel), %d conjuntos, calculados em %.1f ms com %d threads\n",
+                        mapasLuz.lado, mapasLuz.lado, mapasLuz.tamanho / mapasLuz.lado, NUM_CONJUNTOS_LUZ, mapasLuz.ms,
+                        mapasLuz.threads);
+            }
+            if (travessiaAtiva()) {
+                fprintf(stderr, "Travessia: %d threads, %d blocos, lista pronta em %.3f ms\n", travessia.numThreads,
+                        travessia.numBlocos, travessia.leitura >= 0 ? travessia.listas[travessia.leitura].tempoMs : 0.0);
+            }
+            if (oclusaoAtiva()) {
+                fprintf(stderr, "Oclusao: %d consultas, %d folhas e %d props ocultos, %d respostas atrasadas\n",
+                        estatOclusao.consultas, estatOclusao.folhasOcultas, estatOclusao.propsOcultos, estatOclusao.semResposta);
+            }
+            fprintf(stderr, "Hierarquia: %d nos, %d atualizados no ultimo frame (%d props) em %.3f ms\n",
+                    hierarquia.numNos, estatHierarquia.nosAtualizados, estatHierarquia.propsAlterados, estatHierarquia.ms);
+            fprintf(stderr, "Hash espacial: %d volumes em %d baldes, %d trocaram de celula; ultima colisao testou %d volumes, "
+                    "ultima selecao %d volumes em %d celulas\n", hashEspacial.numVolumes, hashEspacial.numBaldes,
+                    estatHash.volumesMovidos, estatHash.volumesColisao, estatHash.volumesSelecao, estatHash.celulasSelecao);
+            fprintf(stderr, "Escalonador: %ld eventos de entrada, %ld frames, %ld passos de simulacao\n",
+                    estatEscalonador.eventos, estatEscalonador.quadros, estatEscalonador.passos);
+            if (usarResolucaoDinamica) {
+                float minimo, media, maximo;
+                resumoHistoricoEscala(TAMANHO_HISTORICO_ESCALA, &minimo, &media, &maximo);
+                fprintf(stderr, "Resolucao dinamica: escala %.3f (%dx%d), ultimos %d frames entre %.3f e %.3f (media %.3f), "
+                        "frame filtrado %.2f ms de %.1f ms\n", escalaRender, (int)(windowWidth * escalaRender + 0.5f),
+                        (int)(windowHeight * escalaRender + 0.5f), resolucao.numHistorico, minimo, maximo, media,
+                        resolucao.tempoFiltrado, orcamentoQuadroMs);
+            }
+            break;
+
+        case 'l': // Tecla "l": liga/desliga a iluminacao agrupada (uma luz por poste)
+        case 'L':
+            usarLuzesAgrupadas = !usarLuzesAgrupadas && agrupadas.programa != 0;
+            fprintf(stderr, "Iluminacao agrupada: %s (%d luzes)\n", usarLuzesAgrupadas ? "ligada" : "desligada", parque.numLuzes);
+            break;
+
+        case 'q': // Tecla "q": liga/desliga a fila ordenada por material
+        case 'Q':
+            usarFila = !usarFila;
+            fprintf(stderr, "Fila ordenada por material: %s\n", usarFila ? "ligada" : "desligada");
+            break;
+
+        case 'o': // Tecla "o": liga/desliga as sombras do sol e do poste
+        case 'O':
+            usarSombras = !usarSombras && sombras.programa != 0;
+            fprintf(stderr, "Sombras: %s\n", usarSombras ? "ligadas" : "desligadas");
             break;
-        case GLUT_KEY_DOWN:
-            // Recua na direção oposta
-            cameraX -= dirX * moveSpeed; //Subtrai o vetor frente
-            cameraZ -= dirZ * moveSpeed;
+
+        case 'h': // Tecla "h": liga/desliga o culling por oclusao
+        case 'H':
+            usarOclusao = !usarOclusao;
+            fprintf(stderr, "Culling por oclusao: %s\n", usarOclusao ? "ligado" : "desligado");
+            break;
+
+        case 'b': // Tecla "b": liga/desliga os impostores dos props distantes
+        case 'B':
+            usarImpostores = !usarImpostores && impostores.programa != 0;
+            fprintf(stderr, "Impostores: %s (alem de %.0f m)%s\n", usarImpostores ? "ligados" : "desligados", distanciaImpostor,
+                   usarImpostores && !impostoresAtivos() ? ", fora enquanto as luzes agrupadas, as sombras ou os mapas de luz estiverem ligados" : "");
+            break;
+
+        case 'g': // Tecla "g": comeca/pausa a gravacao do video
+        case 'G':
+            alternaGravacao();
+            fprintf(stderr, "Gravacao: %s\n", captura.gravando ? "gravando" : "pausada");
+            break;
+
+        case 'x': // Tecla "x": grava o proximo frame em captura_NNN.ppm
+        case 'X':
+            pedeFoto();
+            break;
+
+        case 't': // Tecla "t": desenha a lista do frame anterior (threads adiantadas) / espera a atual
+        case 'T':
+            travessiaAtrasada = !travessiaAtrasada;
+            fprintf(stderr, "Travessia em paralelo (%d threads): %s\n", travessia.numThreads,
+                    travessiaAtrasada ? "lista do frame anterior" : "espera a lista do frame");
+            break;
+
+        case 'd': // Tecla "d": liga/desliga o nivel de detalhe por distancia
+        case 'D':
+            usarLOD = !usarLOD;
+            fprintf(stderr, "LOD: %s\n", usarLOD ? "ligado" : "desligado");
+            break;
+
+        case 'k': // Tecla "k": liga/desliga a colisao da camera com os props
+        case 'K':
+            usarColisao = !usarColisao;
+            fprintf(stderr, "Colisao da camera: %s\n", usarColisao ? "ligada" : "desligada");
+            break;
+
+        case 'e': // Tecla "e": escolhe o prop no centro da tela (igual ao clique)
+        case 'E':
+            selecionaCentro();
+            break;
+
+        case 'j': // Tecla "j": liga/desliga os mapas de luz (calculados na primeira vez)
+        case 'J':
+            usarMapasLuz = !usarMapasLuz && mapasLuz.programa != 0;
+            if (usarMapasLuz && !mapasLuz.prontos) calculaMapasLuz();
+            fprintf(stderr, "Mapas de luz: %s\n", usarMapasLuz ? "ligados" : "desligados");
+            if (usarMapasLuz && !mapasLuzAtivos()) fprintf(stderr, "(a iluminacao agrupada e as sombras tem prioridade)\n");
             break;
-        case GLUT_KEY_LEFT:
-            // Move para a esquerda
-            cameraX -= rightX * moveSpeed; //subtrai o vetor direita
-            cameraZ -= rightZ * moveSpeed;
+
+        case 'r': // Tecla "r": liga/desliga a resolucao dinamica
+        case 'R':
+            usarResolucaoDinamica = !usarResolucaoDinamica && resolucao.programa != 0;
+            fprintf(stderr, "Resolucao dinamica: %s (orcamento %.1f ms)\n", usarResolucaoDinamica ? "ligada" : "desligada",
+                    orcamentoQuadroMs);
             break;
-        case GLUT_KEY_RIGHT:
-            // Move para a direita
-            cameraX += rightX * moveSpeed; //soma o vetor direita
-            cameraZ += rightZ * moveSpeed;
+
+        case 'p': // Tecla "p": mostra/esconde o HUD com os tempos de CPU/GPU por fase
+        case 'P':
+            mostrarHUD = !mostrarHUD;
             break;
     }
-    
-    glutPostRedisplay();
+    acordaEscalonador();
+}
+
+// Setas: so marcam a tecla como pressionada ou solta (o movimento e feito por avancaCamera)
+void marcaSeta(int key, bool pressionada) {
+    switch (key) {
+        case GLUT_KEY_UP:    setas[SETA_FRENTE] = pressionada; break;
+        case GLUT_KEY_DOWN:  setas[SETA_TRAS] = pressionada; break;
+        case GLUT_KEY_LEFT:  setas[SETA_ESQUERDA] = pressionada; break;
+        case GLUT_KEY_RIGHT: setas[SETA_DIREITA] = pressionada; break;
+        default: return;
+    }
+    acordaEscalonador();
+}
+
+void specialKeys(int key, int x, int y) {
+    marcaSeta(key, true);
+}
+
+void specialKeysUp(int key, int x, int y) {
+    marcaSeta(key, false);
+}
+
+// --- MODO HEADLESS (BENCHMARK) ---
+// Sem janela: cria um contexto OpenGL por EGL sem superficie (Mesa llvmpipe funciona sem GPU),
+// desenha num framebuffer object e percorre um caminho de camera fixo chamando display().
+// O tempo de cada frame e medido do inicio de display() ate o glFinish de trocaBuffers()
+// e o resumo sai em JSON.
+
+typedef struct {
+    int quadros;          // frames medidos
+    int aquecimento;      // frames desenhados antes da medicao (caches, compilacao de shaders)
+    int largura, altura;  // resolucao do framebuffer
+    const char* saida;    // arquivo JSON (NULL = saida padrao)
+    const char* imagem;   // PPM do ultimo frame, opcional
+} ConfigBenchmark;
+
+ConfigBenchmark configBenchmark = { 300, 10, 800, 600, NULL, NULL };
+
+bool criaContextoHeadless(int largura, int altura) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!getPlatformDisplay) {
+        fprintf(stderr, "EGL sem eglGetPlatformDisplayEXT\n");
+        return false;
+    }
+    EGLDisplay dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, NULL, NULL)) {
+        fprintf(stderr, "Nao foi possivel iniciar o display EGL surfaceless\n");
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    static const EGLint atributos[] = { EGL_NONE }; // perfil de compatibilidade (pipeline fixo + shaders)
+    EGLContext ctx = eglCreateContext(dpy, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, atributos);
+    if (ctx == EGL_NO_CONTEXT || !eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+        fprintf(stderr, "Nao foi possivel criar o contexto OpenGL headless\n");
+        return false;
+    }
+
+    // sem superficie nao ha framebuffer padrao: desenha num FBO com cor e profundidade
+    GLuint fbo, rb[2];
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGenRenderbuffers(2, rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, rb[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, largura, altura);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rb[0]);
+    glBindRenderbuffer(GL_RENDERBUFFER, rb[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, largura, altura);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rb[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Framebuffer headless incompleto\n");
+        return false;
+    }
+    fprintf(stderr, "Headless: %s, %s\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+    return true;
+}
+
+// Caminho de camera do benchmark: uma volta em circulo olhando para dentro do parque
+void posicionaCameraBenchmark(int quadro, int total) {
+    float raio = parque.extensao * 0.5f;
+    float theta = 2.0f * M_PI * quadro / total;
+    cameraX = raio * sin(theta);
+    cameraZ = raio * cos(theta);
+    cameraY = alturaTerreno(cameraX, cameraZ) + alturaOlhos;
+    angleYaw = -theta * 180.0f / M_PI + 25.0f; // -theta olharia para o centro; 25 graus para o lado
+    anglePitch = -5.0f;
+}
+
+int comparaDouble(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// percentil pelo metodo do posto mais proximo (v ja ordenado)
+double percentil(const double* v, int n, double p) {
+    int k = (int)ceil(p * n) - 1;
+    if (k < 0) k = 0;
+    if (k >= n) k = n - 1;
+    return v[k];
+}
+
+void salvaImagemPPM(const char* arquivo, int largura, int altura) {
+    unsigned char* pixels = malloc(largura * altura * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, largura, altura, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    FILE* f = fopen(arquivo, "wb");
+    if (f) {
+        fprintf(f, "P6\n%d %d\n255\n", largura, altura);
+        for (int y = altura - 1; y >= 0; y--) fwrite(pixels + y * largura * 3, 1, largura * 3, f); // PPM comeca no topo
+        fclose(f);
+    } else {
+        fprintf(stderr, "Nao foi possivel gravar %s\n", arquivo);
+    }
+    free(pixels);
+}
+
+// Tempos e contadores dos frames medidos (benchmark ou sessao reproduzida)
+typedef struct {
+    int quadros;
+    double* tempos;
+    float* escalas;
+    double somaDesenhados, somaVertices;
+    double somaLuzes, somaTravessia, somaNosHierarquia;
+    double somaConsultas, somaOcultos, somaImpostores;
+    double somaColisaoNs, somaSelecaoNs, somaSelecaoFriaNs;
+    double somaMaterialAntes, somaMaterialDepois, somaMalhaAntes, somaMalhaDepois;
+} MedicaoQuadros;
+
+MedicaoQuadros medicao;
+
+void iniciaMedicao(int capacidade) {
+    memset(&medicao, 0, sizeof(medicao));
+    medicao.tempos = malloc(sizeof(double) * (capacidade > 0 ? capacidade : 1));
+    medicao.escalas = malloc(sizeof(float) * (capacidade > 0 ? capacidade : 1));
+}
+
+// Guarda o tempo do frame que acabou de ser desenhado e soma os contadores dele
+void registraQuadroMedido(double ms, float escala) {
+    MedicaoQuadros* m = &medicao;
+    m->tempos[m->quadros] = ms;
+    m->escalas[m->quadros] = escala;
+    m->quadros++;
+    m->somaDesenhados += estatCulling.desenhados;
+    m->somaVertices += estatLOD.vertices;
+    m->somaLuzes += estatLuzes.visiveis;
+    m->somaNosHierarquia += estatHierarquia.nosAtualizados;
+    m->somaImpostores += impostores.numLista;
+    if (oclusaoAtiva()) {
+        m->somaConsultas += estatOclusao.consultas;
+        m->somaOcultos += estatOclusao.propsOcultos;
+    }
+    if (travessiaAtiva() && travessia.leitura >= 0) m->somaTravessia += travessia.listas[travessia.leitura].tempoMs;
+    double colisaoNs, selecaoFriaNs, selecaoNs;
+    medeConsultasHash(&colisaoNs, &selecaoFriaNs, &selecaoNs); // fora do tempo do frame
+    m->somaColisaoNs += colisaoNs;
+    m->somaSelecaoFriaNs += selecaoFriaNs;
+    m->somaSelecaoNs += selecaoNs;
+    m->somaMaterialAntes += estatFila.materialAntes;
+    m->somaMaterialDepois += estatFila.materialDepois;
+    m->somaMalhaAntes += estatFila.malhaAntes;
+    m->somaMalhaDepois += estatFila.malhaDepois;
+}
+
+// Resumo em JSON dos frames medidos (arquivo saida ou saida padrao); libera a medicao
+void escreveMedicao(const char* saida) {
+    MedicaoQuadros* m = &medicao;
+    int n = m->quadros > 0 ? m->quadros : 1;
+    double soma = 0.0, somaEscala = 0.0;
+    float escalaMin = 1.0f, escalaMax = 0.0f;
+    for (int i = 0; i < m->quadros; i++) {
+        soma += m->tempos[i];
+        somaEscala += m->escalas[i];
+        escalaMin = fminf(escalaMin, m->escalas[i]);
+        escalaMax = fmaxf(escalaMax, m->escalas[i]);
+    }
+    if (m->quadros == 0) escalaMin = escalaMax = 1.0f;
+    double* tempos = malloc(sizeof(double) * n); // ordenados para os percentis; m->tempos fica na ordem dos frames
+    memcpy(tempos, m->tempos, sizeof(double) * m->quadros);
+    qsort(tempos, m->quadros, sizeof(double), comparaDouble);
+
+    FILE* f = saida ? fopen(saida, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "Nao foi possivel gravar %s\n", saida);
+        f = stdout;
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"renderer\": \"%s\",\n", (const char*)glGetString(GL_RENDERER));
+    fprintf(f, "  \"largura\": %d,\n  \"altura\": %d,\n", windowWidth, windowHeight);
+    fprintf(f, "  \"props\": %d,\n", parque.numProps);
+    escreveSessaoEntrada(f);
+    fprintf(f, "  \"carga_cena_ms\": %.3f,\n  \"init_ms\": %.3f,\n", tempoCargaCena, tempoInit);
+    fprintf(f, "  \"sol\": %s,\n  \"poste\": %s,\n", luzDirecionalLigada ? "true" : "false", luzPontualLigada ? "true" : "false");
+    fprintf(f, "  \"instanciado\": %s,\n  \"culling\": %s,\n  \"lod\": %s,\n  \"fila\": %s,\n",
+            usarInstancias ? "true" : "false", usarCulling ? "true" : "false", usarLOD ? "true" : "false",
+            usarFila ? "true" : "false");
+    fprintf(f, "  \"luzes_agrupadas\": %s,\n  \"luzes\": %d,\n", luzesAgrupadasAtivas() ? "true" : "false", parque.numLuzes);
+    fprintf(f, "  \"sombras\": %s,\n  \"mapas_sombra_sol\": %ld,\n  \"mapas_sombra_poste\": %ld,\n",
+            sombrasAtivas() ? "true" : "false", estatSombras.mapasSol, estatSombras.mapasPoste);
+    fprintf(f, "  \"mapas_luz\": %s,\n  \"mapas_luz_ms\": %.3f,\n", mapasLuzAtivos() ? "true" : "false", mapasLuz.ms);
+    fprintf(f, "  \"oclusao\": %s,\n", oclusaoAtiva() ? "true" : "false");
+    fprintf(f, "  \"distancia_impostor\": %.1f,\n", impostoresAtivos() ? distanciaImpostor : 0.0);
+    fprintf(f, "  \"quadros_gravados\": %ld,\n  \"quadros_descartados\": %ld,\n", estatCaptura.gravados, estatCaptura.descartados);
+    fprintf(f, "  \"threads\": %d,\n  \"travessia_atrasada\": %s,\n", travessia.numThreads,
+            travessiaAtiva() && travessiaAtrasada ? "true" : "false");
+    fprintf(f, "  \"nos_hierarquia\": %d,\n  \"edicoes_por_quadro\": %d,\n", hierarquia.numNos, edicoesPorQuadro);
+    fprintf(f, "  \"volumes_hash\": %d,\n", hashEspacial.numVolumes);
+    fprintf(f, "  \"resolucao_dinamica\": %s,\n  \"orcamento_ms\": %.1f,\n", usarResolucaoDinamica ? "true" : "false",
+            usarResolucaoDinamica ? orcamentoQuadroMs : 0.0);
+    fprintf(f, "  \"quadros\": %d,\n", m->quadros);
+    fprintf(f, "  \"media_ms\": %.3f,\n", soma / n);
+    fprintf(f, "  \"p50_ms\": %.3f,\n", m->quadros ? percentil(tempos, m->quadros, 0.50) : 0.0);
+    fprintf(f, "  \"p95_ms\": %.3f,\n", m->quadros ? percentil(tempos, m->quadros, 0.95) : 0.0);
+    fprintf(f, "  \"p99_ms\": %.3f,\n", m->quadros ? percentil(tempos, m->quadros, 0.99) : 0.0);
+    fprintf(f, "  \"max_ms\": %.3f,\n", m->quadros ? tempos[m->quadros - 1] : 0.0);
+    fprintf(f, "  \"props_desenhados_media\": %.1f,\n", m->somaDesenhados / n);
+    fprintf(f, "  \"vertices_media\": %.1f,\n", m->somaVertices / n);
+    fprintf(f, "  \"impostores_media\": %.1f,\n", m->somaImpostores / n);
+    fprintf(f, "  \"luzes_visiveis_media\": %.1f,\n", m->somaLuzes / n);
+    fprintf(f, "  \"travessia_ms_media\": %.3f,\n", m->somaTravessia / n);
+    fprintf(f, "  \"nos_atualizados_media\": %.1f,\n", m->somaNosHierarquia / n);
+    fprintf(f, "  \"consultas_oclusao_media\": %.1f,\n", m->somaConsultas / n);
+    fprintf(f, "  \"props_ocultos_media\": %.1f,\n", m->somaOcultos / n);
+    fprintf(f, "  \"colisao_ns_media\": %.1f,\n", m->somaColisaoNs / n);
+    fprintf(f, "  \"selecao_ns_media\": %.1f,\n", m->somaSelecaoNs / n);
+    fprintf(f, "  \"selecao_fria_ns_media\": %.1f,\n", m->somaSelecaoFriaNs / n);
+    fprintf(f, "  \"material_sem_fila_media\": %.1f,\n", m->somaMaterialAntes / n);
+    fprintf(f, "  \"material_com_fila_media\": %.1f,\n", m->somaMaterialDepois / n);
+    fprintf(f, "  \"malha_sem_fila_media\": %.1f,\n", m->somaMalhaAntes / n);
+    fprintf(f, "  \"malha_com_fila_media\": %.1f,\n", m->somaMalhaDepois / n);
+    fprintf(f, "  \"escala_media\": %.4f,\n", m->quadros ? somaEscala / n : 1.0);
+    fprintf(f, "  \"escala_min\": %.4f,\n  \"escala_max\": %.4f,\n", escalaMin, escalaMax);
+    fprintf(f, "  \"historico_escala\": [");
+    for (int i = 0; i < m->quadros; i++) fprintf(f, "%s%.4f", i ? ", " : "", m->escalas[i]);
+    fprintf(f, "]\n");
+    fprintf(f, "}\n");
+    if (f != stdout) fclose(f);
+    else fflush(f);
+
+    free(tempos);
+    free(m->tempos);
+    free(m->escalas);
+    memset(m, 0, sizeof(*m));
+}
+
+int executaBenchmark() {
+    ConfigBenchmark* cfg = &configBenchmark;
+    if (!criaContextoHeadless(cfg->largura, cfg->altura)) return 1;
+    if (modoImediato) {
+        fprintf(stderr, "Modo imediato usa a geometria do glut, que precisa de janela: usando malhas em cache\n");
+        modoImediato = false;
+    }
+
+    double inicioInit = tempoAtualMs();
+    init();
+    aplicaConfiguracaoLuzes();
+    tempoInit = tempoAtualMs() - inicioInit;
+    reshape(cfg->largura, cfg->altura);
+    if (arquivoGravacao) iniciaCaptura(cfg->largura, cfg->altura);
+
+    if (iniciaReproducao()) {
+        // sessao gravada (--reproduz) no lugar do caminho fixo: todos os frames dela sao medidos
+        while (passoReproducao()) {}
+    } else {
+        int total = cfg->aquecimento + cfg->quadros;
+        iniciaMedicao(cfg->quadros);
+        for (int q = 0; q < total; q++) {
+            posicionaCameraBenchmark(q, total);
+            float escala = escalaRender; // display ja escolhe a escala do frame seguinte
+            double inicio = tempoAtualMs();
+            display();
+            double fim = tempoAtualMs();
+            if (q >= cfg->aquecimento) registraQuadroMedido(fim - inicio, escala);
+        }
+    }
+    if (cfg->imagem) salvaImagemPPM(cfg->imagem, windowWidth, windowHeight);
+    perfilColetaPendentes();
+    terminaCaptura();
+
+    GLenum erro = glGetError();
+    if (erro != GL_NO_ERROR) fprintf(stderr, "Erro OpenGL durante o benchmark: 0x%x\n", erro);
+
+    escreveMedicao(cfg->saida);
+    return 0;
+}
+
+// --- GRAVACAO E REPRODUCAO DA ENTRADA ---
+// --grava-entrada guarda num log binario tudo o que chega pelos handlers da janela (mouse,
+// teclado, inclusive as luzes 'A'/'S', setas, clique e tamanho da janela), cada evento com
+// o instante em microssegundos, mais um registro por frame (instante usado pelo escalonador
+// e escala da resolucao dinamica) e um por religada do laco (quando o tempo parado e
+// descartado). Enquanto grava, o escalonador usa esse mesmo relogio quantizado e parado
+// durante cada evento, entao a reproducao, que entrega os registros na ordem aos mesmos
+// handlers e chama simulaQuadro com o instante gravado, refaz os mesmos passos fixos e a
+// mesma interpolacao: o caminho da camera sai identico, bit a bit. Para os frames tambem
+// sairem iguais entre reproducoes, a reproducao espera os blocos do terreno e as respostas
+// da oclusao em vez de desenhar com o que ja chegou (so o texto do HUD, com tempos medidos,
+// muda). Em tempo real cada registro espera o seu instante (frames atrasados nao sao
+// pulados); com --reproducao-rapida os frames saem em seguida. Cada frame reproduzido entra
+// na medicao do benchmark e o JSON sai no fim (o --perfil continua valendo).
+//
+// Formato: CabecalhoEntrada (opcoes de desenho e camera do inicio da sessao) e depois
+// RegistroEntrada[] ate o fim do arquivo, 12 bytes cada (little-endian).
+
+#define MAGICA_ENTRADA "PRQE"
+#define VERSAO_ENTRADA 1
+
+enum { ENTRADA_QUADRO, ENTRADA_ACORDA, ENTRADA_MOUSE, ENTRADA_BOTAO, ENTRADA_TECLA, ENTRADA_SETA, ENTRADA_JANELA };
+
+typedef struct {
+    char magica[4];
+    uint32_t versao;
+    uint32_t largura, altura;     // janela no inicio da gravacao
+    uint32_t numProps;            // a cena vem das opcoes da linha de comando: so e conferida
+    uint32_t estados;             // bit i = *estadosEntrada[i]
+    int32_t edicoesPorQuadro;
+    float camera[3], yaw, pitch;
+    float orcamentoMs, distanciaImpostor, nitidez;
+} CabecalhoEntrada;
+
+typedef struct {
+    uint32_t tempo;   // us desde o inicio da gravacao
+    uint8_t tipo;     // ENTRADA_*
+    uint8_t codigo;   // tecla, seta ou botao
+    uint8_t estado;   // seta pressionada, estado do botao
+    uint8_t livre;
+    union {
+        struct { int16_t x, y; }; // posicao do mouse ou tamanho da janela
+        float escala;             // escala da resolucao dinamica no frame
+    };
+} RegistroEntrada;
+
+typedef struct {
+    FILE* gravacao;                   // --grava-entrada aberto
+    double inicio;                    // ms reais no inicio da gravacao ou da reproducao
+    uint32_t instanteUs;              // instante do evento ou frame em andamento
+    bool dentroEvento;                // um handler gravado esta rodando: o relogio fica parado
+    long gravados;
+    CabecalhoEntrada cabecalho;       // sessao carregada por --reproduz
+    const RegistroEntrada* registros; // mapeados do arquivo
+    size_t numRegistros, proximo;
+    int quadrosSessao;
+    bool reproduzindo;
+    bool rapida;                      // --reproducao-rapida
+} EntradaGravada;
+
+EntradaGravada entrada;
+const char* arquivoGravaEntrada = NULL;  // --grava-entrada
+const char* arquivoReproducao = NULL;    // --reproduz
+
+// Opcoes que mudam o desenho: gravadas no cabecalho e restauradas antes do init na reproducao
+bool* const estadosEntrada[] = {
+    &luzDirecionalLigada, &luzPontualLigada, &modoImediato, &usarInstancias, &usarCulling, &usarLOD,
+    &usarFila, &usarLuzesAgrupadas, &usarSombras, &usarMapasLuz, &usarOclusao, &usarImpostores,
+    &profundidadeImpostor, &usarColisao, &usarResolucaoDinamica, &travessiaAtrasada, &mostrarHUD,
+};
+#define NUM_ESTADOS_ENTRADA (int)(sizeof(estadosEntrada) / sizeof(estadosEntrada[0]))
+
+bool reproducaoAtiva() {
+    return entrada.reproduzindo;
+}
+
+void terminaGravacaoEntrada() {
+    if (!entrada.gravacao) return;
+    fclose(entrada.gravacao);
+    entrada.gravacao = NULL;
+    fprintf(stderr, "Entrada gravada em %s: %ld registros\n", arquivoGravaEntrada, entrada.gravados);
+}
+
+// Relogio do escalonador em ms. Gravando, conta microssegundos inteiros desde o inicio e nao
+// anda durante um evento, para a reproducao entregar exatamente os mesmos valores.
+double relogioEscalonador() {
+    EntradaGravada* g = &entrada;
+    if (g->reproduzindo || g->dentroEvento) return g->instanteUs / 1000.0;
+    if (!g->gravacao) return tempoAtualMs() - g->inicio;
+    double us = (tempoAtualMs() - g->inicio) * 1000.0;
+    if (us >= (double)UINT32_MAX) {
+        fprintf(stderr, "Gravacao da entrada encerrada: limite de %.0f minutos\n", UINT32_MAX / 60.0e6);
+        terminaGravacaoEntrada();
+        return tempoAtualMs() - g->inicio;
+    }
+    g->instanteUs = (uint32_t)us;
+    return g->instanteUs / 1000.0;
+}
+
+void escreveRegistroEntrada(RegistroEntrada* r) {
+    EntradaGravada* g = &entrada;
+    r->tempo = g->instanteUs;
+    if (fwrite(r, sizeof(*r), 1, g->gravacao) != 1) {
+        fprintf(stderr, "Falha ao gravar %s\n", arquivoGravaEntrada);
+        terminaGravacaoEntrada();
+        return;
+    }
+    g->gravados++;
+}
+
+void gravaEntrada(int tipo, int codigo, int estado, int x, int y) {
+    if (!entrada.gravacao) return;
+    RegistroEntrada r = { .tipo = tipo, .codigo = codigo, .estado = estado, .x = x, .y = y };
+    escreveRegistroEntrada(&r);
+}
+
+// O escalonador religou e descartou o tempo parado (chamado logo depois de relogioEscalonador)
+void gravaAcordaEntrada() {
+    gravaEntrada(ENTRADA_ACORDA, 0, 0, 0, 0);
+}
+
+void gravaQuadroEntrada() {
+    if (!entrada.gravacao) return;
+    RegistroEntrada r = { .tipo = ENTRADA_QUADRO, .escala = escalaRender };
+    escreveRegistroEntrada(&r);
+}
+
+// Antes de cada handler: grava o evento e para o relogio. Reproduzindo, a entrada ao vivo e ignorada.
+bool recebeEntrada(int tipo, int codigo, int estado, int x, int y) {
+    if (entrada.reproduzindo) return false;
+    if (entrada.gravacao) {
+        relogioEscalonador();
+        gravaEntrada(tipo, codigo, estado, x, y);
+        entrada.dentroEvento = true;
+    }
+    return true;
+}
+
+void fimEntrada() {
+    entrada.dentroEvento = false;
+}
+
+// Handlers registrados no GLUT: passam pela gravacao e chamam os de sempre
+void entradaMouse(int x, int y) {
+    if (!recebeEntrada(ENTRADA_MOUSE, 0, 0, x, y)) return;
+    mouseMotion(x, y);
+    fimEntrada();
+}
+
+void entradaBotao(int botao, int estado, int x, int y) {
+    if (!recebeEntrada(ENTRADA_BOTAO, botao, estado, x, y)) return;
+    mouseBotao(botao, estado, x, y);
+    fimEntrada();
+}
+
+void entradaTeclado(unsigned char key, int x, int y) {
+    if (entrada.reproduzindo && key == 27) exit(0); // o Esc ainda interrompe a reproducao
+    if (!recebeEntrada(ENTRADA_TECLA, key, 0, x, y)) return;
+    keyboard(key, x, y);
+    fimEntrada();
+}
+
+void entradaSeta(int key, int x, int y) {
+    if (!recebeEntrada(ENTRADA_SETA, key, 1, x, y)) return;
+    specialKeys(key, x, y);
+    fimEntrada();
+}
+
+void entradaSetaSolta(int key, int x, int y) {
+    if (!recebeEntrada(ENTRADA_SETA, key, 0, x, y)) return;
+    specialKeysUp(key, x, y);
+    fimEntrada();
+}
+
+void entradaJanela(int w, int h) {
+    if (!recebeEntrada(ENTRADA_JANELA, 0, 0, w, h)) return; // reproduzindo, o tamanho vem do log
+    reshape(w, h);
+    fimEntrada();
+}
+
+// Abre o log e grava o estado do inicio (chamado depois do init, antes do escalonador)
+bool iniciaGravacaoEntrada(const char* caminho) {
+    EntradaGravada* g = &entrada;
+    g->gravacao = fopen(caminho, "wb");
+    if (!g->gravacao) {
+        fprintf(stderr, "Nao foi possivel gravar %s\n", caminho);
+        return false;
+    }
+    CabecalhoEntrada c;
+    memset(&c, 0, sizeof(c));
+    memcpy(c.magica, MAGICA_ENTRADA, 4);
+    c.versao = VERSAO_ENTRADA;
+    c.largura = windowWidth;
+    c.altura = windowHeight;
+    c.numProps = parque.numProps;
+    for (int i = 0; i < NUM_ESTADOS_ENTRADA; i++) {
+        if (*estadosEntrada[i]) c.estados |= 1u << i;
+    }
+    c.edicoesPorQuadro = edicoesPorQuadro;
+    c.camera[0] = cameraX;
+    c.camera[1] = cameraY;
+    c.camera[2] = cameraZ;
+    c.yaw = angleYaw;
+    c.pitch = anglePitch;
+    c.orcamentoMs = orcamentoQuadroMs;
+    c.distanciaImpostor = distanciaImpostor;
+    c.nitidez = nitidezAmpliacao;
+    if (fwrite(&c, sizeof(c), 1, g->gravacao) != 1) {
+        fprintf(stderr, "Falha ao gravar %s\n", caminho);
+        fclose(g->gravacao);
+        g->gravacao = NULL;
+        return false;
+    }
+    g->inicio = tempoAtualMs();
+    g->instanteUs = 0;
+    return true;
+}
+
+// Mapeia a sessao (mmap, como o arquivo de cena) e aplica as opcoes gravadas no cabecalho.
+// Chamado antes do init: os mapas de luz, o atlas dos impostores etc. saem como na gravacao.
+bool carregaEntrada(const char* caminho) {
+    int fd = open(caminho, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Nao foi possivel abrir %s\n", caminho);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CabecalhoEntrada)) {
+        fprintf(stderr, "%s: arquivo de entrada muito pequeno\n", caminho);
+        close(fd);
+        return false;
+    }
+    unsigned char* mapa = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapa == MAP_FAILED) {
+        fprintf(stderr, "%s: mmap falhou\n", caminho);
+        return false;
+    }
+    const CabecalhoEntrada* c = (const CabecalhoEntrada*)mapa;
+    const char* erro = NULL;
+    if (memcmp(c->magica, MAGICA_ENTRADA, 4) != 0) erro = "nao e um arquivo de entrada";
+    else if (c->versao != VERSAO_ENTRADA) erro = "versao nao suportada";
+    else if ((st.st_size - sizeof(CabecalhoEntrada)) % sizeof(RegistroEntrada) != 0) erro = "arquivo truncado";
+    else if (c->largura == 0 || c->altura == 0) erro = "tamanho de janela invalido";
+    if (erro) {
+        fprintf(stderr, "%s: %s\n", caminho, erro);
+        munmap(mapa, st.st_size);
+        return false;
+    }
+
+    EntradaGravada* g = &entrada;
+    g->cabecalho = *c;
+    g->registros = (const RegistroEntrada*)(mapa + sizeof(CabecalhoEntrada));
+    g->numRegistros = (st.st_size - sizeof(CabecalhoEntrada)) / sizeof(RegistroEntrada);
+    for (int i = 0; i < NUM_ESTADOS_ENTRADA; i++) *estadosEntrada[i] = (c->estados >> i) & 1;
+    edicoesPorQuadro = c->edicoesPorQuadro;
+    orcamentoQuadroMs = c->orcamentoMs;
+    distanciaImpostor = c->distanciaImpostor;
+    nitidezAmpliacao = c->nitidez;
+
+    // a janela comeca no tamanho gravado; sem janela o FBO precisa caber no maior tamanho da sessao
+    int largura = c->largura, altura = c->altura;
+    g->quadrosSessao = 0;
+    for (size_t k = 0; k < g->numRegistros; k++) {
+        const RegistroEntrada* r = &g->registros[k];
+        if (r->tipo == ENTRADA_QUADRO) g->quadrosSessao++;
+        if (r->tipo == ENTRADA_JANELA && r->x > largura) largura = r->x;
+        if (r->tipo == ENTRADA_JANELA && r->y > altura) altura = r->y;
+    }
+    windowWidth = c->largura;
+    windowHeight = c->altura;
+    configBenchmark.largura = largura;
+    configBenchmark.altura = altura;
+    double segundos = g->numRegistros ? g->registros[g->numRegistros - 1].tempo / 1.0e6 : 0.0;
+    fprintf(stderr, "Entrada: %s, %zu registros, %d frames em %.1f s\n", caminho, g->numRegistros,
+            g->quadrosSessao, segundos);
+    return true;
+}
+
+// Estado do inicio da sessao depois do init: janela, camera, escalonador e medicao
+bool iniciaReproducao() {
+    EntradaGravada* g = &entrada;
+    if (!g->registros) return false;
+    const CabecalhoEntrada* c = &g->cabecalho;
+    if (c->numProps != (uint32_t)parque.numProps) {
+        fprintf(stderr, "Aviso: a sessao foi gravada com %u props e a cena tem %d (use as mesmas opcoes de cena)\n",
+                c->numProps, parque.numProps);
+    }
+    reshape(c->largura, c->altura);
+    cameraX = c->camera[0];
+    cameraY = c->camera[1];
+    cameraZ = c->camera[2];
+    angleYaw = c->yaw;
+    anglePitch = c->pitch;
+    oldMouseX = c->largura / 2;
+    oldMouseY = c->altura / 2;
+    mouseAcumuladoX = mouseAcumuladoY = 0;
+    memset(setas, 0, sizeof(setas));
+
+    Escalonador* e = &escalonador;
+    float inicial[3] = { cameraX, cameraY, cameraZ };
+    memcpy(e->anterior, inicial, sizeof(inicial));
+    memcpy(e->atual, inicial, sizeof(inicial));
+    e->acumulador = 0.0;
+    e->ultimoTempo = 0.0;
+    e->ativo = false;
+
+    iniciaMedicao(g->quadrosSessao);
+    g->proximo = 0;
+    g->reproduzindo = true;
+    g->inicio = tempoAtualMs();
+    return true;
+}
+
+// Um frame gravado: simula ate o instante dele com a mesma escala e mede o desenho
+void desenhaQuadroReproduzido(const RegistroEntrada* r) {
+    simulaQuadro(r->tempo / 1000.0);
+    esperaTerreno(); // na gravacao algum bloco podia estar chegando; aqui o frame nao depende disso
+    escalaRender = r->escala;
+    double inicio = tempoAtualMs();
+    display();
+    registraQuadroMedido(tempoAtualMs() - inicio, r->escala);
+    estatEscalonador.quadros++;
+}
+
+// Entrega os registros aos handlers ate desenhar um frame (ou esperar o instante do proximo,
+// em tempo real). Devolve false quando a sessao acaba.
+bool passoReproducao() {
+    EntradaGravada* g = &entrada;
+    while (g->proximo < g->numRegistros) {
+        const RegistroEntrada* r = &g->registros[g->proximo];
+        if (!g->rapida) {
+            double espera = r->tempo / 1000.0 - (tempoAtualMs() - g->inicio);
+            if (espera > 0.0) {
+                usleep((useconds_t)(fmin(espera, 10.0) * 1000.0)); // a janela continua respondendo
+                return true;
+            }
+        }
+        g->proximo++;
+        g->instanteUs = r->tempo;
+        switch (r->tipo) {
+            case ENTRADA_QUADRO:
+                desenhaQuadroReproduzido(r);
+                return true;
+            case ENTRADA_ACORDA:
+                escalonador.ultimoTempo = r->tempo / 1000.0;
+                escalonador.acumulador = 0.0;
+                break;
+            case ENTRADA_MOUSE:  mouseMotion(r->x, r->y); break;
+            case ENTRADA_BOTAO:  mouseBotao(r->codigo, r->estado, r->x, r->y); break;
+            case ENTRADA_SETA:
+                if (r->estado) specialKeys(r->codigo, r->x, r->y);
+                else specialKeysUp(r->codigo, r->x, r->y);
+                break;
+            case ENTRADA_JANELA:
+                if (!modoHeadless) glutReshapeWindow(r->x, r->y);
+                reshape(r->x, r->y);
+                break;
+            case ENTRADA_TECLA:
+                if (r->codigo == 27) g->proximo = g->numRegistros; // o Esc da gravacao encerra a sessao
+                else keyboard(r->codigo, r->x, r->y);
+                break;
+        }
+    }
+    return false;
+}
+
+// Campos da sessao reproduzida no JSON da medicao
+void escreveSessaoEntrada(FILE* f) {
+    EntradaGravada* g = &entrada;
+    if (!g->registros) return;
+    double segundos = g->numRegistros ? g->registros[g->numRegistros - 1].tempo / 1.0e6 : 0.0;
+    fprintf(f, "  \"sessao\": \"%s\",\n  \"reproducao\": \"%s\",\n", arquivoReproducao, g->rapida ? "rapida" : "tempo_real");
+    fprintf(f, "  \"duracao_sessao_s\": %.3f,\n  \"duracao_reproducao_s\": %.3f,\n", segundos,
+            (tempoAtualMs() - g->inicio) / 1000.0);
+    fprintf(f, "  \"camera_final\": [%.6f, %.6f, %.6f, %.6f, %.6f],\n", cameraX, cameraY, cameraZ, angleYaw, anglePitch);
+}
+
+// Laco ocioso da reproducao na janela. No fim imprime o JSON e devolve a camera ao usuario.
+void quadroReproducao() {
+    if (passoReproducao()) return;
+    escreveMedicao(configBenchmark.saida);
+    entrada.reproduzindo = false;
+    entrada.inicio = 0.0;
+    glutIdleFunc(NULL);
+    iniciaEscalonador();
 }
 
 int main(int argc, char** argv) {
+    // Opcoes proprias (as que nao sao reconhecidas ficam para o glutInit)
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--imediato") == 0) modoImediato = true;
+        else if (strcmp(argv[i], "--parque") == 0 && i + 1 < argc) numPropsParque = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cena") == 0 && i + 1 < argc) arquivoCena = argv[++i];
+        else if (strcmp(argv[i], "--terreno-mb") == 0 && i + 1 < argc) orcamentoTerrenoMB = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--salva-cena") == 0 && i + 1 < argc) arquivoSalvaCena = argv[++i];
+        else if (strcmp(argv[i], "--converte") == 0 && i + 2 < argc) {
+            const char* entrada = argv[++i];
+            const char* saida = argv[++i];
+            return converteTextoCena(entrada, saida) ? 0 : 1;
+        }
+        else if (strcmp(argv[i], "--luzes") == 0 && i + 1 < argc) {
+            const char* luzes = argv[++i];
+            luzDirecionalLigada = strcmp(luzes, "sol") == 0 || strcmp(luzes, "ambas") == 0;
+            luzPontualLigada = strcmp(luzes, "poste") == 0 || strcmp(luzes, "ambas") == 0;
+        }
+        else if (strcmp(argv[i], "--prop-a-prop") == 0) usarInstancias = false;
+        else if (strcmp(argv[i], "--sem-fila") == 0) usarFila = false;
+        else if (strcmp(argv[i], "--luzes-agrupadas") == 0) usarLuzesAgrupadas = true;
+        else if (strcmp(argv[i], "--sombras") == 0) usarSombras = true;
+        else if (strcmp(argv[i], "--mapas-luz") == 0) usarMapasLuz = true;
+        else if (strcmp(argv[i], "--oclusao") == 0) usarOclusao = true;
+        else if (strcmp(argv[i], "--impostores") == 0) usarImpostores = true;
+        else if (strcmp(argv[i], "--sem-colisao") == 0) usarColisao = false;
+        else if (strcmp(argv[i], "--headless") == 0) modoHeadless = true;
+        else if (strcmp(argv[i], "--quadros") == 0 && i + 1 < argc) configBenchmark.quadros = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--aquecimento") == 0 && i + 1 < argc) configBenchmark.aquecimento = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--largura") == 0 && i + 1 < argc) configBenchmark.largura = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--altura") == 0 && i + 1 < argc) configBenchmark.altura = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--saida") == 0 && i + 1 < argc) configBenchmark.saida = argv[++i];
+        else if (strcmp(argv[i], "--imagem") == 0 && i + 1 < argc) configBenchmark.imagem = argv[++i];
+        else if (strcmp(argv[i], "--perfil") == 0 && i + 1 < argc) arquivoPerfil = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threadsTravessia = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--travessia-sincrona") == 0) travessiaAtrasada = false;
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) limiteFPS = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--vsync") == 0) usarVsync = true;
+        else if (strcmp(argv[i], "--distancia-impostor") == 0 && i + 1 < argc) distanciaImpostor = atof(argv[++i]);
+        else if (strcmp(argv[i], "--impostor-profundidade") == 0) profundidadeImpostor = true;
+        else if (strcmp(argv[i], "--grava") == 0 && i + 1 < argc) arquivoGravacao = argv[++i];
+        else if (strcmp(argv[i], "--edicoes") == 0 && i + 1 < argc) edicoesPorQuadro = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--resolucao-dinamica") == 0 && i + 1 < argc) {
+            usarResolucaoDinamica = true;
+            orcamentoQuadroMs = atof(argv[++i]);
+            if (orcamentoQuadroMs <= 0.0f) orcamentoQuadroMs = 16.6f;
+        }
+        else if (strcmp(argv[i], "--nitidez") == 0 && i + 1 < argc) nitidezAmpliacao = atof(argv[++i]);
+        else if (strcmp(argv[i], "--grava-entrada") == 0 && i + 1 < argc) arquivoGravaEntrada = argv[++i];
+        else if (strcmp(argv[i], "--reproduz") == 0 && i + 1 < argc) arquivoReproducao = argv[++i];
+        else if (strcmp(argv[i], "--reproducao-rapida") == 0) entrada.rapida = true;
+    }
+
+    // o video na saida padrao nao pode dividi-la com o JSON do benchmark ou da reproducao
+    if (arquivoGravacao && strcmp(arquivoGravacao, "-") == 0 && (modoHeadless || arquivoReproducao) && !configBenchmark.saida) {
+        fprintf(stderr, "--grava - usa a saida padrao para o video: mande o JSON para um arquivo com --saida\n");
+        return 1;
+    }
+
+    // Sessao gravada: as opcoes de desenho do cabecalho valem no lugar das da linha de comando
+    if (arquivoReproducao && !carregaEntrada(arquivoReproducao)) return 1;
+    if (arquivoGravaEntrada && (arquivoReproducao || modoHeadless)) {
+        fprintf(stderr, "--grava-entrada ignorado: so grava a entrada ao vivo da janela\n");
+        arquivoGravaEntrada = NULL;
+    }
+
+    // Layout dos props: um arquivo de cena, um parque gerado com N props ou a cena original
+    double inicioCarga = tempoAtualMs();
+    if (arquivoCena) {
+        if (!carregaCena(arquivoCena, &parque)) return 1;
+    }
+    else if (numPropsParque > 0) geraParque(&parque, numPropsParque);
+    else criaParqueOriginal(&parque);
+    tempoCargaCena = tempoAtualMs() - inicioCarga;
+    fprintf(stderr, "Cena: %d props, %d luzes em %.2f ms\n", parque.numProps, parque.numLuzes, tempoCargaCena);
+    if (arquivoSalvaCena && !salvaCena(arquivoSalvaCena, &parque)) return 1;
+
+    atexit(fechaPerfil); // garante o CSV completo tambem ao sair pelo Esc
+    atexit(terminaTerreno); // e junta a thread do terreno
+    atexit(terminaTravessia); // e as da travessia
+    atexit(terminaCaptura); // e o fim do video
+    atexit(terminaGravacaoEntrada); // e o log da entrada
+
+    if (modoHeadless) return executaBenchmark();
+
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
     glutInitWindowPosition(100, 100);
-    glutInitWindowSize(800, 600);
+    glutInitWindowSize(windowWidth, windowHeight); // 800x600 ou o tamanho do inicio da sessao reproduzida
     glutCreateWindow("Parque Urbano ao Entardecer");
 
-    // Define as dimensões iniciais da janela
-    windowWidth = 800;
-    windowHeight = 600;
-
+    double inicioInit = tempoAtualMs();
     init();
+    aplicaConfiguracaoLuzes();
+    tempoInit = tempoAtualMs() - inicioInit;
+    fprintf(stderr, "Inicializacao (malhas, BVH, buffers): %.2f ms\n", tempoInit);
+    if (arquivoGravacao) iniciaCaptura(windowWidth, windowHeight);
 
     // Esconde o cursor do mouse
     glutSetCursor(GLUT_CURSOR_NONE);
 
-    glutDisplayFunc(display);
-    glutReshapeFunc(reshape);
-    glutKeyboardFunc(keyboard);
+    glutDisplayFunc(redesenhaJanela); // desenha pelo escalonador (laco ocioso)
+    // A entrada passa pela gravacao/reproducao (entrada*) antes dos handlers
+    glutReshapeFunc(entradaJanela);
+    glutKeyboardFunc(entradaTeclado);
     
     // Vinculação de funções de movimentação de câmera:
-    glutSpecialFunc(specialKeys);      // chama tratamento de setas do teclado
-    glutPassiveMotionFunc(mouseMotion); // Para o movimento passivo do mouse
+    glutSpecialFunc(entradaSeta);         // chama tratamento de setas do teclado
+    glutSpecialUpFunc(entradaSetaSolta);  // soltar a seta para o movimento
+    glutPassiveMotionFunc(entradaMouse);  // Para o movimento passivo do mouse
+    glutMouseFunc(entradaBotao);          // clique esquerdo escolhe o prop na mira
     
     // Posiciona o mouse no centro da tela inicialmente
     glutWarpPointer(windowWidth / 2, windowHeight / 2);
     oldMouseX = windowWidth / 2;
     oldMouseY = windowHeight / 2;
+
+    if (iniciaReproducao()) {
+        glutIdleFunc(quadroReproducao); // no fim da sessao o escalonador assume
+    } else {
+        if (arquivoGravaEntrada) iniciaGravacaoEntrada(arquivoGravaEntrada);
+        iniciaEscalonador();
+    }
     
     glutMainLoop();
 